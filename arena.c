@@ -0,0 +1,136 @@
+/**
+ * @file arena.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Bump allocator for per-command memory
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Round a size up to the arena alignment
+	*
+	* @param size byte count
+	* @return aligned byte count
+	*/
+static size_t arena_align(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+/**
+	* Put a new chunk of at least size bytes at the head of the arena
+	*
+	* @param a arena
+	* @param size minimum usable bytes
+	* @return true on success
+	*/
+static int arena_push_chunk(arena* a, size_t size) {
+	arena_chunk* c;
+
+	if ( size < ARENA_CHUNK_SIZE )
+		size = ARENA_CHUNK_SIZE;
+	if ( !(c = malloc(sizeof(arena_chunk) + size)) )
+		return 0;
+
+	c->next = a->head;
+	c->size = size;
+	c->used = 0;
+	a->head = c;
+	a->mallocs++;
+	return 1;
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Allocate memory from the arena
+	*
+	* @param a arena
+	* @param size number of bytes
+	* @return suitably aligned memory, or NULL if out of memory
+	*/
+void* arena_alloc(arena* a, size_t size) {
+	void* p;
+
+	size = arena_align(size ? size : 1);
+	if ( !a->head || a->head->size - a->head->used < size ) {
+		// Grow geometrically so a long command needs few chunks
+		size_t want = a->head ? a->head->size * 2 : 0;
+		if ( !arena_push_chunk(a, want > size ? want : size) )
+			return NULL;
+	}
+
+	p = a->head->data + a->head->used;
+	a->head->used += size;
+	a->used += size;
+	return p;
+}
+
+/**
+	* Copy a string into the arena
+	*
+	* @param a arena
+	* @param s string to copy
+	* @return the copy, or NULL if out of memory
+	*/
+char* arena_strdup(arena* a, const char* s) {
+	size_t len = strlen(s) + 1;
+	char* p = arena_alloc(a, len);
+
+	if ( p )
+		memcpy(p, s, len);
+	return p;
+}
+
+/**
+	* Release every allocation at once
+	*
+	* @param a arena
+	*/
+void arena_reset(arena* a) {
+	size_t total = a->used;
+
+	if ( !a->head )
+		return;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Several chunks were needed - replace them with one that fits it all
+	////////////////////////////////////////////////////////////////////////////////
+	if ( a->head->next ) {
+		arena_free(a);
+		arena_push_chunk(a, total);
+	}
+	else
+		a->head->used = 0;
+	a->used = 0;
+}
+
+/**
+	* Return all of the arena's memory to the heap
+	*
+	* @param a arena
+	*/
+void arena_free(arena* a) {
+	arena_chunk* c = a->head;
+
+	while ( c ) {
+		arena_chunk* next = c->next;
+		free(c);
+		c = next;
+	}
+	a->head = NULL;
+	a->used = 0;
+}
@@ -0,0 +1,79 @@
+/**
+	* @file arena.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Bump allocator owning everything built while parsing and running a
+	* single command. Resetting the arena releases it all at once.
+	*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+	* Specify the minimum size of an arena chunk in bytes
+	*/
+#define ARENA_CHUNK_SIZE (4096)
+/**
+	* Specify the alignment of every arena allocation (enough for any scalar)
+	*/
+#define ARENA_ALIGN (16)
+
+/**
+	* A contiguous block of arena memory
+	*/
+typedef struct arena_chunk {
+	struct arena_chunk* next;				///< previously filled chunk
+	size_t size;							///< usable bytes in data
+	size_t used;							///< bytes handed out from data
+	char data[];							///< the memory itself
+} arena_chunk;
+
+/**
+	* Holds a chain of chunks, the newest one at the head
+	*/
+typedef struct arena {
+	arena_chunk* head;						///< chunk currently being filled
+	size_t used;							///< bytes handed out since the last reset
+	size_t mallocs;							///< chunk allocations over the arena's life (stats arena)
+} arena;
+
+/**
+	* Allocate memory from the arena. The memory lives until the next
+	* arena_reset() or arena_free().
+	*
+	* @param a arena
+	* @param size number of bytes
+	* @return suitably aligned memory, or NULL if out of memory
+	*/
+void* arena_alloc(arena* a, size_t size);
+
+/**
+	* Copy a string into the arena
+	*
+	* @param a arena
+	* @param s string to copy
+	* @return the copy, or NULL if out of memory
+	*/
+char* arena_strdup(arena* a, const char* s);
+
+/**
+	* Release every allocation at once. The arena keeps a single chunk big
+	* enough for everything used since the last reset, so a steady stream of
+	* similar commands stops touching the heap.
+	*
+	* @param a arena
+	*/
+void arena_reset(arena* a);
+
+/**
+	* Return all of the arena's memory to the heap
+	*
+	* @param a arena
+	*/
+void arena_free(arena* a);
+
+#endif // ARENA_H
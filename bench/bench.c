@@ -0,0 +1,465 @@
+/**
+ * @file bench.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Quash benchmark harness. Generates small scripts, runs them through one
+ * or more shells and prints per-benchmark percentiles as JSON on stdout.
+ *
+ * Usage: bench [-n reps] [-t MB] [-e VAR=VALUE] shell [[-e VAR=VALUE] shell]...
+ *
+ * -e sets an environment variable for the next shell only, so the same
+ * binary can be compared against itself (e.g. -e QUASH_SPAWN=fork ./quash).
+ * -t MB runs the text utility benchmarks instead, over a generated file of
+ * that many megabytes.
+	*/
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/**
+	* Specify the default number of runs per benchmark
+	*/
+#define BENCH_DEFAULT_REPS (10)
+
+/**
+	* Specify the maximum number of environment overrides per shell
+	*/
+#define BENCH_MAX_ENV (8)
+
+/**
+	* Specify the number of external launches in the spawn benchmark
+	*/
+#define BENCH_SPAWN_CMDS (200)
+
+/**
+	* Specify the number of builtin calls in the builtin benchmark
+	*/
+#define BENCH_BUILTIN_CMDS (5000)
+
+/**
+	* Specify the number of lines in the script throughput benchmark
+	*/
+#define BENCH_SCRIPT_LINES (20000)
+
+/**
+	* Specify the number of jobs in the background benchmark
+	*/
+#define BENCH_BG_JOBS (200)
+
+/**
+	* Specify the number of stages in the pipeline benchmark
+	*/
+#define BENCH_PIPE_STAGES (10)
+
+/**
+	* Specify the bytes pushed through the pipeline benchmark
+	*/
+#define BENCH_PIPE_BYTES (64 << 20)
+
+/**
+	* Specify the number of text utility benchmarks
+	*/
+#define BENCH_TEXT_CMDS (6)
+
+/**
+	* A shell under test
+	*/
+typedef struct shell_t {
+	const char* path;						///< executable
+	char* env[BENCH_MAX_ENV];				///< VAR=VALUE overrides
+	int num_env;							///< number of overrides
+} shell_t;
+
+/**
+	* A benchmark: a generated script and how to turn run time into a figure
+	*/
+typedef struct bench_t {
+	const char* name;						///< benchmark name
+	const char* unit;						///< unit of the reported figure
+	size_t ops;								///< operations per run (lines, jobs, bytes)
+	bool rate;								///< report ops per second instead of time per op
+	double scale;							///< divides (rate) or multiplies (latency) the figure
+	char path[64];							///< generated script
+} bench_t;
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Number of runs per benchmark
+	*/
+static int reps = BENCH_DEFAULT_REPS;
+
+/**
+	* Scratch directory holding the generated scripts
+	*/
+static char dir[] = "/tmp/quash-bench-XXXXXX";
+
+/**
+	* Generated input of the text benchmarks
+	*/
+static char text_path[64];
+
+/**
+	* Text benchmarks: name as a bare word, name through /usr/bin and the
+	* command run on the generated input. A bare word runs the quash
+	* builtin, the path runs the real program. Output goes to a file, as
+	* GNU grep stops at the first match when it writes to /dev/null.
+	*/
+static const char* text_cmds[BENCH_TEXT_CMDS][3] = {
+	{ "wc_l", "wc_l_usr", "wc -l" },
+	{ "wc", "wc_usr", "wc" },
+	{ "grep_F", "grep_F_usr", "grep -F -c needle" },
+	{ "head", "head_usr", "head -n 100000000" },
+	{ "tail", "tail_usr", "tail -n 1000" },
+	{ "cut_f", "cut_f_usr", "cut -d , -f 2,4" }
+};
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Seconds between two monotonic timestamps
+	*
+	* @param a start
+	* @param b end
+	* @return elapsed seconds
+	*/
+static double elapsed(struct timespec* a, struct timespec* b) {
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/**
+	* Write a generated script
+	*
+	* @param b benchmark, receives the script path
+	* @param file name inside the scratch directory
+	* @param body first line, or NULL
+	* @param line line repeated count times
+	* @param count repeat count
+	* @return true on success
+	*/
+static bool write_script(bench_t* b, const char* file, const char* body, const char* line, size_t count) {
+	FILE* f;
+	size_t i;
+
+	snprintf(b->path, sizeof(b->path), "%s/%s", dir, file);
+	if ( !(f = fopen(b->path, "w")) ) {
+		fprintf(stderr, "bench: cannot write %s. ERRNO\"%d\"\n", b->path, errno);
+		return false;
+	}
+	if ( body )
+		fputs(body, f);
+	for ( i = 0; i < count; i++ )
+		fputs(line, f);
+	fclose(f);
+	return true;
+}
+
+/**
+	* Run one script through a shell and wait for it and everything it
+	* started. The harness is a child subreaper, so background jobs the
+	* shell leaves behind are reparented here and waited for too.
+	*
+	* @param sh shell
+	* @param script script path
+	* @return elapsed seconds, or a negative value on failure
+	*/
+static double run_once(shell_t* sh, const char* script) {
+	struct timespec t0, t1;
+	int i, status, failed = 0;
+	pid_t p;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ( (p = fork()) < 0 )
+		return -1;
+	if ( p == 0 ) {
+		int null = open("/dev/null", O_RDWR);
+
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		for ( i = 0; i < sh->num_env; i++ )
+			putenv(sh->env[i]);
+		execlp(sh->path, sh->path, script, (char*) NULL);
+		fprintf(stderr, "bench: cannot run %s. ERRNO\"%d\"\n", sh->path, errno);
+		_exit(127);
+	}
+
+	while ( (p = wait(&status)) > 0 || errno == EINTR ) {
+		if ( p > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 127 )
+			failed = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return failed ? -1 : elapsed(&t0, &t1);
+}
+
+/**
+	* Order doubles for qsort
+	*/
+static int cmp_double(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/**
+	* Nearest-rank percentile of sorted samples
+	*
+	* @param v sorted samples
+	* @param n number of samples
+	* @param p percentile (0-100)
+	* @return sample at that rank
+	*/
+static double percentile(double* v, int n, double p) {
+	int rank = (int) (p / 100.0 * n + 0.999999);
+
+	if ( rank < 1 )
+		rank = 1;
+	return v[(rank > n ? n : rank) - 1];
+}
+
+/**
+	* Run a benchmark reps times through a shell and print its JSON record
+	*
+	* @param sh shell
+	* @param b benchmark
+	* @param baseline per-run startup cost to subtract, in seconds
+	* @param first true for the first record (no leading comma)
+	* @return median run time in seconds, or a negative value on failure
+	*/
+static double run_bench(shell_t* sh, bench_t* b, double baseline, bool first) {
+	double* v = calloc(reps, sizeof(double));
+	double* raw = calloc(reps, sizeof(double));
+	double mean = 0, median;
+	int i;
+
+	for ( i = 0; i < reps; i++ ) {
+		double t = raw[i] = run_once(sh, b->path);
+
+		if ( t < 0 ) {
+			fprintf(stderr, "bench: %s failed under %s\n", b->name, sh->path);
+			free(v);
+			free(raw);
+			return -1;
+		}
+		t -= baseline;
+		if ( t <= 0 )
+			t = 1e-9;
+		v[i] = b->rate ? b->ops / t / b->scale : t / b->ops * b->scale;
+		mean += v[i] / reps;
+	}
+	qsort(v, reps, sizeof(double), cmp_double);
+	qsort(raw, reps, sizeof(double), cmp_double);
+
+	printf("%s\n    {\"shell\": \"%s\", \"env\": \"", first ? "" : ",", sh->path);
+	for ( i = 0; i < sh->num_env; i++ )
+		printf("%s%s", i ? " " : "", sh->env[i]);
+	printf("\", \"name\": \"%s\", \"unit\": \"%s\", \"runs\": %d, \"ops\": %zu, "
+		"\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}",
+		b->name, b->unit, reps, b->ops, v[0], percentile(v, reps, 50), percentile(v, reps, 90),
+		percentile(v, reps, 99), v[reps - 1], mean);
+	fflush(stdout);
+
+	median = percentile(raw, reps, 50);
+	free(v);
+	free(raw);
+	return median;
+}
+
+/**
+	* Generate the input of the text benchmarks: comma separated lines of
+	* varying length, a few of which hold the grep needle
+	*
+	* @param mb size in megabytes
+	* @return true on success
+	*/
+static bool write_text(size_t mb) {
+	static const char* words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta" };
+	unsigned seed = 1;
+	size_t total = 0;
+	FILE* f;
+
+	snprintf(text_path, sizeof(text_path), "%s/text.csv", dir);
+	if ( !(f = fopen(text_path, "w")) ) {
+		fprintf(stderr, "bench: cannot write %s. ERRNO\"%d\"\n", text_path, errno);
+		return false;
+	}
+	while ( total < mb << 20 ) {
+		int n = fprintf(f, "%u,%s,%s,%u,%s\n", seed % 100000, words[seed % 6],
+			seed % 997 ? words[(seed >> 8) % 6] : "needle", seed % 65536,
+			words[(seed >> 16) % 6]);
+
+		if ( n < 0 ) {
+			fprintf(stderr, "bench: cannot write %s. ERRNO\"%d\"\n", text_path, errno);
+			fclose(f);
+			return false;
+		}
+		total += n;
+		seed = seed * 1103515245 + 12345;
+	}
+	fclose(f);
+	return true;
+}
+
+/**
+	* Remove the generated scripts
+	*
+	* @param b benchmarks
+	* @param n number of benchmarks
+	*/
+static void cleanup(bench_t* b, int n) {
+	int i;
+
+	for ( i = 0; i < n; i++ )
+		unlink(b[i].path);
+	if ( text_path[0] ) {
+		unlink(text_path);
+		snprintf(text_path, sizeof(text_path), "%s/text.out", dir);
+		unlink(text_path);
+	}
+	rmdir(dir);
+}
+
+/**************************************************************************
+ * MAIN
+ **************************************************************************/
+
+/**
+	* Benchmark entry point
+	*
+	* @param argc argument count from the command line
+	* @param argv argument vector from the command line
+	* @return program exit status
+	*/
+int main(int argc, char** argv) {
+	shell_t* shells = calloc(argc, sizeof(shell_t));
+	int num_shells = 0, num_bench = 0, i, s;
+	bench_t bench[1 + 2 * BENCH_TEXT_CMDS];
+	char pipe_line[512], file[32];
+	size_t text_mb = 0;
+	bool first = true;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Options - -e applies to the next shell only
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 1; i < argc; i++ ) {
+		if ( !strcmp(argv[i], "-n") && i + 1 < argc && atoi(argv[i + 1]) > 0 )
+			reps = atoi(argv[++i]);
+		else if ( !strcmp(argv[i], "-t") && i + 1 < argc && atoi(argv[i + 1]) > 0 )
+			text_mb = atoi(argv[++i]);
+		else if ( !strcmp(argv[i], "-e") && i + 1 < argc && strchr(argv[i + 1], '=')
+			&& shells[num_shells].num_env < BENCH_MAX_ENV )
+			shells[num_shells].env[shells[num_shells].num_env++] = argv[++i];
+		else if ( argv[i][0] != '-' )
+			shells[num_shells++].path = argv[i];
+		else
+			num_shells = 0, i = argc;
+	}
+	if ( !num_shells ) {
+		fprintf(stderr, "Usage: %s [-n reps] [-t MB] [-e VAR=VALUE] shell [[-e VAR=VALUE] shell]...\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Scripts - plain POSIX so every shell runs the same thing
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !mkdtemp(dir) ) {
+		fprintf(stderr, "bench: cannot create %s. ERRNO\"%d\"\n", dir, errno);
+		return EXIT_FAILURE;
+	}
+
+	bench[num_bench] = (bench_t) { "startup", "ms", 1, false, 1e3, "" };
+	if ( !write_script(&bench[num_bench++], "startup.sh", NULL, "", 0) )
+		goto fail;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// -t: each text command as a bare word and through /usr/bin, so one run
+	// compares the builtins against the real programs under the same shell
+	////////////////////////////////////////////////////////////////////////////////
+	if ( text_mb ) {
+		if ( !write_text(text_mb) )
+			goto fail;
+		for ( i = 0; i < BENCH_TEXT_CMDS; i++ ) {
+			for ( s = 0; s < 2; s++ ) {
+				bench_t* b = &bench[num_bench++];
+
+				*b = (bench_t) { text_cmds[i][s], "MB/s", text_mb << 20, true, 1 << 20, "" };
+				snprintf(file, sizeof(file), "text_%d_%d.sh", i, s);
+				snprintf(pipe_line, sizeof(pipe_line), "%s%s %s > %s/text.out\n",
+					s ? "/usr/bin/" : "", text_cmds[i][2], text_path, dir);
+				if ( !write_script(b, file, pipe_line, "", 0) )
+					goto fail;
+			}
+		}
+		goto run;
+	}
+
+	bench[num_bench] = (bench_t) { "spawn_true", "us/cmd", BENCH_SPAWN_CMDS, false, 1e6, "" };
+	if ( !write_script(&bench[num_bench++], "spawn.sh", NULL, "/bin/true\n", BENCH_SPAWN_CMDS) )
+		goto fail;
+
+	snprintf(pipe_line, sizeof(pipe_line), "head -c %d /dev/zero", BENCH_PIPE_BYTES);
+	for ( i = 2; i < BENCH_PIPE_STAGES; i++ )
+		strcat(pipe_line, " | cat");
+	strcat(pipe_line, " | wc -c\n");
+	bench[num_bench] = (bench_t) { "pipeline_10", "MB/s", BENCH_PIPE_BYTES, true, 1 << 20, "" };
+	if ( !write_script(&bench[num_bench++], "pipe.sh", pipe_line, "", 0) )
+		goto fail;
+
+	bench[num_bench] = (bench_t) { "background", "jobs/s", BENCH_BG_JOBS, true, 1, "" };
+	if ( !write_script(&bench[num_bench++], "bg.sh", NULL, "/bin/true &\n", BENCH_BG_JOBS) )
+		goto fail;
+	bench[num_bench] = (bench_t) { "builtin", "us/cmd", BENCH_BUILTIN_CMDS, false, 1e6, "" };
+	if ( !write_script(&bench[num_bench++], "builtin.sh", NULL, "cd .\n", BENCH_BUILTIN_CMDS) )
+		goto fail;
+	bench[num_bench] = (bench_t) { "script", "lines/s", BENCH_SCRIPT_LINES, true, 1, "" };
+	if ( !write_script(&bench[num_bench++], "script.sh", NULL, "# comment\necho line\n",
+		BENCH_SCRIPT_LINES / 2) )
+		goto fail;
+
+run:
+	////////////////////////////////////////////////////////////////////////////////
+	// Run - startup cost is measured first and taken out of the other figures
+	////////////////////////////////////////////////////////////////////////////////
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+	printf("{\n  \"reps\": %d,\n  \"results\": [", reps);
+	for ( s = 0; s < num_shells; s++ ) {
+		double baseline = run_bench(&shells[s], &bench[0], 0, first);
+
+		first = false;
+		for ( i = 1; baseline >= 0 && i < num_bench; i++ )
+			run_bench(&shells[s], &bench[i], baseline, false);
+	}
+	printf("\n  ]\n}\n");
+
+	cleanup(bench, num_bench);
+	free(shells);
+	return EXIT_SUCCESS;
+
+fail:
+	cleanup(bench, num_bench);
+	free(shells);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,35 @@
+/**
+	* @file builtin_hash.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Hash behind the builtin registry. tools/mkbuiltins searches for a seed
+	* under which every name in builtins.def lands in its own slot of a power
+	* of two sized table, and quash looks a command name up by hashing it with
+	* the same seed and checking the single slot it lands in.
+	*/
+
+#ifndef BUILTIN_HASH_H
+#define BUILTIN_HASH_H
+
+#include <stdint.h>
+
+/**
+	* Seeded FNV-1a hash of a command name
+	*
+	* @param name NUL terminated command name
+	* @param seed seed chosen by tools/mkbuiltins
+	* @return 32 bit hash, reduced by masking with the table size - 1
+	*/
+static inline uint32_t builtin_hash(const char* name, uint32_t seed) {
+	uint32_t h = 2166136261u ^ seed;
+
+	while ( *name ) {
+		h ^= (unsigned char) *name++;
+		h *= 16777619u;
+	}
+	return h ^ (h >> 16);
+}
+
+#endif // BUILTIN_HASH_H
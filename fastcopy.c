@@ -0,0 +1,510 @@
+/**
+ * @file fastcopy.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * In-process cat, cp and tee on top of the kernel's copy calls
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "fastcopy.h"
+#include "textutil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**************************************************************************
+ * Private Types
+ **************************************************************************/
+/**
+	* Ways of moving bytes, cheapest first
+	*/
+typedef enum copy_how {
+	COPY_RANGE,								///< copy_file_range, file to file
+	COPY_SENDFILE,							///< sendfile, file to anything
+	COPY_SPLICE,							///< splice, one side a pipe
+	COPY_RW									///< read/write through a buffer
+} copy_how;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Write a whole buffer to a descriptor
+	*
+	* @param fd descriptor
+	* @param data bytes to write
+	* @param len number of bytes
+	* @return true if every byte was written
+	*/
+static bool write_all(int fd, const char* data, size_t len) {
+	while ( len ) {
+		ssize_t n = write(fd, data, len);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+	* Pick the cheapest way to copy between two descriptors. A regular file
+	* of size 0 may still have contents (as in /proc), so it is read.
+	*
+	* @param in descriptor to read
+	* @param out descriptor to write
+	* @return copy method to try first
+	*/
+static copy_how copy_pick(int in, int out) {
+	struct stat si, so;
+
+	if ( fstat(in, &si) || fstat(out, &so) )
+		return COPY_RW;
+	if ( S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode) )
+		return COPY_SPLICE;
+	if ( S_ISREG(si.st_mode) && si.st_size > 0 )
+		return S_ISREG(so.st_mode) ? COPY_RANGE : COPY_SENDFILE;
+	return COPY_RW;
+}
+
+/**
+	* Copy one buffer's worth through user space
+	*
+	* @param in descriptor to read
+	* @param off offset to read at (advanced), or NULL
+	* @param out descriptor to write
+	* @param want most bytes to copy
+	* @param buf fallback buffer, allocated on first use
+	* @return bytes copied, 0 at end of file, -1 on error
+	*/
+static ssize_t copy_rw(int in, off_t* off, int out, size_t want, char** buf) {
+	ssize_t n;
+
+	if ( !*buf && !(*buf = malloc(COPY_BUF_SIZE)) )
+		return -1;
+	if ( want > COPY_BUF_SIZE )
+		want = COPY_BUF_SIZE;
+
+	n = off ? pread(in, *buf, want, *off) : read(in, *buf, want);
+	if ( n <= 0 )
+		return n;
+	if ( !write_all(out, *buf, n) )
+		return -1;
+	if ( off )
+		*off += n;
+	return n;
+}
+
+/**
+	* Check whether a failed kernel copy should be retried another way
+	*
+	* @param err errno of the failure
+	* @return true if the descriptors just don't support that method
+	*/
+static bool copy_unsupported(int err) {
+	return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP
+		|| err == EBADF || err == ESPIPE;
+}
+
+/**
+	* Duplicate a pipe to several outputs. The first output gets a tee(2)
+	* of what is in the pipe (through a helper pipe if it is not a pipe
+	* itself), the ones in between get it through the helper pipe, and the
+	* last one consumes it.
+	*
+	* @param in pipe to read
+	* @param fds outputs
+	* @param n number of outputs (at least 2)
+	* @return true on success
+	*/
+static bool tee_pipe(int in, int* fds, int n) {
+	int helper[2] = { -1, -1 };
+	bool ok = false, first_pipe;
+	struct stat st;
+	ssize_t got;
+	int i;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The helper must hold everything in the input pipe, so each tee into it
+	// takes the whole amount
+	////////////////////////////////////////////////////////////////////////////////
+	if ( pipe2(helper, O_CLOEXEC) )
+		return false;
+	fcntl(helper[1], F_SETPIPE_SZ, fcntl(in, F_GETPIPE_SZ));
+	first_pipe = !fstat(fds[0], &st) && S_ISFIFO(st.st_mode);
+
+	for ( ;; ) {
+		got = tee(in, first_pipe ? fds[0] : helper[1], COPY_CHUNK, 0);
+		if ( got < 0 && errno == EINTR )
+			continue;
+		if ( got <= 0 ) {
+			ok = got == 0;
+			break;
+		}
+		if ( !first_pipe && copy_fd(helper[0], NULL, fds[0], got) != got )
+			break;
+
+		for ( i = 1; i < n - 1; i++ ) {
+			ssize_t dup;
+
+			while ( (dup = tee(in, helper[1], got, 0)) < 0 && errno == EINTR )
+				;
+			if ( dup != got ) {
+				if ( dup >= 0 )
+					errno = EIO;
+				break;
+			}
+			if ( copy_fd(helper[0], NULL, fds[i], got) != got )
+				break;
+		}
+		if ( i < n - 1 || copy_fd(in, NULL, fds[n - 1], got) != got )
+			break;
+	}
+
+	close(helper[0]);
+	close(helper[1]);
+	return ok;
+}
+
+/**
+	* Copy input to several outputs
+	*
+	* @param in descriptor to read
+	* @param fds outputs
+	* @param n number of outputs
+	* @return true on success
+	*/
+static bool tee_fds(int in, int* fds, int n) {
+	struct stat st;
+	off_t start, end;
+	char* buf = NULL;
+	ssize_t got;
+	int i;
+
+	if ( n == 1 )
+		return copy_fd(in, NULL, fds[0], SIZE_MAX) >= 0;
+	if ( fstat(in, &st) )
+		return false;
+	if ( S_ISFIFO(st.st_mode) )
+		return tee_pipe(in, fds, n);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A regular file is copied to each output in turn from the same offset
+	////////////////////////////////////////////////////////////////////////////////
+	if ( S_ISREG(st.st_mode) && (start = lseek(in, 0, SEEK_CUR)) >= 0 ) {
+		for ( i = 0, end = start; i < n; i++ ) {
+			off_t off = start;
+
+			if ( copy_fd(in, &off, fds[i], SIZE_MAX) < 0 )
+				return false;
+			if ( off > end )
+				end = off;
+		}
+		return lseek(in, end, SEEK_SET) >= 0;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Anything else (a terminal, a socket) is read once and written n times
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !(buf = malloc(COPY_BUF_SIZE)) )
+		return false;
+	while ( (got = read(in, buf, COPY_BUF_SIZE)) != 0 ) {
+		if ( got < 0 && errno == EINTR )
+			continue;
+		if ( got < 0 )
+			break;
+		for ( i = 0; i < n && write_all(fds[i], buf, got); i++ )
+			;
+		if ( i < n ) {
+			got = -1;
+			break;
+		}
+	}
+	free(buf);
+	return got == 0;
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Copy bytes between two descriptors with the cheapest method they
+	* allow, falling back to the next one when the kernel refuses
+	*
+	* @param in descriptor to read
+	* @param off offset to read in at (advanced), or NULL to use and move
+	* the file offset
+	* @param out descriptor to write
+	* @param len most bytes to copy, SIZE_MAX for everything up to end of file
+	* @return bytes copied, or -1 on error with errno set
+	*/
+ssize_t copy_fd(int in, off_t* off, int out, size_t len) {
+	copy_how how = copy_pick(in, out);
+	char* buf = NULL;
+	size_t done = 0;
+	int saved;
+
+	while ( done < len ) {
+		size_t want = len - done < COPY_CHUNK ? len - done : COPY_CHUNK;
+		ssize_t n;
+
+		if ( how == COPY_RANGE )
+			n = copy_file_range(in, off, out, NULL, want, 0);
+		else if ( how == COPY_SENDFILE )
+			n = sendfile(out, in, off, want);
+		else if ( how == COPY_SPLICE )
+			n = splice(in, off, out, NULL, want, SPLICE_F_MOVE);
+		else
+			n = copy_rw(in, off, out, want, &buf);
+
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 && how != COPY_RW && copy_unsupported(errno) ) {
+			how = how == COPY_RANGE ? COPY_SENDFILE : COPY_RW;
+			continue;
+		}
+		if ( n < 0 ) {
+			saved = errno;
+			free(buf);
+			errno = saved;
+			return -1;
+		}
+		if ( n == 0 )
+			break;
+		done += n;
+	}
+	free(buf);
+	return done;
+}
+
+/**
+	* cat [-u] [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int copy_cat(int argc, char** argv, int in, int out, int err) {
+	char* stdin_only[] = { "-", NULL };
+	int i, f, nfiles, status = EXIT_SUCCESS;
+	struct stat so, si;
+	bool out_reg;
+	char** files;
+
+	// -u (unbuffered) is what cat does anyway
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		if ( strcmp(argv[i], "-u") )
+			return TEXT_UNSUPPORTED;
+	}
+
+	nfiles = argc - i;
+	files = nfiles ? argv + i : stdin_only;
+	out_reg = !fstat(out, &so) && S_ISREG(so.st_mode);
+
+	for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+		bool is_stdin = !strcmp(files[f], "-");
+		int fd = is_stdin ? in : open(files[f], O_RDONLY | O_CLOEXEC);
+
+		if ( fd < 0 ) {
+			dprintf(err, "cat: %s: %s\n", files[f], strerror(errno));
+			status = EXIT_FAILURE;
+			continue;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Appending a file to itself would never reach its end
+		////////////////////////////////////////////////////////////////////////////////
+		if ( out_reg && !fstat(fd, &si) && si.st_dev == so.st_dev && si.st_ino == so.st_ino
+			&& lseek(fd, 0, SEEK_CUR) < si.st_size ) {
+			dprintf(err, "cat: %s: input file is output file\n", files[f]);
+			status = EXIT_FAILURE;
+		}
+		else if ( copy_fd(fd, NULL, out, SIZE_MAX) < 0 ) {
+			dprintf(err, "cat: %s: %s\n", files[f], strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		if ( !is_stdin )
+			close(fd);
+	}
+	return status;
+}
+
+/**
+	* cp source dest | cp source... directory
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int copy_cp(int argc, char** argv, int in, int out, int err) {
+	int i, first, status = EXIT_SUCCESS;
+	char* target = argv[argc - 1];
+	struct stat st, dt;
+	bool to_dir;
+
+	// Every option (-r, -p, -a...) is left to the real cp
+	for ( first = 1; first < argc && argv[first][0] == '-' && argv[first][1]; first++ ) {
+		if ( strcmp(argv[first], "--") )
+			return TEXT_UNSUPPORTED;
+		first++;
+		break;
+	}
+
+	if ( first >= argc ) {
+		dprintf(err, "cp: missing file operand\n");
+		return EXIT_FAILURE;
+	}
+	if ( first == argc - 1 ) {
+		dprintf(err, "cp: missing destination file operand after '%s'\n", argv[first]);
+		return EXIT_FAILURE;
+	}
+	to_dir = !stat(target, &dt) && S_ISDIR(dt.st_mode);
+	if ( !to_dir && argc - first > 2 ) {
+		if ( access(target, F_OK) )
+			dprintf(err, "cp: target '%s': %s\n", target, strerror(errno));
+		else
+			dprintf(err, "cp: target '%s' is not a directory\n", target);
+		return EXIT_FAILURE;
+	}
+
+	for ( i = first; i < argc - 1; i++ ) {
+		char* src = argv[i];
+		char* dest = target;
+		char* path = NULL;
+		int sfd, dfd;
+
+		if ( (sfd = open(src, O_RDONLY | O_CLOEXEC)) < 0 || fstat(sfd, &st) ) {
+			dprintf(err, "cp: cannot stat '%s': %s\n", src, strerror(errno));
+			if ( sfd >= 0 )
+				close(sfd);
+			status = EXIT_FAILURE;
+			continue;
+		}
+		if ( S_ISDIR(st.st_mode) ) {
+			dprintf(err, "cp: -r not specified; omitting directory '%s'\n", src);
+			close(sfd);
+			status = EXIT_FAILURE;
+			continue;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Into a directory the copy keeps the source's name
+		////////////////////////////////////////////////////////////////////////////////
+		if ( to_dir ) {
+			char* copy = strdup(src);
+
+			if ( !copy || asprintf(&path, "%s/%s", target, basename(copy)) < 0 ) {
+				free(copy);
+				close(sfd);
+				return EXIT_FAILURE;
+			}
+			free(copy);
+			dest = path;
+		}
+
+		if ( !stat(dest, &dt) && dt.st_dev == st.st_dev && dt.st_ino == st.st_ino ) {
+			dprintf(err, "cp: '%s' and '%s' are the same file\n", src, dest);
+			status = EXIT_FAILURE;
+		}
+		else if ( (dfd = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777)) < 0 ) {
+			dprintf(err, "cp: cannot create regular file '%s': %s\n", dest, strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		else {
+			if ( copy_fd(sfd, NULL, dfd, SIZE_MAX) < 0 ) {
+				dprintf(err, "cp: error copying '%s' to '%s': %s\n", src, dest, strerror(errno));
+				status = EXIT_FAILURE;
+			}
+			if ( close(dfd) && status == EXIT_SUCCESS ) {
+				dprintf(err, "cp: failed to close '%s': %s\n", dest, strerror(errno));
+				status = EXIT_FAILURE;
+			}
+		}
+		close(sfd);
+		free(path);
+	}
+	return status;
+}
+
+/**
+	* tee [-a] [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int copy_tee(int argc, char** argv, int in, int out, int err) {
+	int i, n = 0, status = EXIT_SUCCESS;
+	bool append = false;
+	int* fds;
+
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		if ( strcmp(argv[i], "-a") )
+			return TEXT_UNSUPPORTED;
+		append = true;
+	}
+
+	if ( !(fds = malloc((argc - i + 1) * sizeof(int))) )
+		return EXIT_FAILURE;
+	fds[n++] = out;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// -a seeks to the end instead of using O_APPEND, which the kernel won't
+	// splice or copy_file_range into
+	////////////////////////////////////////////////////////////////////////////////
+	for ( ; i < argc; i++ ) {
+		int fd = open(argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0666);
+
+		if ( fd < 0 || (append && lseek(fd, 0, SEEK_END) < 0 && errno != ESPIPE) ) {
+			dprintf(err, "tee: %s: %s\n", argv[i], strerror(errno));
+			if ( fd >= 0 )
+				close(fd);
+			status = EXIT_FAILURE;
+			continue;
+		}
+		fds[n++] = fd;
+	}
+
+	if ( !tee_fds(in, fds, n) ) {
+		dprintf(err, "tee: %s\n", strerror(errno));
+		status = EXIT_FAILURE;
+	}
+	for ( i = 1; i < n; i++ )
+		close(fds[i]);
+	free(fds);
+	return status;
+}
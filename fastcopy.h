@@ -0,0 +1,65 @@
+/**
+	* @file fastcopy.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* In-process cat, cp and tee. Data is moved by the kernel wherever it
+	* can be: copy_file_range between regular files, splice when one side is
+	* a pipe, sendfile from a regular file to anything else and tee(2) to
+	* duplicate a pipe. Everything else goes through a large read/write
+	* buffer.
+	*/
+
+#ifndef FASTCOPY_H
+#define FASTCOPY_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+	* Specify the size of the read/write fallback buffer in bytes
+	*/
+#define COPY_BUF_SIZE (1 << 20)
+
+/**
+	* Specify the most bytes asked of the kernel in one call
+	*/
+#define COPY_CHUNK (1 << 30)
+
+/**
+	* Copy bytes between two descriptors with the cheapest method they
+	* allow
+	*
+	* @param in descriptor to read
+	* @param off offset to read in at (advanced), or NULL to use and move
+	* the file offset
+	* @param out descriptor to write
+	* @param len most bytes to copy, SIZE_MAX for everything up to end of file
+	* @return bytes copied, or -1 on error with errno set
+	*/
+ssize_t copy_fd(int in, off_t* off, int out, size_t len);
+
+/**
+	* cat [-u] [file...]
+	*/
+int copy_cat(int argc, char** argv, int in, int out, int err);
+
+/**
+	* cp source dest | cp source... directory
+	*/
+int copy_cp(int argc, char** argv, int in, int out, int err);
+
+/**
+	* tee [-a] [file...]
+	*/
+int copy_tee(int argc, char** argv, int in, int out, int err);
+
+#endif // FASTCOPY_H
@@ -0,0 +1,217 @@
+/**
+ * @file fdreg.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Registry of the descriptors the shell creates
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "fdreg.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**************************************************************************
+ * Private Types and Variables
+ **************************************************************************/
+/**
+	* One registered descriptor
+	*/
+typedef struct fd_entry {
+	fd_owner owner;							///< who holds it (FD_UNTRACKED if nobody)
+	int id;									///< owner ID
+	const char* what;						///< short description
+} fd_entry;
+
+/**
+	* Entries indexed by descriptor number
+	*/
+static fd_entry* table = NULL;
+
+/**
+	* Number of entries in the table
+	*/
+static size_t table_size = 0;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Make room for a descriptor number, doubling the table as needed
+	*
+	* @param fd descriptor
+	* @return true if table[fd] exists
+	*/
+static bool fdreg_reserve(int fd) {
+	size_t size = table_size ? table_size : FDREG_INIT_SIZE;
+	fd_entry* grown;
+
+	if ( (size_t) fd < table_size )
+		return true;
+	while ( size <= (size_t) fd )
+		size *= 2;
+	if ( !(grown = realloc(table, size * sizeof(fd_entry))) )
+		return false;
+	memset(grown + table_size, 0, (size - table_size) * sizeof(fd_entry));
+	table = grown;
+	table_size = size;
+	return true;
+}
+
+/**
+	* Describe an entry's owner
+	*
+	* @param fd descriptor
+	* @param buf scratch space
+	* @param len size of buf
+	* @return owner text
+	*/
+static const char* fdreg_owner_name(int fd, char* buf, size_t len) {
+	fd_entry* e = ((size_t) fd < table_size) ? &table[fd] : NULL;
+
+	switch ( e ? e->owner : FD_UNTRACKED ) {
+		case FD_SHELL:
+			return "shell";
+		case FD_COMMAND:
+			snprintf(buf, len, "command %d", e->id);
+			return buf;
+		case FD_WORKER:
+			snprintf(buf, len, "worker %d", e->id);
+			return buf;
+		case FD_JOB:
+			snprintf(buf, len, "job %%%d", e->id);
+			return buf;
+		default:
+			return (fd <= STDERR_FILENO) ? "stdio" : "untracked";
+	}
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Record a descriptor the shell created
+	*
+	* @param fd descriptor, passed through untouched if negative
+	* @param owner owner kind
+	* @param id owner ID
+	* @param what short description (a string constant)
+	* @return fd
+	*/
+int fdreg_track(int fd, fd_owner owner, int id, const char* what) {
+	if ( fd >= 0 && fdreg_reserve(fd) )
+		table[fd] = (fd_entry) { owner, id, what };
+	return fd;
+}
+
+/**
+	* Hand a tracked descriptor over to a new owner
+	*
+	* @param fd descriptor
+	* @param owner owner kind
+	* @param id owner ID
+	*/
+void fdreg_move(int fd, fd_owner owner, int id) {
+	if ( fd >= 0 && (size_t) fd < table_size && table[fd].owner != FD_UNTRACKED ) {
+		table[fd].owner = owner;
+		table[fd].id = id;
+	}
+}
+
+/**
+	* Stop tracking a descriptor that is closed by other means
+	*
+	* @param fd descriptor
+	*/
+void fdreg_forget(int fd) {
+	if ( fd >= 0 && (size_t) fd < table_size )
+		table[fd].owner = FD_UNTRACKED;
+}
+
+/**
+	* Close a descriptor and stop tracking it
+	*
+	* @param fd descriptor
+	* @return result of close()
+	*/
+int fdreg_close(int fd) {
+	fdreg_forget(fd);
+	return close(fd);
+}
+
+/**
+	* Close every descriptor an owner still holds
+	*
+	* @param owner owner kind
+	* @param id owner ID, or FDREG_ANY for all owners of the kind
+	* @return number of descriptors closed
+	*/
+size_t fdreg_close_owner(fd_owner owner, int id) {
+	size_t fd, closed = 0;
+
+	for ( fd = 0; fd < table_size; fd++ ) {
+		if ( table[fd].owner == owner && (id == FDREG_ANY || table[fd].id == id) ) {
+			fdreg_close(fd);
+			closed++;
+		}
+	}
+	return closed;
+}
+
+/**
+	* Print every descriptor open in the shell
+	*
+	* @param out stream to print to
+	* @return number of descriptors that are untracked or not close-on-exec
+	* (stdin, stdout and stderr aside)
+	*/
+size_t fdreg_print(FILE* out) {
+	size_t open_fds = 0, untracked = 0, inheritable = 0;
+	char path[32], target[PATH_MAX], owner[32];
+	struct dirent* d;
+	DIR* dir;
+	ssize_t n;
+	int fd, flags;
+
+	if ( !(dir = opendir("/proc/self/fd")) ) {
+		fprintf(out, "fds: cannot list /proc/self/fd\n");
+		return 0;
+	}
+
+	fprintf(out, "%4s  %-12s %-20s %-8s %s\n", "FD", "OWNER", "WHAT", "CLOEXEC", "TARGET");
+	while ( (d = readdir(dir)) ) {
+		if ( d->d_name[0] < '0' || d->d_name[0] > '9' || (fd = atoi(d->d_name)) == dirfd(dir) )
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		if ( (n = readlink(path, target, sizeof(target) - 1)) < 0 )
+			n = 0;
+		target[n] = '\0';
+		flags = fcntl(fd, F_GETFD);
+
+		open_fds++;
+		if ( fd > STDERR_FILENO && ((size_t) fd >= table_size || table[fd].owner == FD_UNTRACKED) )
+			untracked++;
+		if ( fd > STDERR_FILENO && flags >= 0 && !(flags & FD_CLOEXEC) )
+			inheritable++;
+
+		fprintf(out, "%4d  %-12s %-20s %-8s %s\n", fd, fdreg_owner_name(fd, owner, sizeof(owner)),
+			((size_t) fd < table_size && table[fd].owner != FD_UNTRACKED) ? table[fd].what : "-",
+			(flags >= 0 && (flags & FD_CLOEXEC)) ? "yes" : "no", target);
+	}
+	closedir(dir);
+
+	fprintf(out, "%zu open, %zu untracked, %zu inherited by children\n",
+		open_fds, untracked, inheritable);
+	return untracked + inheritable;
+}
@@ -0,0 +1,104 @@
+/**
+	* @file fdreg.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Registry of the descriptors the shell creates. Each one is recorded
+	* with its owner (the shell itself, the foreground command, a parallel
+	* worker or a background job) so a forked child can drop whatever it
+	* does not own, an owner's leftovers can be closed in one go, and the
+	* fds builtin can show what is open and who holds it.
+	*/
+
+#ifndef FDREG_H
+#define FDREG_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+	* Specify the initial number of descriptors the registry has room for
+	*/
+#define FDREG_INIT_SIZE (64)
+
+/**
+	* Specify the owner ID that matches every owner of a kind
+	*/
+#define FDREG_ANY (-1)
+
+/**
+	* Who holds a descriptor
+	*/
+typedef enum fd_owner {
+	FD_UNTRACKED = 0,						///< not created through the registry
+	FD_SHELL,								///< held for the life of the shell
+	FD_COMMAND,								///< held while a foreground command runs (ID: command number)
+	FD_WORKER,								///< held for a parallel script worker (ID: script position)
+	FD_JOB									///< held for a background job (ID: job ID)
+} fd_owner;
+
+/**
+	* Record a descriptor the shell created. It should already be
+	* close-on-exec; the fds builtin flags any that are not.
+	*
+	* @param fd descriptor, passed through untouched if negative
+	* @param owner owner kind
+	* @param id owner ID
+	* @param what short description (a string constant)
+	* @return fd
+	*/
+int fdreg_track(int fd, fd_owner owner, int id, const char* what);
+
+/**
+	* Hand a tracked descriptor over to a new owner
+	*
+	* @param fd descriptor
+	* @param owner owner kind
+	* @param id owner ID
+	*/
+void fdreg_move(int fd, fd_owner owner, int id);
+
+/**
+	* Stop tracking a descriptor that is closed by other means (fclose)
+	*
+	* @param fd descriptor
+	*/
+void fdreg_forget(int fd);
+
+/**
+	* Close a descriptor and stop tracking it
+	*
+	* @param fd descriptor
+	* @return result of close()
+	*/
+int fdreg_close(int fd);
+
+/**
+	* Close every descriptor an owner still holds
+	*
+	* @param owner owner kind
+	* @param id owner ID, or FDREG_ANY for all owners of the kind
+	* @return number of descriptors closed
+	*/
+size_t fdreg_close_owner(fd_owner owner, int id);
+
+/**
+	* Print every descriptor open in the shell with its owner, whether it is
+	* close-on-exec and what it refers to. Open descriptors the registry
+	* does not know about are listed as untracked.
+	*
+	* @param out stream to print to
+	* @return number of descriptors that are untracked or not close-on-exec
+	* (stdin, stdout and stderr aside)
+	*/
+size_t fdreg_print(FILE* out);
+
+#endif // FDREG_H
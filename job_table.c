@@ -0,0 +1,307 @@
+/**
+ * @file job_table.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Background job table
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "job_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Job slots, indexed by job ID
+	*/
+static job* slots = NULL;
+
+/**
+	* Number of allocated slots
+	*/
+static int num_slots = 0;
+
+/**
+	* Slots below this index have been handed out at least once
+	*/
+static int high_water = 0;
+
+/**
+	* First free slot below high_water, -1 if none
+	*/
+static int free_head = -1;
+
+/**
+	* Oldest and newest live jobs, -1 if none
+	*/
+static int live_head = -1, live_tail = -1;
+
+/**
+	* Number of live jobs
+	*/
+static size_t live = 0;
+
+/**
+	* pid -> slot index, open addressing with linear probing, -1 is empty.
+	* Always twice the size of the slot array so it stays at most half full.
+	*/
+static int* pid_index = NULL;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Home position of a pid in the pid index
+	*
+	* @param pid process ID
+	* @return index into pid_index
+	*/
+static int pid_home(pid_t pid) {
+	return ((uint32_t) pid * 2654435761u) & (num_slots * 2 - 1);
+}
+
+/**
+	* Find the pid index position holding pid
+	*
+	* @param pid process ID
+	* @return position, or -1 if pid is not indexed
+	*/
+static int pid_find(pid_t pid) {
+	int mask = num_slots * 2 - 1;
+	int i;
+
+	if ( !pid_index )
+		return -1;
+	for ( i = pid_home(pid); pid_index[i] >= 0; i = (i + 1) & mask ) {
+		if ( slots[pid_index[i]].pid == pid )
+			return i;
+	}
+	return -1;
+}
+
+/**
+	* Index a slot under its pid
+	*
+	* @param slot slot index
+	*/
+static void pid_insert(int slot) {
+	int mask = num_slots * 2 - 1;
+	int i = pid_home(slots[slot].pid);
+
+	while ( pid_index[i] >= 0 )
+		i = (i + 1) & mask;
+	pid_index[i] = slot;
+}
+
+/**
+	* Remove a position from the pid index, shifting later entries of the
+	* same probe run back so lookups never stop early
+	*
+	* @param i position to clear
+	*/
+static void pid_erase(int i) {
+	int mask = num_slots * 2 - 1;
+	int j = i;
+
+	pid_index[i] = -1;
+	for ( ;; ) {
+		int k;
+
+		j = (j + 1) & mask;
+		if ( pid_index[j] < 0 )
+			return;
+		k = pid_home(slots[pid_index[j]].pid);
+
+		// Move j into the hole unless its home lies cyclically in (i, j]
+		if ( (i <= j) ? (k <= i || k > j) : (k <= i && k > j) ) {
+			pid_index[i] = pid_index[j];
+			pid_index[j] = -1;
+			i = j;
+		}
+	}
+}
+
+/**
+	* Double the slot array and rebuild the pid index
+	*
+	* @return true on success
+	*/
+static bool job_grow() {
+	int size = num_slots ? num_slots * 2 : JOB_TABLE_INIT_SIZE;
+	job* grown = realloc(slots, size * sizeof(job));
+	int* index;
+	int i;
+
+	if ( !grown )
+		return false;
+	slots = grown;
+
+	if ( !(index = malloc(size * 2 * sizeof(int))) )
+		return false;
+	free(pid_index);
+	pid_index = index;
+	num_slots = size;
+
+	memset(pid_index, -1, size * 2 * sizeof(int));
+	for ( i = live_head; i >= 0; i = slots[i].next ) {
+		if ( slots[i].indexed )
+			pid_insert(i);
+	}
+	return true;
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Add a job for a freshly started process
+	*
+	* @param pid process ID
+	* @param cmdstr command name (copied)
+	* @return the new job, or NULL if out of memory
+	*/
+job* job_add(pid_t pid, const char* cmdstr) {
+	char* name = strdup(cmdstr);
+	int slot;
+	job* j;
+
+	if ( !name )
+		return NULL;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Reuse a freed slot, or take a fresh one
+	////////////////////////////////////////////////////////////////////////////////
+	if ( free_head >= 0 ) {
+		slot = free_head;
+		free_head = slots[slot].next;
+	}
+	else {
+		if ( high_water == num_slots && !job_grow() ) {
+			free(name);
+			return NULL;
+		}
+		slot = high_water++;
+	}
+
+	j = &slots[slot];
+	j->cmdstr = name;
+	j->status = false;
+	j->pid = pid;
+	j->jid = slot;
+	j->indexed = true;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Append to the live list and index the pid
+	////////////////////////////////////////////////////////////////////////////////
+	j->prev = live_tail;
+	j->next = -1;
+	if ( live_tail >= 0 )
+		slots[live_tail].next = slot;
+	else
+		live_head = slot;
+	live_tail = slot;
+	live++;
+
+	pid_insert(slot);
+	return j;
+}
+
+/**
+	* Look up a job by process ID
+	*
+	* @param pid process ID
+	* @return the job, or NULL if no job still waiting to be reaped has that pid
+	*/
+job* job_by_pid(pid_t pid) {
+	int i = pid_find(pid);
+	return i < 0 ? NULL : &slots[pid_index[i]];
+}
+
+/**
+	* Look up a job by job ID
+	*
+	* @param jid job ID
+	* @return the job, or NULL if no live job has that ID
+	*/
+job* job_by_jid(int jid) {
+	if ( jid < 0 || jid >= high_water || !slots[jid].cmdstr )
+		return NULL;
+	return &slots[jid];
+}
+
+/**
+	* Drop a reaped job's pid from the pid index
+	*
+	* @param j reaped job
+	*/
+void job_unindex(job* j) {
+	int i;
+
+	if ( j->indexed && (i = pid_find(j->pid)) >= 0 )
+		pid_erase(i);
+	j->indexed = false;
+}
+
+/**
+	* Forget a job and put its slot back on the free list
+	*
+	* @param j job to remove
+	*/
+void job_remove(job* j) {
+	int slot = j->jid;
+
+	job_unindex(j);
+
+	if ( j->prev >= 0 )
+		slots[j->prev].next = j->next;
+	else
+		live_head = j->next;
+	if ( j->next >= 0 )
+		slots[j->next].prev = j->prev;
+	else
+		live_tail = j->prev;
+	live--;
+
+	free(j->cmdstr);
+	j->cmdstr = NULL;
+	j->pid = 0;
+	j->next = free_head;
+	free_head = slot;
+}
+
+/**
+	* First live job, in start order
+	*
+	* @return the oldest live job, or NULL if there are none
+	*/
+job* job_first() {
+	return live_head < 0 ? NULL : &slots[live_head];
+}
+
+/**
+	* Next live job, in start order
+	*
+	* @param j current job
+	* @return the following live job, or NULL at the end
+	*/
+job* job_next(job* j) {
+	return j->next < 0 ? NULL : &slots[j->next];
+}
+
+/**
+	* Number of live jobs
+	*
+	* @return live job count
+	*/
+size_t job_count() {
+	return live;
+}
@@ -0,0 +1,109 @@
+/**
+	* @file job_table.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Background job table. Jobs live in a growable slot array addressed by
+	* job ID, with a pid index on the side and a free list so finished slots
+	* are reused. Every operation is O(1) no matter how many jobs have run.
+	*/
+
+#ifndef JOB_TABLE_H
+#define JOB_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ring.h"
+#include "usage.h"
+
+/**
+	* Specify the initial number of job slots (power of two)
+	*/
+#define JOB_TABLE_INIT_SIZE (16)
+
+/**
+	* Holds information about a running process (job).
+	*/
+typedef struct job {
+	char* cmdstr;							///< The command issued for this process
+	bool status;							///< Status for this process (true once finished)
+	int pid;								///< Process ID #
+	int jid;								///< Job ID #
+	bool indexed;							///< pid is in the pid index (until reaped)
+	int pidfd;								///< pidfd watching the process, -1 if none
+	int out_fd;								///< read end of the output pipe, -1 once closed
+	ring_buf out;							///< captured stdout/stderr
+	struct timespec started;				///< when the job was started
+	usage used;								///< resources used, valid once finished
+	int prev;								///< previous live job, -1 at the head
+	int next;								///< next live job (or next free slot), -1 at the end
+} job;
+
+/**
+	* Add a job for a freshly started process. The job ID is the most
+	* recently freed slot, or a new one.
+	*
+	* @param pid process ID
+	* @param cmdstr command name (copied)
+	* @return the new job, or NULL if out of memory
+	*/
+job* job_add(pid_t pid, const char* cmdstr);
+
+/**
+	* Look up a job by process ID
+	*
+	* @param pid process ID
+	* @return the job, or NULL if no job still waiting to be reaped has that pid
+	*/
+job* job_by_pid(pid_t pid);
+
+/**
+	* Look up a job by job ID
+	*
+	* @param jid job ID
+	* @return the job, or NULL if no live job has that ID
+	*/
+job* job_by_jid(int jid);
+
+/**
+	* Drop a reaped job's pid from the pid index. The job keeps its slot and
+	* job ID, but job_by_pid no longer finds it once the kernel may hand the
+	* pid to another process.
+	*
+	* @param j reaped job
+	*/
+void job_unindex(job* j);
+
+/**
+	* Forget a job and put its slot back on the free list
+	*
+	* @param j job to remove
+	*/
+void job_remove(job* j);
+
+/**
+	* First live job, in start order
+	*
+	* @return the oldest live job, or NULL if there are none
+	*/
+job* job_first();
+
+/**
+	* Next live job, in start order
+	*
+	* @param j current job
+	* @return the following live job, or NULL at the end
+	*/
+job* job_next(job* j);
+
+/**
+	* Number of live jobs
+	*
+	* @return live job count
+	*/
+size_t job_count();
+
+#endif // JOB_TABLE_H
@@ -0,0 +1,231 @@
+/**
+ * @file loadable.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Builtins loaded from shared objects at run time
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "loadable.h"
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin_hash.h"
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* A loaded builtin
+	*/
+typedef struct loaded {
+	char* name;								///< command name, NULL for an empty slot
+	char* path;								///< object it was loaded from
+	void* handle;							///< dlopen handle, one reference per builtin
+	const quash_builtin* b;					///< descriptor exported by the object
+} loaded;
+
+/**
+	* Loaded builtins, open addressing with linear probing. Kept at most half
+	* full so probe runs stay short.
+	*/
+static loaded table[LOADABLE_MAX];
+
+/**
+	* Number of loaded builtins
+	*/
+static size_t num_loaded = 0;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Home slot of a name
+	*
+	* @param name command name
+	* @return index into table
+	*/
+static size_t loadable_home(const char* name) {
+	return builtin_hash(name, 0) & (LOADABLE_MAX - 1);
+}
+
+/**
+	* Find the slot holding a name, or the empty slot ending its probe run
+	*
+	* @param name command name
+	* @return index into table
+	*/
+static size_t loadable_slot(const char* name) {
+	size_t i = loadable_home(name);
+
+	while ( table[i].name && strcmp(table[i].name, name) )
+		i = (i + 1) & (LOADABLE_MAX - 1);
+	return i;
+}
+
+/**
+	* Empty a slot, shifting later entries of the same probe run back so
+	* lookups never stop early
+	*
+	* @param i slot to clear
+	*/
+static void loadable_erase(size_t i) {
+	size_t j = i, k;
+
+	table[i].name = NULL;
+	for ( ;; ) {
+		j = (j + 1) & (LOADABLE_MAX - 1);
+		if ( !table[j].name )
+			return;
+		k = loadable_home(table[j].name);
+
+		// Move j into the hole unless its home lies cyclically in (i, j]
+		if ( (i <= j) ? (k <= i || k > j) : (k <= i && k > j) ) {
+			table[i] = table[j];
+			table[j].name = NULL;
+			i = j;
+		}
+	}
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Load a builtin from a shared object
+	*
+	* @param path shared object
+	* @param name builtin to load, exported as quash_builtin_<name>
+	* @return NULL on success, otherwise a description of the failure
+	*/
+const char* loadable_enable(const char* path, const char* name) {
+	char symbol[sizeof(QUASH_BUILTIN_SYMBOL_PREFIX) + 256];
+	const quash_builtin* b;
+	char* name_copy;
+	char* path_copy;
+	void* handle;
+	size_t i;
+
+	if ( strlen(name) > 255 )
+		return "builtin name too long";
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Open the object and find the builtin's descriptor
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !(handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) )
+		return dlerror();
+
+	snprintf(symbol, sizeof(symbol), QUASH_BUILTIN_SYMBOL_PREFIX "%s", name);
+	if ( !(b = dlsym(handle, symbol)) ) {
+		dlclose(handle);
+		return "no such builtin in the object";
+	}
+	if ( b->abi_version != QUASH_BUILTIN_ABI_VERSION || !b->fn ) {
+		dlclose(handle);
+		return "builtin was built for a different quash";
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Replace a builtin loaded under the same name, or take a fresh slot
+	////////////////////////////////////////////////////////////////////////////////
+	i = loadable_slot(name);
+	if ( !table[i].name && num_loaded >= LOADABLE_MAX / 2 ) {
+		dlclose(handle);
+		return "too many loaded builtins";
+	}
+	name_copy = strdup(name);
+	path_copy = strdup(path);
+	if ( !name_copy || !path_copy ) {
+		free(name_copy);
+		free(path_copy);
+		dlclose(handle);
+		return "out of memory";
+	}
+
+	if ( table[i].name ) {
+		free(table[i].name);
+		free(table[i].path);
+		dlclose(table[i].handle);
+	}
+	else
+		num_loaded++;
+
+	table[i].name = name_copy;
+	table[i].path = path_copy;
+	table[i].handle = handle;
+	table[i].b = b;
+	return NULL;
+}
+
+/**
+	* Unload a builtin
+	*
+	* @param name builtin name
+	* @return true if the builtin was loaded
+	*/
+bool loadable_disable(const char* name) {
+	size_t i = loadable_slot(name);
+
+	if ( !table[i].name )
+		return false;
+
+	free(table[i].name);
+	free(table[i].path);
+	dlclose(table[i].handle);
+	loadable_erase(i);
+	num_loaded--;
+	return true;
+}
+
+/**
+	* Look up a loaded builtin
+	*
+	* @param name command name
+	* @return the builtin, or NULL if no builtin of that name is loaded
+	*/
+const quash_builtin* loadable_find(const char* name) {
+	size_t i;
+
+	if ( !num_loaded )
+		return NULL;
+	i = loadable_slot(name);
+	return table[i].name ? table[i].b : NULL;
+}
+
+/**
+	* Run a loaded builtin
+	*
+	* @param b builtin
+	* @param argc number of arguments
+	* @param argv arguments (NULL terminated)
+	* @param in descriptor to read input from
+	* @param out descriptor to write output to
+	* @param err descriptor to write diagnostics to
+	* @return the builtin's exit status
+	*/
+int loadable_run(const quash_builtin* b, int argc, char** argv, int in, int out, int err) {
+	quash_builtin_args args = { sizeof(args), argc, argv, in, out, err };
+
+	return b->fn(&args);
+}
+
+/**
+	* Print every loaded builtin along with the object it came from
+	*
+	* @param out stream to print to
+	*/
+void loadable_print(FILE* out) {
+	size_t i;
+
+	for ( i = 0; i < LOADABLE_MAX; i++ ) {
+		if ( table[i].name )
+			fprintf(out, "enable -f %s %s\n", table[i].path, table[i].name);
+	}
+}
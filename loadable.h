@@ -0,0 +1,79 @@
+/**
+	* @file loadable.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Builtins loaded from shared objects at run time (enable -f). Loaded
+	* builtins are kept in a small hash table next to the generated registry
+	* of the compiled-in builtins.
+	*/
+
+#ifndef LOADABLE_H
+#define LOADABLE_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "quash_builtin.h"
+
+/**
+	* Specify the maximum number of loaded builtins (power of two)
+	*/
+#define LOADABLE_MAX (64)
+
+/**
+	* Load a builtin from a shared object. A builtin of the same name that
+	* is already loaded is replaced.
+	*
+	* @param path shared object (searched like dlopen does if it has no '/')
+	* @param name builtin to load, exported as quash_builtin_<name>
+	* @return NULL on success, otherwise a description of the failure
+	*/
+const char* loadable_enable(const char* path, const char* name);
+
+/**
+	* Unload a builtin. The shared object is closed once none of its
+	* builtins remain loaded.
+	*
+	* @param name builtin name
+	* @return true if the builtin was loaded
+	*/
+bool loadable_disable(const char* name);
+
+/**
+	* Look up a loaded builtin
+	*
+	* @param name command name
+	* @return the builtin, or NULL if no builtin of that name is loaded
+	*/
+const quash_builtin* loadable_find(const char* name);
+
+/**
+	* Run a loaded builtin
+	*
+	* @param b builtin
+	* @param argc number of arguments
+	* @param argv arguments (NULL terminated)
+	* @param in descriptor to read input from
+	* @param out descriptor to write output to
+	* @param err descriptor to write diagnostics to
+	* @return the builtin's exit status
+	*/
+int loadable_run(const quash_builtin* b, int argc, char** argv, int in, int out, int err);
+
+/**
+	* Print every loaded builtin along with the object it came from
+	*
+	* @param out stream to print to
+	*/
+void loadable_print(FILE* out);
+
+#endif // LOADABLE_H
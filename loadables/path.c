@@ -0,0 +1,114 @@
+/**
+ * @file path.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Example loadable builtins: basename and dirname without the fork+exec.
+ *
+ *   make loadables
+ *   enable -f loadables/path.so basename dirname
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "quash_builtin.h"
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Write a string and a newline
+	*
+	* @param fd descriptor
+	* @param s string
+	* @param len bytes of s to write
+	* @return exit status
+	*/
+static int put_line(int fd, const char* s, size_t len) {
+	struct iovec iov[2] = { { (void*) s, len }, { "\n", 1 } };
+
+	return writev(fd, iov, 2) == (ssize_t) len + 1 ? 0 : 1;
+}
+
+/**
+	* Length of a path without its trailing slashes (a lone "/" is kept)
+	*
+	* @param path path
+	* @return length
+	*/
+static size_t trimmed_len(const char* path) {
+	size_t len = strlen(path);
+
+	while ( len > 1 && path[len - 1] == '/' )
+		len--;
+	return len;
+}
+
+/**
+	* basename path [suffix]
+	*
+	* @param args arguments and descriptors
+	* @return exit status
+	*/
+static int basename_builtin(const quash_builtin_args* args) {
+	const char* path;
+	size_t len, start, slen;
+
+	if ( args->argc < 2 || args->argc > 3 ) {
+		dprintf(args->err, "basename: usage: basename path [suffix]\n");
+		return 1;
+	}
+	path = args->argv[1];
+	len = trimmed_len(path);
+	if ( len == 1 && path[0] == '/' )
+		return put_line(args->out, "/", 1);
+
+	for ( start = len; start && path[start - 1] != '/'; start-- )
+		;
+	if ( args->argc == 3 ) {
+		slen = strlen(args->argv[2]);
+		if ( slen < len - start && !memcmp(path + len - slen, args->argv[2], slen) )
+			len -= slen;
+	}
+	return put_line(args->out, path + start, len - start);
+}
+
+/**
+	* dirname path
+	*
+	* @param args arguments and descriptors
+	* @return exit status
+	*/
+static int dirname_builtin(const quash_builtin_args* args) {
+	const char* path;
+	size_t len;
+
+	if ( args->argc != 2 ) {
+		dprintf(args->err, "dirname: usage: dirname path\n");
+		return 1;
+	}
+	path = args->argv[1];
+	len = trimmed_len(path);
+
+	// Drop the last component, then the slashes before it
+	while ( len && path[len - 1] != '/' )
+		len--;
+	if ( !len )
+		return put_line(args->out, ".", 1);
+	while ( len > 1 && path[len - 1] == '/' )
+		len--;
+	return put_line(args->out, path, len);
+}
+
+/**************************************************************************
+ * Exported Builtins
+ **************************************************************************/
+QUASH_BUILTIN(basename, basename_builtin);
+QUASH_BUILTIN(dirname, dirname_builtin);
@@ -0,0 +1,277 @@
+/**
+ * @file path_hash.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Hashed $PATH lookup cache
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "path_hash.h"
+#include "vars.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**************************************************************************
+ * Private Types and Variables
+ **************************************************************************/
+/**
+	* One cached command
+	*/
+typedef struct path_entry {
+	char* name;								///< command name (NULL marks an empty slot)
+	char* path;								///< resolved path (NULL once forgotten)
+	unsigned long hits;						///< number of lookups served from the table
+} path_entry;
+
+/**
+	* Open addressing table of cached commands
+	*/
+static path_entry* table = NULL;
+
+/**
+	* Number of slots in the table (always a power of two)
+	*/
+static size_t table_size = 0;
+
+/**
+	* Number of used slots in the table
+	*/
+static size_t table_used = 0;
+
+/**
+	* Lookups answered from the table
+	*/
+static unsigned long total_hits = 0;
+
+/**
+	* Lookups that had to search $PATH
+	*/
+static unsigned long total_misses = 0;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* FNV-1a string hash
+	*
+	* @param s string to hash
+	* @return hash value
+	*/
+static uint32_t path_hash_str(const char* s) {
+	uint32_t h = 2166136261u;
+	while ( *s ) {
+		h ^= (unsigned char) *s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+	* Find the slot holding name, or the empty slot it would be placed in
+	*
+	* @param name command name
+	* @return slot pointer
+	*/
+static path_entry* path_hash_slot(const char* name) {
+	size_t i = path_hash_str(name) & (table_size - 1);
+	while ( table[i].name && strcmp(table[i].name, name) )
+		i = (i + 1) & (table_size - 1);
+	return &table[i];
+}
+
+/**
+	* Double the table once it is three quarters full
+	*
+	* @return true if there is room for another entry
+	*/
+static bool path_hash_grow() {
+	path_entry* old = table;
+	size_t old_size = table_size;
+	size_t i;
+
+	if ( table && (table_used + 1) * 4 < table_size * 3 )
+		return true;
+
+	table_size = old ? old_size * 2 : PATH_HASH_INIT_SIZE;
+	table = calloc(table_size, sizeof(path_entry));
+	if ( !table ) {
+		table = old;
+		table_size = old_size;
+		return old != NULL && table_used + 1 < table_size;
+	}
+
+	for ( i = 0; i < old_size; i++ ) {
+		if ( old[i].name )
+			*path_hash_slot(old[i].name) = old[i];
+	}
+	free(old);
+	return true;
+}
+
+/**
+	* Walk $PATH looking for an executable regular file
+	*
+	* @param name command name
+	* @param cacheable set to false if the match came from a relative $PATH
+	*                  entry (it would go stale on the next cd)
+	* @return malloc'd path, or NULL if not found
+	*/
+static char* path_hash_search(const char* name, bool* cacheable) {
+	const char* dirs = vars_get("PATH");
+	const char* dir;
+	const char* end;
+	size_t name_len = strlen(name);
+	struct stat st;
+
+	*cacheable = true;
+	if ( !dirs )
+		dirs = "/bin:/usr/bin";
+
+	for ( dir = dirs; ; dir = end + 1 ) {
+		end = strchrnul(dir, ':');
+		size_t dir_len = end - dir;
+		char* cand = malloc(dir_len + name_len + 3);
+
+		if ( !cand )
+			return NULL;
+
+		////////////////////////////////////////////////////////////////////////////////
+		// An empty $PATH entry means the current directory
+		////////////////////////////////////////////////////////////////////////////////
+		if ( dir_len == 0 ) {
+			strcpy(cand, "./");
+			dir_len = 2;
+		}
+		else {
+			memcpy(cand, dir, dir_len);
+			cand[dir_len++] = '/';
+		}
+		memcpy(cand + dir_len, name, name_len + 1);
+
+		if ( !stat(cand, &st) && S_ISREG(st.st_mode) && !access(cand, X_OK) ) {
+			*cacheable = (cand[0] == '/');
+			return cand;
+		}
+		free(cand);
+
+		if ( !*end )
+			return NULL;
+	}
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Resolve a command name to an executable path
+	*
+	* @param name command name
+	* @return path to execute, or NULL if the command could not be found
+	*/
+const char* path_hash_lookup(const char* name) {
+	path_entry* e;
+	bool cacheable;
+	char* path;
+
+	if ( strchr(name, '/') )
+		return name;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Hit
+	////////////////////////////////////////////////////////////////////////////////
+	if ( table ) {
+		e = path_hash_slot(name);
+		if ( e->name && e->path ) {
+			e->hits++;
+			total_hits++;
+			return e->path;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Miss - search $PATH and remember the answer
+	////////////////////////////////////////////////////////////////////////////////
+	total_misses++;
+	if ( !(path = path_hash_search(name, &cacheable)) )
+		return NULL;
+
+	if ( !cacheable || !path_hash_grow() ) {
+		// Not cacheable: hand out a buffer that lives until the next call
+		static char* scratch = NULL;
+		free(scratch);
+		scratch = path;
+		return scratch;
+	}
+
+	e = path_hash_slot(name);
+	if ( !e->name ) {
+		if ( !(e->name = strdup(name)) ) {
+			free(path);
+			return NULL;
+		}
+		e->hits = 0;
+		table_used++;
+	}
+	e->path = path;
+	return e->path;
+}
+
+/**
+	* Drop the cached path of a single command
+	*
+	* @param name command name
+	*/
+void path_hash_forget(const char* name) {
+	path_entry* e;
+
+	if ( !table )
+		return;
+	e = path_hash_slot(name);
+	if ( e->name ) {
+		free(e->path);
+		e->path = NULL;
+	}
+}
+
+/**
+	* Drop every cached path
+	*/
+void path_hash_flush() {
+	size_t i;
+
+	for ( i = 0; i < table_size; i++ ) {
+		free(table[i].name);
+		free(table[i].path);
+	}
+	if ( table )
+		memset(table, 0, table_size * sizeof(path_entry));
+	table_used = 0;
+}
+
+/**
+	* Print every cached command along with the hit/miss counters
+	*
+	* @param out stream to print to
+	*/
+void path_hash_print(FILE* out) {
+	size_t i;
+
+	if ( table_used )
+		fprintf(out, "hits\tcommand\n");
+	for ( i = 0; i < table_size; i++ ) {
+		if ( table[i].name && table[i].path )
+			fprintf(out, "%4lu\t%s\n", table[i].hits, table[i].path);
+	}
+	fprintf(out, "hash: %lu hits, %lu misses, %zu entries\n",
+		total_hits, total_misses, table_used);
+}
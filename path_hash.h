@@ -0,0 +1,57 @@
+/**
+	* @file path_hash.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Hashed $PATH lookup cache. Maps command names to the absolute path of
+	* the executable so a launch does not have to walk every $PATH directory.
+	*/
+
+#ifndef PATH_HASH_H
+#define PATH_HASH_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+
+/**
+	* Specify the initial number of slots in the path hash table (power of two)
+	*/
+#define PATH_HASH_INIT_SIZE (64)
+
+/**
+	* Resolve a command name to an executable path. Names containing a '/'
+	* are returned untouched; everything else is searched in $PATH once and
+	* then served from the table.
+	*
+	* @param name command name
+	* @return path to execute, or NULL if the command could not be found
+	*/
+const char* path_hash_lookup(const char* name);
+
+/**
+	* Drop the cached path of a single command (e.g. the binary went away)
+	*
+	* @param name command name
+	*/
+void path_hash_forget(const char* name);
+
+/**
+	* Drop every cached path. Must be called whenever $PATH changes.
+	*/
+void path_hash_flush();
+
+/**
+	* Print every cached command along with the hit/miss counters
+	*
+	* @param out stream to print to
+	*/
+void path_hash_print(FILE* out);
+
+#endif // PATH_HASH_H
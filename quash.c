@@ -13,6 +13,8 @@
 #include "quash.h"	// Putting this above the other includes allows us to ensure
 					// this file's headder's #include statements are self
 					// contained.
+#include "builtin_hash.h"
+#include "builtin_table.h"	// Generated from builtins.def by tools/mkbuiltins
 
 /**************************************************************************
  * Private Variables
@@ -27,9 +29,89 @@ static bool running;
 
 static bool running_from_file;
 
-static struct job all_jobs[MAX_NUM_JOBS];
+/**
+	* Report parse and execution throughput of scripts and a resource summary
+	* of the session (-t)
+	*/
+static bool report_timing = false;
+
+/**
+	* Resources used by the foreground command(s) since the last reset, read
+	* by the time keyword
+	*/
+static usage fg_usage;
+
+/**
+	* Number of script commands allowed in flight at once (-j N)
+	*/
+static int parallel_jobs = 1;
+
+/**
+	* Emit parallel output in completion order instead of input order
+	*/
+static bool parallel_unordered = false;
+
+
+/**
+	* SIGCHLD delivered as a readable descriptor (SIGCHLD stays blocked)
+	*/
+static int sigchld_fd = -1;
+
+/**
+	* epoll set driving the interactive loop
+	*/
+static int event_fd = -1;
+
+/**
+	* epoll set of background job pidfds (plus the SIGCHLD descriptor when
+	* the kernel has no pidfd support or a job has none). Nested inside
+	* event_fd.
+	*/
+static int job_event_fd = -1;
+
+/**
+	* Background jobs are tracked with pidfds
+	*/
+static bool use_pidfd = false;
+
+/**
+	* The SIGCHLD descriptor is in job_event_fd, so jobs without a pidfd are
+	* polled whenever a child exits
+	*/
+static bool sigchld_watched = false;
+
+/**
+	* Capacity of each background job's output ring ($QUASH_OUTPUT_RING)
+	*/
+static size_t output_ring_size = RING_DEFAULT_SIZE;
+
+/**
+	* Directory receiving output that overflows a job's ring
+	* ($QUASH_OUTPUT_SPILL), NULL to drop the oldest output instead
+	*/
+static const char* output_spill_dir = NULL;
+
+/**
+	* Owns the tokens and pipeline stages of the command being run. Reset
+	* after every run_quash so steady state parsing never touches the heap.
+	*/
+static arena cmd_arena;
+
+/**
+	* Exit status of the last command, expanded by $?
+	*/
+static int last_status = EXIT_SUCCESS;
+
+/**
+	* Number of finished jobs kept in the table for their output
+	*/
+static size_t retained_jobs = 0;
 
-static int num_jobs = 0;
+/**
+	* Number of the foreground command being run, the owner of the
+	* descriptors it creates in the registry
+	*/
+static int command_num = 0;
 
 /**************************************************************************
  * Private Functions 
@@ -66,6 +148,7 @@ bool is_running() {
 	*/
 void terminate() {
 	running = false;
+	running_from_file = false;
 }
 
 /**
@@ -111,310 +194,2248 @@ void print_cmd_tokens(command_t* cmd) {
 	* Print Current Working Directory before shell commands
 	*/
 void print_init() {
-	char cwd[MAX_COMMAND_LENGTH];	//cwd arg - print before each shell command
+	char cwd[PATH_MAX];	//cwd arg - print before each shell command
 	if ( getcwd(cwd, sizeof(cwd)) && !running_from_file )
 		printf("\n[Quash: %s] q$ ", cwd);
 }
 
 /**
-	* Handles exiting signal from background processes
+	* In a forked child that goes on running shell code, close what belongs
+	* to the parent's commands, workers and jobs. Holding a pipe's write
+	* end here would keep its reader from ever seeing end of file.
+	*/
+static void drop_inherited_fds() {
+	fdreg_close_owner(FD_COMMAND, FDREG_ANY);
+	fdreg_close_owner(FD_WORKER, FDREG_ANY);
+	fdreg_close_owner(FD_JOB, FDREG_ANY);
+}
+
+/**
+	* Forget a job along with its descriptors and captured output
 	*
-	* @param signal int
-	* @param sig struct
-	* @param slot
+	* @param j job
 	*/
-void job_handler(int signal, siginfo_t* sig, void* slot) {
-	pid_t p = sig->si_pid;
-	int i = 0;
-	for ( ; i < num_jobs; ++i) {
-		if ( all_jobs[i].pid == p )
+static void release_job(job* j) {
+	if ( j->status && j->out.total )
+		retained_jobs--;			// finish_job kept it for its output
+	if ( j->pidfd >= 0 )
+		fdreg_close(j->pidfd);		// also drops it from job_event_fd
+	if ( j->out_fd >= 0 )
+		fdreg_close(j->out_fd);
+	ring_free(&j->out);
+	job_remove(j);
+}
+
+/**
+	* Move everything a job has written so far into its output ring
+	*
+	* @param j job
+	*/
+static void drain_job_output(job* j) {
+	char buf[READER_CHUNK_SIZE];
+	ssize_t n;
+
+	while ( j->out_fd >= 0 ) {
+		n = read(j->out_fd, buf, sizeof(buf));
+		if ( n > 0 ) {
+			ring_write(&j->out, buf, n);
+			continue;
+		}
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n == 0 || errno != EAGAIN ) {
+			fdreg_close(j->out_fd);
+			j->out_fd = -1;
+		}
+		break;
+	}
+}
+
+/**
+	* Report a finished job. A job that produced output is kept (marked done)
+	* until the output builtin has shown it or MAX_RETAINED_JOBS newer ones
+	* push it out; any other job is released.
+	*
+	* @param j finished job
+	* @param first true for the first job of a batch
+	* @param ru resources the job used
+	* @param seen when the shell saw the job's exit event. A job's wall time
+	* runs until then, which in a script is the next command boundary.
+	*/
+static void finish_job(job* j, bool first, struct rusage* ru, const struct timespec* seen) {
+	printf("%s[%d] %d finished %s\n", first ? "\n" : "", j->jid, j->pid, j->cmdstr);
+	j->status = true;
+	usage_from_rusage(&j->used, ru, &j->started, seen);
+	usage_record(j->cmdstr, &j->used);
+
+	drain_job_output(j);
+	if ( !j->out.total ) {
+		release_job(j);
+		return;
+	}
+
+	if ( j->pidfd >= 0 )
+		fdreg_close(j->pidfd);
+	if ( j->out_fd >= 0 )
+		fdreg_close(j->out_fd);
+	j->pidfd = j->out_fd = -1;
+	job_unindex(j);				// the pid is free for reuse now
+	retained_jobs++;
+}
+
+/**
+	* Keep at most MAX_RETAINED_JOBS finished jobs around for their output,
+	* dropping the oldest first
+	*/
+static void trim_finished_jobs() {
+	job* j, *next;
+
+	for ( j = job_first(); j && retained_jobs > MAX_RETAINED_JOBS; j = next ) {
+		next = job_next(j);
+		if ( j->status )
+			release_job(j);
+	}
+}
+
+/**
+	* Add the SIGCHLD descriptor to the job event set, once
+	*/
+static void watch_sigchld() {
+	struct epoll_event ev;
+
+	if ( sigchld_watched || sigchld_fd < 0 )
+		return;
+	ev.events = EPOLLIN;
+	ev.data.u64 = EVENT_SIGCHLD;
+	sigchld_watched = !epoll_ctl(job_event_fd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+}
+
+/**
+	* Start watching a background job: its pidfd for completion and the read
+	* end of its output pipe for captured stdout/stderr
+	*
+	* @param j new job
+	* @param out_fd non-blocking read end of the job's output pipe
+	*/
+void watch_job(job* j, int out_fd) {
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &j->started);
+	j->out_fd = out_fd;
+	fdreg_move(out_fd, FD_JOB, j->jid);
+	ring_init(&j->out, output_ring_size, output_spill_dir);
+	j->out.owner = j->jid;
+	ev.data.u64 = ((uint64_t) j->jid << 32) | EVENT_OUTPUT;
+	epoll_ctl(job_event_fd, EPOLL_CTL_ADD, j->out_fd, &ev);
+
+	j->pidfd = -1;
+	if ( !use_pidfd )
+		return;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Without a pidfd (out of descriptors, say) the job is collected on SIGCHLD
+	// like it would be on a kernel without pidfds, rather than never reaped
+	////////////////////////////////////////////////////////////////////////////////
+	if ( (j->pidfd = fdreg_track(pidfd_open(j->pid, 0), FD_JOB, j->jid, "pidfd")) < 0 ) {
+		fprintf(stderr, "Error opening pidfd for %d, watching SIGCHLD instead. ERRNO\"%d\"\n", j->pid, errno);
+		watch_sigchld();
+		return;
+	}
+
+	ev.data.u64 = ((uint64_t) j->jid << 32) | EVENT_JOB;
+	epoll_ctl(job_event_fd, EPOLL_CTL_ADD, j->pidfd, &ev);
+}
+
+/**
+	* Services the background job set: captured output is moved into the
+	* jobs' rings, and jobs that have finished are reaped and reported as one
+	* batch. Each job's pidfd turns readable when it exits, so only those jobs
+	* are touched; without pidfd support every exited child is collected with
+	* wait4(-1) when the SIGCHLD descriptor fires and matched to its job
+	* through the pid index. Never runs in signal context.
+	*
+	* @return number of background jobs that finished
+	*/
+int reap_jobs() {
+	struct epoll_event evs[MAX_EVENTS];
+	struct signalfd_siginfo si;
+	struct rusage ru;
+	struct timespec seen;
+	int finished = 0, i, n, wait_status;
+	pid_t p;
+	job* j;
+
+	while ( (n = epoll_wait(job_event_fd, evs, MAX_EVENTS, 0)) > 0 ) {
+		clock_gettime(CLOCK_MONOTONIC, &seen);
+		for ( i = 0; i < n; i++ ) {
+			////////////////////////////////////////////////////////////////////////////////
+			// A job wrote output
+			////////////////////////////////////////////////////////////////////////////////
+			if ( (evs[i].data.u64 & 0xffffffff) == EVENT_OUTPUT ) {
+				if ( (j = job_by_jid(evs[i].data.u64 >> 32)) )
+					drain_job_output(j);
+				continue;
+			}
+
+			////////////////////////////////////////////////////////////////////////////////
+			// A job's pidfd is ready - collect exactly that child. Its pid cannot
+			// be reused before it is reaped, so wait4 on the pid is exact and
+			// returns the rusage waitid(P_PIDFD) would not.
+			////////////////////////////////////////////////////////////////////////////////
+			if ( (evs[i].data.u64 & 0xffffffff) == EVENT_JOB ) {
+				j = job_by_jid(evs[i].data.u64 >> 32);
+				if ( j && !j->status && wait4(j->pid, &wait_status, WNOHANG, &ru) > 0 )
+					finish_job(j, !finished++, &ru, &seen);
+				continue;
+			}
+
+			////////////////////////////////////////////////////////////////////////////////
+			// SIGCHLD fallback - coalesced signals are fine since the wait4 loop
+			// collects every exited child, one call each. A child that is not a
+			// job (a foreground pipeline stage) is stashed for its waiter.
+			////////////////////////////////////////////////////////////////////////////////
+			while ( read(sigchld_fd, &si, sizeof(si)) > 0 ) {}
+			while ( (p = wait4(-1, &wait_status, WNOHANG, &ru)) > 0 ) {
+				if ( (j = job_by_pid(p)) && !j->status )
+					finish_job(j, !finished++, &ru, &seen);
+				else
+					spawn_stash(p, wait_status, &ru);
+			}
+		}
+		if ( n < MAX_EVENTS )
 			break;
 	}
-	if ( i < num_jobs ) {
-		printf("\n[%d] %d finished %s\n", all_jobs[i].jid, p, all_jobs[i].cmdstr);
-		all_jobs[i].status = true;
-		free(all_jobs[i].cmdstr);
+
+	if ( finished ) {
+		trim_finished_jobs();
+		fflush(stdout);
 	}
+	return finished;
+}
+
+/**
+	* Milliseconds elapsed between two monotonic timestamps
+	*
+	* @param a start
+	* @param b end
+	* @return elapsed milliseconds
+	*/
+static double elapsed_ms(struct timespec* a, struct timespec* b) {
+	return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+/**
+	* Wait for a foreground child and account the resources it used to the
+	* session and to the foreground total read by the time keyword
+	*
+	* @param p child pid
+	* @param wait_status receives the child's wait status
+	* @param name command name
+	* @param start CLOCK_MONOTONIC time the child was started
+	* @return p, or -1 on failure
+	*/
+pid_t wait_child(pid_t p, int* wait_status, const char* name, const struct timespec* start) {
+	struct rusage ru;
+	usage u;
+	TRACE_BEGIN(t_wait);
+
+	p = spawn_wait(p, wait_status, &ru);
+	TRACE_END(TRACE_WAIT, t_wait, name);
+	if ( p < 0 )
+		return p;
+
+	usage_from_rusage(&u, &ru, start, NULL);
+	usage_record(name, &u);
+	usage_add(&fg_usage, &u);
+	return p;
+}
+
+/**
+	* Exit status a shell reports for a child: its own exit status, or 128
+	* plus the number of the signal that killed it
+	*
+	* @param wait_status wait status of the child
+	* @return exit status
+	*/
+static int exit_status(int wait_status) {
+	return WIFSIGNALED(wait_status) ? 128 + WTERMSIG(wait_status) : WEXITSTATUS(wait_status);
+}
+
+/**
+	* Exit status a shell reports for a command that could not be launched
+	*
+	* @param err errno value describing the failure
+	* @return 127 if the command was not found, 126 if it could not be run
+	*/
+static int launch_status(int err) {
+	return err == ENOENT ? 127 : 126;
 }
 
 /* 
 	* Kill Command from jobs listing
 	*
 	* @param cmd command struct
+	* @param io standard streams
 	* @return: RETURN_CODE
 */
-int kill_proc(command_t* cmd) {
+int kill_proc(command_t* cmd, io_ctx* io) {
 	////////////////////////////////////////////////////////////////////////////////
 	// Kill requires 3 arguments
 	////////////////////////////////////////////////////////////////////////////////
 	if ( cmd->toklen == 3 ) {
 		int ksignal;
 		sscanf(cmd->tok[1], "%d", &ksignal);
-		int num;
+		int num = -1;
 		sscanf(cmd->tok[2], "%d", &num);
 
 		////////////////////////////////////////////////////////////////////////////////
 		// Kill provided Job
 		////////////////////////////////////////////////////////////////////////////////
-		if ( all_jobs[num].pid )
-			kill(all_jobs[num].pid,ksignal); 
-		else {
-			printf("Error: process does not exist \n"); 
+		job* j = job_by_jid(num);
+		if ( !j ) {
+			fprintf(io->out, "Error: process does not exist \n"); 
 			return EXIT_FAILURE; 
 		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// A finished job has been reaped and its pid may already belong to
+		// someone else. A running one is signalled through its pidfd, or by pid
+		// when there is none - it cannot be reused before we reap it.
+		////////////////////////////////////////////////////////////////////////////////
+		if ( j->status ) {
+			fprintf(io->out, "Error: job has finished \n");
+			return EXIT_FAILURE;
+		}
+		if ( j->pidfd >= 0 )
+			pidfd_send_signal(j->pidfd, ksignal, NULL, 0);
+		else
+			kill(j->pid,ksignal); 
 	}
 	////////////////////////////////////////////////////////////////////////////////
 	// Otherwise error status
 	////////////////////////////////////////////////////////////////////////////////
 	else {
-		puts("kill: Incorrect syntax. provide 2 arguments:\n");
+		fputs("kill: Incorrect syntax. provide 2 arguments:\n\n", io->out);
 		return EXIT_FAILURE; 
 	}
 	return EXIT_SUCCESS; 
 }
 
+/**************************************************************************
+ * String Manipulation Functions 
+ **************************************************************************/
+
 /**
-	* Creates forks and redirects file streams for use in iterative fashion
+	* End of the token starting at i. Spaces inside a $(...) don't end it.
 	*
-	* @param cmd command struct
-	* @param fsi file descriptor in
-	* @param fso file descriptor out
-	* @param envp environment variables
-	* @return RETURN_CODE
+	* @param s command line
+	* @param i start of the token
+	* @param len length of the command line
+	* @return index of the space or end of line following the token
 	*/
-int iterative_fork_helper (command_t* cmd, int fsi, int fso, char* envp[])
-{
-	pid_t p;
+static size_t token_end(const char* s, size_t i, size_t len) {
+	int depth = 0;
 
-	if ( !(p = fork ()) ) {
-		////////////////////////////////////////////////////////////////////////////////
-		// Redirect for STDOUT
-		////////////////////////////////////////////////////////////////////////////////
-		if ( fso != 1 ) {
-			if ( dup2(fso, STDOUT_FILENO) < 0 ) {
-				fprintf(stderr, "\nError redirecting STDOUT. ERRNO\"%d\"\n", errno);
-				exit(EXIT_FAILURE);
-			}
-			close (fso);
-		}
-		////////////////////////////////////////////////////////////////////////////////
-		// Redirect for STDIN
-		////////////////////////////////////////////////////////////////////////////////
-		if ( fsi != 0 ) {
-			if ( dup2(fsi, STDIN_FILENO ) < 0) {
-				fprintf(stderr, "\nError redirecting STDIN. ERRNO\"%d\"\n", errno);
-				exit(EXIT_FAILURE);
-			}
-			close (fsi);
+	for ( ; i < len && (depth || s[i] != ' '); i++ ) {
+		if ( s[i] == '$' && s[i + 1] == '(' ) {
+			depth++;
+			i++;
 		}
-		////////////////////////////////////////////////////////////////////////////////
-		// Execute Command
-		////////////////////////////////////////////////////////////////////////////////
-		if ( execvpe(cmd->tok[0], cmd->tok, envp) < 0	&& errno == 2 ) {
-			fprintf(stderr, "Command: \"%s\" not found.\n", cmd->tok[0]);
-			exit(EXIT_FAILURE);
-		}
-		else {
-			fprintf(stderr, "Error executing %s. ERRNO\"%d\"\n", cmd->tok[0], errno);
-			exit(EXIT_FAILURE);
-		}
-		return EXIT_SUCCESS;
+		else if ( depth && s[i] == '(' )
+			depth++;
+		else if ( depth && s[i] == ')' )
+			depth--;
 	}
-	return p;
+	return i;
 }
 
-/**************************************************************************
- * String Manipulation Functions 
- **************************************************************************/
-
 /**
-	* Parse Raw Command string
+	* Tokenize a command line in place
 	*
 	* @param cmd command struct
-	* @param in instream
+	* @param line writable, NUL terminated command line
+	* @param len length of line
+	* @param mem arena that receives the token vector
 	* @return bool successful parse
 	*/
-bool get_command(command_t* cmd, FILE* in) {
-	if ( fgets(cmd->cmdstr, MAX_COMMAND_LENGTH, in) != NULL ) {
-		size_t len = strlen(cmd->cmdstr);
-		char last_char = cmd->cmdstr[len - 1];
+bool parse_command(command_t* cmd, char* line, size_t len, arena* mem) {
+	cmd->cmdstr = line;
+	cmd->cmdlen = len;
+	cmd->toklen = 0;
+	cmd->tok = NULL;
+	cmd->ops = OP_NONE;
+	cmd->expand = false;
+	cmd->here = NULL;
+	cmd->here_len = 0;
+	cmd->here_expand = false;
 
-		if ( last_char == '\n' || last_char == '\r' ) {
-			// Remove trailing new line character.
-			cmd->cmdstr[len - 1] = '\0';
-			cmd->cmdlen = len - 1;
-		}
-		else
-			cmd->cmdlen = len;
+	////////////////////////////////////////////////////////////////////////////////
+	// Empty Command return true - MUST BE HANDLED
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !(int)cmd->cmdlen )
+		return true;
 
-		////////////////////////////////////////////////////////////////////////////////
-		// Empty Command return true - MUST BE HANDLED
-		////////////////////////////////////////////////////////////////////////////////
-		if ( !(int)cmd->cmdlen )
-			return true;
+	////////////////////////////////////////////////////////////////////////////////
+	// Tokenize command arguments - count first so the token vector is sized
+	// exactly, whatever the number of arguments. A $(...) is one token,
+	// spaces and all.
+	////////////////////////////////////////////////////////////////////////////////
+	size_t i, end, count = 0;
+	for ( i = 0; i < cmd->cmdlen; i = end ) {
+		end = i + 1;
+		if ( cmd->cmdstr[i] != ' ' ) {
+			end = token_end(cmd->cmdstr, i, cmd->cmdlen);
+			count++;
+		}
+	}
+	if ( !(cmd->tok = arena_alloc(mem, sizeof(char*) * (count + 1))) )
+		return false;
 
-		////////////////////////////////////////////////////////////////////////////////
-		// Tokenize command arguments
-		////////////////////////////////////////////////////////////////////////////////
-		cmd->tok = malloc( sizeof(char*) * MAX_COMMAND_ARGLEN );
-		cmd->toklen = 0;
+	for ( i = 0; i < cmd->cmdlen; i = end + 1 ) {
+		char* token = cmd->cmdstr + i;
+
+		end = i;
+		if ( *token == ' ' )
+			continue;
+		end = token_end(cmd->cmdstr, i, cmd->cmdlen);
+		cmd->cmdstr[end] = '\0';
+
+		//debug print - printf ("%d: %s\n", (int)cmd->toklen, token);
+		cmd->tok[cmd->toklen] = token;
+		if ( cmd->toklen )
+			cmd->ops |= token_op(token);	// classified once, here
+		if ( strchr(token, '$') )
+			cmd->expand = true;				// expanded when the command runs
+		cmd->toklen++;
+	}
 
-		char* token = malloc( sizeof(char*) * MAX_COMMAND_ARGLEN );
+	////////////////////////////////////////////////////////////////////////////////
+	// Remove NULL token from end
+	////////////////////////////////////////////////////////////////////////////////
+	cmd->tok[cmd->toklen] = NULL;
 
-		token = strtok (cmd->cmdstr," ");
-		while ( token != NULL )
-		{
-			//debug print - printf ("%d: %s\n", (int)cmd->toklen, token);
-			cmd->tok[cmd->toklen] = token;
-			cmd->toklen++;
-			token = strtok(NULL, " ");
-		}
+	return true;
+}
 
-		free(token);
-		////////////////////////////////////////////////////////////////////////////////
-		// Remove NULL token from end
-		////////////////////////////////////////////////////////////////////////////////
-		cmd->tok[cmd->toklen] = '\0';
+/**
+	* Parse the redirection operator starting a token: an optional
+	* descriptor number followed by <, >, >>, <&, >&, <<, <<- or <<<, or
+	* &> and &>>. The word may follow in the same token (2>err) or in the
+	* next one (2> err).
+	*
+	* @param tok token
+	* @param r receives the kind and descriptor of the redirection
+	* @return operator length, or 0 if tok is no redirection
+	*/
+static size_t redir_parse(const char* tok, redirect_t* r) {
+	const char* p = tok;
+	int fd = -1;
+
+	if ( p[0] == '&' && p[1] == '>' ) {
+		r->fd = -1;
+		r->kind = (p[2] == '>') ? REDIR_APPEND : REDIR_WRITE;
+		return (p[2] == '>') ? 3 : 2;
+	}
+	for ( ; *p >= '0' && *p <= '9'; p++ ) {
+		if ( (fd = (fd < 0 ? 0 : fd * 10) + (*p - '0')) > 9999 )
+			return 0;
+	}
 
-		return true;
+	if ( *p == '<' ) {
+		r->fd = 0;
+		if ( p[1] == '<' && p[2] == '<' ) {
+			r->kind = REDIR_HERESTRING;
+			p += 3;
+		}
+		else if ( p[1] == '<' ) {
+			r->kind = REDIR_HEREDOC;
+			p += (p[2] == '-') ? 3 : 2;
+		}
+		else {
+			r->kind = (p[1] == '&') ? REDIR_DUP : REDIR_READ;
+			p += (p[1] == '&') ? 2 : 1;
+		}
+	}
+	else if ( *p == '>' ) {
+		r->fd = 1;
+		if ( p[1] == '>' || p[1] == '&' )
+			r->kind = (p[1] == '>') ? REDIR_APPEND : REDIR_DUP;
+		else
+			r->kind = REDIR_WRITE;
+		p += (r->kind == REDIR_WRITE) ? 1 : 2;
 	}
 	else
-		return false;
-}
+		return 0;
 
-/**************************************************************************
- * Shell Fuctionality 
- **************************************************************************/
+	if ( fd >= 0 )
+		r->fd = fd;
+	return p - tok;
+}
 
 /**
-	* CD Implementation
+	* Classify a token as one of the shell's operators
 	*
-	* @param cmd command struct
-	* @return void
-	* Note: chdir will make new dir's if they don't exist
+	* @param tok token
+	* @return the token's cmd_op, or OP_NONE for an ordinary word
 	*/
-void cd(command_t* cmd) 
-{
-	if ( cmd->toklen < 2 ) {
-		if ( chdir(getenv("HOME")) )
-			printf("cd: %s: Cannot navigate to $HOME\n", getenv("HOME"));
+cmd_op token_op(const char* tok) {
+	const char* p = tok;
+	redirect_t r;
+
+	if ( redir_parse(tok, &r) ) {
+		if ( r.kind == REDIR_HEREDOC || r.kind == REDIR_HERESTRING )
+			return (r.kind == REDIR_HEREDOC) ? OP_HEREDOC : OP_HERESTRING;
+		while ( *p >= '0' && *p <= '9' )
+			p++;
+		return (*p == '<') ? OP_REDIR_IN : OP_REDIR_OUT;
 	}
-	else if ( cmd->toklen > 2 )
-		puts("Too many arguments");
-	else { 
-		if ( chdir(cmd->tok[1]) )
-			printf("cd: %s: No such file or directory\n", cmd->tok[1]); 
+	if ( !tok[0] || tok[1] )
+		return OP_NONE;
+	switch ( tok[0] ) {
+		case '&': return OP_BACKGROUND;
+		case '|': return OP_PIPE;
+		default: return OP_NONE;
 	}
 }
 
 /**
-	* Echo Implementation
+	* Check a parsed command for misplaced |, & and redirection tokens
 	*
 	* @param cmd command struct
-	* @return void
+	* @return the offending token, or NULL if the command is well formed
 	*/
-void echo(command_t* cmd) 
-{
-	if ( cmd->toklen == 2 ) {
-		if ( !strcmp(cmd->tok[1], "$HOME") )
-			puts(getenv("HOME"));
-		else if ( !strcmp(cmd->tok[1], "$PATH") )
-			puts(getenv("PATH"));
-		else
-			puts(cmd->tok[1]);
-	}
-	else if ( cmd->toklen == 1 ) {
-		puts(getenv("HOME"));
+const char* syntax_error(command_t* cmd) {
+	size_t i;
+
+	// Operators only ever follow the command name
+	if ( !cmd->ops && (!cmd->toklen || token_op(cmd->tok[0]) == OP_NONE) )
+		return NULL;
+
+	for ( i = 0; i < cmd->toklen; i++ ) {
+		char* t = cmd->tok[i];
+		bool last = (i + 1 == cmd->toklen);
+		redirect_t r;
+
+		switch ( token_op(t) ) {
+			case OP_PIPE:
+				if ( i == 0 || last || token_op(cmd->tok[i + 1]) == OP_PIPE )
+					return t;
+				break;
+			case OP_REDIR_IN:
+			case OP_REDIR_OUT:
+			case OP_HEREDOC:
+			case OP_HERESTRING:
+				// The word is glued on (2>err) or the next token, never an operator
+				if ( t[redir_parse(t, &r)] )
+					break;
+				if ( last )
+					return "newline";
+				if ( token_op(cmd->tok[i + 1]) != OP_NONE )
+					return cmd->tok[i + 1];
+				break;
+			case OP_BACKGROUND:
+				if ( i == 0 || !last )
+					return t;
+				break;
+			default:
+				break;
+		}
 	}
-	else{
-		int i = 1;
-		for ( ; i < cmd->toklen; i++ )
-			printf("%s ", cmd->tok[i]);
-		puts("");
+	return NULL;
+}
+
+/**
+	* Make room for at least len more bytes in a growable output buffer,
+	* doubling its size as often as needed. An arena-backed buffer moves to
+	* a bigger block of the arena; the old block goes back at the next reset.
+	*
+	* @param out buffer
+	* @param len number of bytes
+	* @return bool success
+	*/
+static bool out_reserve(out_buf* out, size_t len) {
+	if ( out->len + len > out->cap ) {
+		size_t cap = out->cap ? out->cap : out->mem ? OUT_ARENA_INIT_SIZE : READER_CHUNK_SIZE;
+		char* grown;
+
+		while ( cap < out->len + len )
+			cap *= 2;
+		if ( out->mem ) {
+			if ( !(grown = arena_alloc(out->mem, cap)) )
+				return false;
+			if ( out->len )
+				memcpy(grown, out->data, out->len);
+		}
+		else if ( !(grown = realloc(out->data, cap)) )
+			return false;
+		out->data = grown;
+		out->cap = cap;
 	}
+	return true;
 }
 
 /**
-	* Displays all currently running jobs
-	* @return void
+	* Append bytes to a growable output buffer
+	*
+	* @param out buffer
+	* @param data bytes to append
+	* @param len number of bytes
+	* @return bool success
 	*/
-void jobs(command_t* cmd) {
-	int i;
+static bool out_append(out_buf* out, const char* data, size_t len) {
+	if ( !out_reserve(out, len) )
+		return false;
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+	return true;
+}
 
-	for ( i = 0; i < num_jobs; i++ ) {
-		if ( kill(all_jobs[i].pid, 0) == 0 && !all_jobs[i].status ) {
-			printf("[%d] %d %s \n", all_jobs[i].jid, all_jobs[i].pid, all_jobs[i].cmdstr);
-		}
+/**
+	* Find the parenthesis closing a $(
+	*
+	* @param s the character after the "$("
+	* @return the closing ')', or NULL if there is none
+	*/
+static const char* subst_end(const char* s) {
+	int depth = 1;
+
+	for ( ; *s; s++ ) {
+		if ( *s == '(' )
+			depth++;
+		else if ( *s == ')' && !--depth )
+			return s;
 	}
+	return NULL;
 }
 
 /**
-	* Set Implementation
+	* Check for a builtin that changes the shell itself, which has to run in
+	* a subshell when substituted
 	*
-	* Assigns the specified environment variable (HOME or PATH),
-	* or displays an error for user mistakes.
+	* @param fn builtin
+	* @return true if fn changes shell state
+	*/
+static bool changes_shell(builtin_fn fn) {
+	return fn == cd || fn == quit || fn == set || fn == export || fn == unset || fn == enable;
+}
+
+/**
+	* Run a builtin in the shell with its output collected in a memfd
 	*
+	* @param fn builtin
 	* @param cmd command struct
-	* @return void
+	* @param out receives the output
+	* @return bool success
 	*/
-void set(command_t* cmd) {
-	if ( cmd->tok[1] == NULL )
-		printf("set: No command given\n");
-	else {
-		// Get the environment variable and directory
-		// (Delimited by '=')
-		char* env = strtok(cmd->tok[1], "=");
-		char* dir = strtok(NULL, "=");
+static bool capture_builtin(builtin_fn fn, command_t* cmd, out_buf* out) {
+	int fd = fdreg_track(memfd_create("quash-subst", MFD_CLOEXEC), FD_COMMAND, command_num,
+		"substitution memfd");
+	off_t size, off = 0;
+	ssize_t n;
+
+	if ( fd < 0 ) {
+		fprintf(stderr, "\nError creating substitution buffer. ERRNO\"%d\"\n", errno);
+		return false;
+	}
+	last_status = run_builtin(fn, cmd, STDIN_FILENO, fd, STDERR_FILENO);
 
-		if ( env == NULL || dir == NULL ) {
-			printf("set: Incorrect syntax. Possible Usages:\n");
-			printf("\tset PATH=/directory/to/use/for/path\n");
-			printf("\tset HOME=/directory/to/use/for/home\n");
-		}
-		////////////////////////////////////////////////////////////////////////////////
-		// Set the environment variable
-		////////////////////////////////////////////////////////////////////////////////
-		else if ( !strcmp(env, "PATH") || !strcmp(env, "HOME") )
-			setenv(env, dir, 1);
-		else
-			printf("set: available only for PATH or HOME environment variables\n");
+	if ( (size = lseek(fd, 0, SEEK_END)) < 0 || !out_reserve(out, size) ) {
+		fdreg_close(fd);
+		return false;
 	}
+	while ( off < size && (n = pread(fd, out->data + out->len, size - off, off)) != 0 ) {
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 )
+			break;
+		out->len += n;
+		off += n;
+	}
+	fdreg_close(fd);
+	return off == size;
 }
 
-/**************************************************************************
- * File Execution Functions 
- **************************************************************************/
-
 /**
-	* Executes any Quash commands from the given file 
+	* Run a command in a forked subshell and collect what it writes to
+	* stdout through a pipe. The pipe is read while the command runs, into
+	* the free end of the buffer, in reads of at least SUBST_READ_SIZE bytes.
 	*
-	* @param argc argument count from the command line
-	* @param argv argument vector from the command line
-	* @param envp environment variables
+	* @param cmd command struct
+	* @param out receives the output
+	* @return bool success
 	*/
-void exec_from_file(char** argv, int argc, char* envp[]) {
-	
+static bool capture_subshell(command_t* cmd, out_buf* out) {
+	struct timespec start;
+	int file_desc[2], wait_status;
+	ssize_t n = 0;
+	pid_t p;
+
+	if ( pipe2(file_desc, O_CLOEXEC) < 0 ) {
+		fprintf(stderr, "\nError in pipe creation. ERRNO:%d\n", errno);
+		return false;
+	}
+	fdreg_track(file_desc[0], FD_COMMAND, command_num, "substitution pipe");
+	fdreg_track(file_desc[1], FD_COMMAND, command_num, "substitution pipe");
+	fcntl(file_desc[1], F_SETPIPE_SZ, SUBST_READ_SIZE);
+
+	fflush(stdout);
+	fflush(stderr);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( (p = fork()) < 0 ) {
+		fprintf(stderr, "Error forking substitution. ERRNO\"%d\"\n", errno);
+		fdreg_close(file_desc[0]);
+		fdreg_close(file_desc[1]);
+		return false;
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
-	// Args
+	// Child - run the command as the shell would, with stdout into the pipe
 	////////////////////////////////////////////////////////////////////////////////
-	command_t cmd;
+	if ( p == 0 ) {
+		dup2(file_desc[1], STDOUT_FILENO);
+		drop_inherited_fds();
+		signal(SIGCHLD, SIG_DFL);
+		sigprocmask(SIG_UNBLOCK, &sigmask_1, NULL);
+		trace_child();
+		spawn_detach();
+
+		wait_status = exec_command(cmd, vars_envp());
+		fflush(stdout);
+		_exit(wait_status);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parent - read until every writer is gone
+	////////////////////////////////////////////////////////////////////////////////
+	fdreg_close(file_desc[1]);
+	for ( ;; ) {
+		if ( !out_reserve(out, SUBST_READ_SIZE) )
+			break;
+		n = read(file_desc[0], out->data + out->len, out->cap - out->len);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			break;
+		out->len += n;
+	}
+	fdreg_close(file_desc[0]);
+
+	if ( wait_child(p, &wait_status, cmd->tok[0], &start) >= 0 )
+		last_status = exit_status(wait_status);
+	return n == 0;
+}
+
+/**
+	* Run a command substitution and append its output to a word. Trailing
+	* newlines are dropped and, when splitting, every other space, tab or
+	* newline ends a field (written as a NUL).
+	*
+	* @param text command between the parentheses
+	* @param len length of text
+	* @param out word being expanded
+	* @param split split the output into fields
+	* @return bool success
+	*/
+static bool substitute(const char* text, size_t len, out_buf* out, bool split) {
+	command_t inner, expanded;
+	size_t start = out->len, i;
+	builtin_fn fn = NULL;
+	const char* bad;
+	char* line;
+	bool ok;
+
+	if ( !(line = arena_alloc(&cmd_arena, len + 1)) )
+		return false;
+	memcpy(line, text, len);
+	line[len] = '\0';
+	if ( !parse_command(&inner, line, len, &cmd_arena) )
+		return false;
+	if ( inner.toklen && (bad = syntax_error(&inner)) ) {
+		fprintf(stderr, "quash: syntax error near unexpected token `%s'\n", bad);
+		return true;
+	}
+	if ( inner.expand ) {
+		if ( !expand_command(&inner, &expanded, &cmd_arena) )
+			return false;
+		inner = expanded;
+	}
+	if ( !inner.toklen )
+		return true;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Builtins don't fork unless they would change the shell
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !inner.ops && strcmp(inner.tok[0], "time") )
+		fn = find_builtin(inner.tok[0]);
+	if ( fn && !changes_shell(fn) )
+		ok = capture_builtin(fn, &inner, out);
+	else
+		ok = capture_subshell(&inner, out);
+	if ( !ok )
+		return false;
+
+	while ( out->len > start && out->data[out->len - 1] == '\n' )
+		out->len--;
+	for ( i = start; split && i < out->len; i++ ) {
+		if ( out->data[i] == ' ' || out->data[i] == '\t' || out->data[i] == '\n' )
+			out->data[i] = '\0';
+	}
+	return true;
+}
+
+/**
+	* Value of the variable reference following a '$'
+	*
+	* @param p in: the character after the '$', out: the character after
+	* the reference
+	* @param num scratch space for $? and $$
+	* @return value (empty for an unset variable), or NULL if p does not
+	* start a reference and the '$' is literal
+	*/
+static const char* expand_ref(const char** p, char num[24]) {
+	const char* s = *p;
+	const char* v;
+	size_t len;
+
+	if ( *s == '?' || *s == '$' ) {
+		snprintf(num, 24, "%d", *s == '?' ? last_status : (int) getpid());
+		*p = s + 1;
+		return num;
+	}
+	if ( *s == '{' ) {
+		if ( !(len = vars_name_len(s + 1)) || s[len + 1] != '}' )
+			return NULL;
+		v = vars_getn(s + 1, len);
+		*p = s + len + 2;
+	}
+	else {
+		if ( !(len = vars_name_len(s)) )
+			return NULL;
+		v = vars_getn(s, len);
+		*p = s + len;
+	}
+	return v ? v : "";
+}
+
+/**
+	* Expand the variable references and command substitutions in a word
+	*
+	* @param w word
+	* @param out receives the expanded word
+	* @param split separate the fields of command substitutions by NULs
+	* @return bool success
+	*/
+static bool expand_word(const char* w, out_buf* out, bool split) {
+	char num[24];
+
+	while ( *w ) {
+		const char* after = w + 1;
+		const char* close;
+		const char* v;
+
+		if ( w[0] == '$' && w[1] == '(' && (close = subst_end(w + 2)) ) {
+			if ( !substitute(w + 2, close - (w + 2), out, split) )
+				return false;
+			w = close + 1;
+		}
+		else if ( *w == '$' && (v = expand_ref(&after, num)) ) {
+			if ( !out_append(out, v, strlen(v)) )
+				return false;
+			w = after;
+		}
+		else if ( !out_append(out, w++, 1) )
+			return false;
+	}
+	return true;
+}
+
+/**
+	* Expand $NAME, ${NAME}, $?, $$ and $(command) in the tokens of a
+	* command. The output of a command substitution is split into words.
+	*
+	* @param cmd parsed command
+	* @param out receives the expanded command
+	* @param mem arena that receives the expanded tokens and holds the work
+	* buffers, so expansion never touches the heap
+	* @return bool success
+	*/
+bool expand_command(command_t* cmd, command_t* out, arena* mem) {
+	out_buf word = { NULL, 0, 0, mem };
+	out_buf toks = { NULL, 0, 0, mem };
+	char* terminator = NULL;
+	bool ok = true;
+	size_t i;
+
+	*out = *cmd;
+	out->expand = false;
+
+	for ( i = 0; ok && i < cmd->toklen; i++ ) {
+		char* t = cmd->tok[i];
+		char* p;
+		char* end;
+
+		if ( !strchr(t, '$') ) {
+			ok = out_append(&toks, (char*) &t, sizeof(t));
+			continue;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Every non-empty field of the expansion becomes a token; a word that
+		// expands to nothing is dropped
+		////////////////////////////////////////////////////////////////////////////////
+		word.len = 0;
+		if ( !(ok = expand_word(t, &word, true)) )
+			break;
+		for ( p = word.data, end = word.data + word.len; ok && p < end; p++ ) {
+			char* f = memchr(p, '\0', end - p);
+			size_t len = (f ? f : end) - p;
+
+			if ( len ) {
+				ok = (t = arena_alloc(mem, len + 1)) && out_append(&toks, (char*) &t, sizeof(t));
+				if ( ok ) {
+					memcpy(t, p, len);
+					t[len] = '\0';
+				}
+			}
+			p += len;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Both buffers live in the arena, so the token list is used in place
+	////////////////////////////////////////////////////////////////////////////////
+	out->toklen = toks.len / sizeof(char*);
+	if ( ok && out_append(&toks, (char*) &terminator, sizeof(terminator)) )
+		out->tok = (char**) toks.data;
+	else
+		ok = false;
+	return ok;
+}
+
+/**
+	* Assign a NAME=VALUE word to a shell variable
+	*
+	* @param word NAME=VALUE (NAME already checked with vars_name_len)
+	* @param export export the variable
+	* @return bool success
+	*/
+static bool assign(char* word, bool export) {
+	size_t len = vars_name_len(word);
+	bool ok;
+
+	word[len] = '\0';
+	ok = vars_set(word, word + len + 1, export);
+	if ( ok && !strcmp(word, "PATH") )
+		path_hash_flush();
+	word[len] = '=';
+	return ok;
+}
+
+/**
+	* Check for a NAME=VALUE word
+	*
+	* @param word token
+	* @return true if word assigns a variable
+	*/
+static bool is_assignment(const char* word) {
+	size_t len = vars_name_len(word);
+
+	return len && word[len] == '=';
+}
+
+/**
+	* Read the body of a command's here-document from the lines following
+	* it, up to the delimiter line. A quoted delimiter ('EOF' or "EOF")
+	* keeps the body from being expanded; <<- strips leading tabs.
+	*
+	* @param cmd command struct, its here fields are filled in
+	* @param next reads the next line from src
+	* @param src reader or script cursor the command came from
+	* @param mem arena that receives the body
+	* @return bool success
+	*/
+bool read_heredoc(command_t* cmd, here_getline next, void* src, arena* mem) {
+	out_buf body = { NULL, 0, 0 };
+	const char* delim = NULL;
+	bool strip = false, found = false, ok = true;
+	size_t i, dlen;
+	ssize_t len;
+	char* line;
+
+	if ( !(cmd->ops & OP_HEREDOC) )
+		return true;
+	for ( i = 1; !delim && i < cmd->toklen; i++ ) {
+		char* t = cmd->tok[i];
+		redirect_t r;
+		size_t op_len = redir_parse(t, &r);
+
+		if ( op_len && r.kind == REDIR_HEREDOC ) {
+			strip = (t[op_len - 1] == '-');
+			delim = t[op_len] ? t + op_len : cmd->tok[i + 1];
+		}
+	}
+	if ( !delim )
+		return true;
+
+	dlen = strlen(delim);
+	cmd->here_expand = true;
+	if ( dlen >= 2 && (delim[0] == '\'' || delim[0] == '"') && delim[dlen - 1] == delim[0] ) {
+		delim++;
+		dlen -= 2;
+		cmd->here_expand = false;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Collect lines up to the delimiter
+	////////////////////////////////////////////////////////////////////////////////
+	while ( ok && (len = next(src, &line)) >= 0 ) {
+		while ( strip && len && *line == '\t' ) {
+			line++;
+			len--;
+		}
+		if ( (size_t) len == dlen && !memcmp(line, delim, dlen) ) {
+			found = true;
+			break;
+		}
+		ok = out_append(&body, line, len) && out_append(&body, "\n", 1);
+	}
+	if ( ok && !found )
+		fprintf(stderr, "quash: warning: here-document delimited by end-of-file (wanted `%.*s')\n",
+			(int) dlen, delim);
+
+	if ( ok && (cmd->here = arena_alloc(mem, body.len + 1)) ) {
+		if ( body.len )
+			memcpy(cmd->here, body.data, body.len);
+		cmd->here[body.len] = '\0';
+		cmd->here_len = body.len;
+	}
+	else
+		ok = false;
+	free(body.data);
+	return ok;
+}
+
+/**
+	* Read a here-document line from the terminal, prompting for it
+	*
+	* @param src line reader
+	* @param line set to the line
+	* @return length of the line, or -1 at end of input
+	*/
+static ssize_t prompt_getline(void* src, char** line) {
+	fputs(HEREDOC_PROMPT, stdout);
+	fflush(stdout);
+	return reader_getline(src, line);
+}
+
+/**
+	* Parse Raw Command string, along with the here-document that follows it
+	*
+	* @param cmd command struct
+	* @param in line reader for the input stream
+	* @return bool successful parse
+	*/
+bool get_command(command_t* cmd, line_reader* in) {
+	char* line;
+	char* copy;
+	ssize_t len = reader_getline(in, &line);
+
+	if ( len < 0 )
+		return false;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Copy the line into the command's arena - the reader reuses its buffer
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !(copy = arena_alloc(&cmd_arena, len + 1)) )
+		return false;
+	memcpy(copy, line, len + 1);
+
+	return parse_command(cmd, copy, len, &cmd_arena)
+		&& read_heredoc(cmd, prompt_getline, in, &cmd_arena);
+}
+
+/**************************************************************************
+ * Shell Fuctionality 
+ **************************************************************************/
+
+/**
+	* CD Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	* Note: chdir will make new dir's if they don't exist
+	*/
+int cd(command_t* cmd, io_ctx* io)
+{
+	if ( cmd->toklen < 2 ) {
+		if ( chdir(vars_get("HOME")) ) {
+			fprintf(io->out, "cd: %s: Cannot navigate to $HOME\n", vars_get("HOME"));
+			return EXIT_FAILURE;
+		}
+	}
+	else if ( cmd->toklen > 2 ) {
+		fputs("Too many arguments\n", io->out);
+		return EXIT_FAILURE;
+	}
+	else {
+		if ( chdir(cmd->tok[1]) ) {
+			fprintf(io->out, "cd: %s: No such file or directory\n", cmd->tok[1]);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+	* Echo Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int echo(command_t* cmd, io_ctx* io)
+{
+	if ( cmd->toklen == 2 ) {
+		fprintf(io->out, "%s\n", cmd->tok[1]);
+	}
+	else if ( cmd->toklen == 1 ) {
+		fprintf(io->out, "%s\n", vars_get("HOME"));
+	}
+	else{
+		int i = 1;
+		for ( ; i < cmd->toklen; i++ )
+			fprintf(io->out, "%s ", cmd->tok[i]);
+		fputc('\n', io->out);
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+	* Displays all currently running jobs. With -v finished jobs that still
+	* hold output are listed too, along with the resources they used.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int jobs(command_t* cmd, io_ctx* io) {
+	bool verbose = cmd->toklen > 1 && !strcmp(cmd->tok[1], "-v");
+	struct timespec now;
+	job* j;
+
+	reap_jobs();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for ( j = job_first(); j; j = job_next(j) ) {
+		if ( !verbose ) {
+			if ( !j->status )
+				fprintf(io->out, "[%d] %d %s \n", j->jid, j->pid, j->cmdstr);
+			continue;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// -v: finished jobs still holding output show what they used
+		////////////////////////////////////////////////////////////////////////////////
+		fprintf(io->out, "[%d] %d %s ", j->jid, j->pid, j->cmdstr);
+		if ( j->status ) {
+			fputs("done ", io->out);
+			usage_print(io->out, &j->used);
+			fputc('\n', io->out);
+		}
+		else
+			fprintf(io->out, "running real %.3fs\n", elapsed_ms(&j->started, &now) / 1e3);
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+	* Set Implementation
+	*
+	* Assigns shell variables (set NAME=VALUE...), or lists every variable
+	* with no arguments. A variable that is exported (like PATH and HOME)
+	* stays exported, so commands started afterwards see the new value.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int set(command_t* cmd, io_ctx* io) {
+	int i;
+
+	if ( cmd->toklen == 1 ) {
+		vars_print(io->out, false, "");
+		return EXIT_SUCCESS;
+	}
+
+	for ( i = 1; i < cmd->toklen; i++ ) {
+		if ( !is_assignment(cmd->tok[i]) ) {
+			fprintf(io->out, "set: Incorrect syntax. Possible Usages:\n");
+			fprintf(io->out, "\tset\n");
+			fprintf(io->out, "\tset NAME=VALUE...\n");
+			return EXIT_FAILURE;
+		}
+		if ( !assign(cmd->tok[i], false) ) {
+			fprintf(io->out, "set: %s: Cannot assign variable\n", cmd->tok[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+	* Export Implementation
+	*
+	* Exports shell variables to the commands quash starts, assigning them
+	* first when given as NAME=VALUE. Lists the exported variables with no
+	* arguments.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int export(command_t* cmd, io_ctx* io) {
+	int i, status = EXIT_SUCCESS;
+
+	if ( cmd->toklen == 1 ) {
+		vars_print(io->out, true, "export ");
+		return EXIT_SUCCESS;
+	}
+
+	for ( i = 1; i < cmd->toklen; i++ ) {
+		char* t = cmd->tok[i];
+		size_t len = vars_name_len(t);
+
+		if ( !len || (t[len] && t[len] != '=') ) {
+			fprintf(io->out, "export: `%s': not a valid identifier\n", t);
+			status = EXIT_FAILURE;
+		}
+		else if ( t[len] == '=' && !assign(t, true) ) {
+			fprintf(io->out, "export: %s: Cannot assign variable\n", t);
+			status = EXIT_FAILURE;
+		}
+		else if ( !t[len] )
+			vars_export(t);		// exporting an unset variable does nothing
+	}
+	return status;
+}
+
+/**
+	* Unset Implementation
+	*
+	* Removes shell variables
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int unset(command_t* cmd, io_ctx* io) {
+	int i, status = EXIT_SUCCESS;
+
+	for ( i = 1; i < cmd->toklen; i++ ) {
+		char* t = cmd->tok[i];
+		size_t len = vars_name_len(t);
+
+		if ( !len || t[len] ) {
+			fprintf(io->out, "unset: `%s': not a valid identifier\n", t);
+			status = EXIT_FAILURE;
+		}
+		else if ( vars_unset(t) && !strcmp(t, "PATH") )
+			path_hash_flush();
+	}
+	return status;
+}
+
+/**
+	* Hash Implementation
+	*
+	* Displays the cached command paths and hit/miss counters, or forgets
+	* them all with -r.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int hash(command_t* cmd, io_ctx* io) {
+	if ( cmd->toklen == 1 )
+		path_hash_print(io->out);
+	else if ( cmd->toklen == 2 && !strcmp(cmd->tok[1], "-r") )
+		path_hash_flush();
+	else {
+		fprintf(io->out, "hash: Incorrect syntax. Possible Usages:\n\thash\n\thash -r\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+	* Output Implementation
+	*
+	* Shows the stdout/stderr captured from a background job. With no
+	* arguments lists the jobs holding output; -f keeps following a running
+	* job until it finishes. A finished job is forgotten once shown.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int output(command_t* cmd, io_ctx* io) {
+	bool follow = cmd->toklen == 3 && !strcmp(cmd->tok[1], "-f");
+	char* spec = cmd->tok[cmd->toklen - 1];
+	struct epoll_event ev;
+	int jid = -1;
+	size_t seen;
+	job* j;
+
+	reap_jobs();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// No job given - list the jobs holding output
+	////////////////////////////////////////////////////////////////////////////////
+	if ( cmd->toklen == 1 ) {
+		for ( j = job_first(); j; j = job_next(j) ) {
+			if ( j->out.total )
+				fprintf(io->out, "[%d] %d %s %zu bytes %s\n", j->jid, j->pid,
+					j->status ? "done" : "running", j->out.total, j->cmdstr);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if ( (cmd->toklen != 2 && !follow) || sscanf(spec + (spec[0] == '%'), "%d", &jid) != 1 ) {
+		fprintf(io->out, "output: Incorrect syntax. Possible Usages:\n\toutput\n\toutput %%jid\n\toutput -f %%jid\n");
+		return EXIT_FAILURE;
+	}
+	if ( !(j = job_by_jid(jid)) ) {
+		fprintf(io->out, "Error: process does not exist \n");
+		return EXIT_FAILURE;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Show what has been captured so far, then keep following if asked to
+	////////////////////////////////////////////////////////////////////////////////
+	fflush(io->out);
+	seen = ring_dump(&j->out, 0, fileno(io->out));
+	while ( follow && j && !j->status ) {
+		if ( epoll_wait(job_event_fd, &ev, 1, -1) < 0 && errno != EINTR )
+			break;
+		reap_jobs();
+		fflush(stdout);
+		if ( (j = job_by_jid(jid)) )
+			seen = ring_dump(&j->out, seen, fileno(io->out));
+	}
+
+	if ( j && j->status )
+		release_job(j);
+	return EXIT_SUCCESS;
+}
+
+/**
+	* Stats Implementation
+	*
+	* Prints p50/p99/max latency of every traced phase. "stats on" and
+	* "stats off" start and stop recording, "stats reset" clears the
+	* histograms. "stats arena" prints the command arena's lifetime chunk
+	* allocations so a soak test can check they stop growing.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int stats(command_t* cmd, io_ctx* io) {
+	if ( cmd->toklen == 1 ) {
+		if ( !trace_on )
+			fputs("stats: tracing is off (stats on, or set QUASH_STATS)\n", io->out);
+		trace_print(io->out);
+	}
+	else if ( !strcmp(cmd->tok[1], "on") )
+		trace_enable(true);
+	else if ( !strcmp(cmd->tok[1], "off") )
+		trace_enable(false);
+	else if ( !strcmp(cmd->tok[1], "reset") )
+		trace_reset();
+	else if ( !strcmp(cmd->tok[1], "arena") )
+		fprintf(io->out, "%zu\n", cmd_arena.mallocs);
+	else {
+		fprintf(io->out, "stats: Incorrect syntax. Possible Usages:\n\tstats\n\tstats on|off|reset|arena\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+	* fds Implementation
+	*
+	* Lists the descriptors open in the shell with their owner (shell,
+	* command, worker or job), whether they are close-on-exec and what they
+	* refer to. Fails when one is untracked or would be inherited by the
+	* commands the shell starts, so a leak check can be scripted.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int fds_proc(command_t* cmd, io_ctx* io) {
+	return fdreg_print(io->out) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+	* Run the program a builtin stands in for on the builtin's streams
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return exit status of the program
+	*/
+static int run_external(command_t* cmd, io_ctx* io) {
+	struct timespec start;
+	int wait_status;
+	spawn_t sp;
+	pid_t p;
+
+	fflush(io->out);
+	spawn_reset(&sp);
+	if ( io->in != STDIN_FILENO )
+		spawn_add_dup2(&sp, io->in, STDIN_FILENO);
+	if ( fileno(io->out) != STDOUT_FILENO )
+		spawn_add_dup2(&sp, fileno(io->out), STDOUT_FILENO);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( (p = spawn_command(&sp, cmd->tok, vars_envp())) < 0 )
+		return launch_status(errno);
+	if ( wait_child(p, &wait_status, cmd->tok[0], &start) < 0 )
+		return EXIT_FAILURE;
+	return exit_status(wait_status);
+}
+
+/**
+	* Run one of the text utilities on a builtin's streams, falling back to
+	* the real program for options it does not implement
+	*
+	* @param fn utility
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+static int text_builtin(text_fn fn, command_t* cmd, io_ctx* io) {
+	int status;
+
+	fflush(io->out);
+	fflush(io->err);
+	if ( (status = fn(cmd->toklen, cmd->tok, io->in, fileno(io->out), fileno(io->err))) == TEXT_UNSUPPORTED )
+		status = run_external(cmd, io);
+	return status;
+}
+
+/**
+	* wc Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int wc(command_t* cmd, io_ctx* io) {
+	return text_builtin(text_wc, cmd, io);
+}
+
+/**
+	* grep Implementation (fixed strings)
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int grep(command_t* cmd, io_ctx* io) {
+	return text_builtin(text_grep, cmd, io);
+}
+
+/**
+	* head Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int head(command_t* cmd, io_ctx* io) {
+	return text_builtin(text_head, cmd, io);
+}
+
+/**
+	* tail Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int tail(command_t* cmd, io_ctx* io) {
+	return text_builtin(text_tail, cmd, io);
+}
+
+/**
+	* cut Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int cut(command_t* cmd, io_ctx* io) {
+	return text_builtin(text_cut, cmd, io);
+}
+
+/**
+	* cat Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int cat(command_t* cmd, io_ctx* io) {
+	return text_builtin(copy_cat, cmd, io);
+}
+
+/**
+	* cp Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int cp(command_t* cmd, io_ctx* io) {
+	return text_builtin(copy_cp, cmd, io);
+}
+
+/**
+	* tee Implementation
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int tee_proc(command_t* cmd, io_ctx* io) {
+	return text_builtin(copy_tee, cmd, io);
+}
+
+/**
+	* Enable Implementation
+	*
+	* Loads builtins from a shared object (enable -f lib.so name...), unloads
+	* them (enable -d name...) or lists the loaded ones (enable).
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+int enable(command_t* cmd, io_ctx* io) {
+	int RETURN_CODE = EXIT_SUCCESS;
+	const char* err;
+	size_t i;
+
+	if ( cmd->toklen == 1 ) {
+		loadable_print(io->out);
+		return EXIT_SUCCESS;
+	}
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Redirect Quash Standard Input
+	// enable -f lib.so name... - compiled-in builtins cannot be replaced
 	////////////////////////////////////////////////////////////////////////////////
-	start_from_file();
+	if ( cmd->toklen > 3 && !strcmp(cmd->tok[1], "-f") ) {
+		for ( i = 3; i < cmd->toklen; i++ ) {
+			if ( find_builtin(cmd->tok[i]) && !loadable_find(cmd->tok[i]) )
+				err = "is a shell builtin";
+			else
+				err = loadable_enable(cmd->tok[2], cmd->tok[i]);
+			if ( err ) {
+				fprintf(io->err, "enable: %s: %s\n", cmd->tok[i], err);
+				RETURN_CODE = EXIT_FAILURE;
+			}
+		}
+		return RETURN_CODE;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// enable -d name...
+	////////////////////////////////////////////////////////////////////////////////
+	if ( cmd->toklen > 2 && !strcmp(cmd->tok[1], "-d") ) {
+		for ( i = 2; i < cmd->toklen; i++ ) {
+			if ( !loadable_disable(cmd->tok[i]) ) {
+				fprintf(io->err, "enable: %s: not a loaded builtin\n", cmd->tok[i]);
+				RETURN_CODE = EXIT_FAILURE;
+			}
+		}
+		return RETURN_CODE;
+	}
+
+	fprintf(io->out, "enable: Incorrect syntax. Possible Usages:\n\tenable\n\tenable -f lib.so name...\n\tenable -d name...\n");
+	return EXIT_FAILURE;
+}
+
+/**
+	* Exit Implementation (exit and quit). "exit N" leaves with status N,
+	* plain exit with the status of the last command.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE, which becomes the shell's exit status
+	*/
+int quit(command_t* cmd, io_ctx* io) {
+	terminate(); // Exit Quash
+	if ( cmd->toklen > 1 )
+		return atoi(cmd->tok[1]) & 0xff;
+	return last_status;
+}
+
+/**
+	* Entry point shared by every builtin loaded with enable -f. Hands the
+	* builtin its arguments and descriptors through the stable interface.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+	*/
+static int loadable_builtin(command_t* cmd, io_ctx* io) {
+	const quash_builtin* b = loadable_find(cmd->tok[0]);
+
+	if ( !b )
+		return 127;
+	fflush(io->out);
+	fflush(io->err);
+	return loadable_run(b, cmd->toklen, cmd->tok, io->in, fileno(io->out), fileno(io->err));
+}
+
+/**
+	* Look up a builtin by name in the generated perfect hash table, then
+	* among the builtins loaded with enable -f
+	*
+	* @param name command name
+	* @return the builtin, or NULL if name is not a builtin
+	*/
+builtin_fn find_builtin(const char* name) {
+	const builtin_entry* b = &builtin_table[builtin_hash(name, BUILTIN_HASH_SEED)
+		& (BUILTIN_TABLE_SIZE - 1)];
+
+	if ( b->name && !strcmp(b->name, name) )
+		return b->fn;
+	if ( loadable_find(name) )
+		return loadable_builtin;
+	return NULL;
+}
+
+/**
+	* Run a builtin in the shell on the given descriptors. Output to anything
+	* but the shell's stdout goes through a stream of its own, so the shell's
+	* standard descriptors are never swapped around the call.
+	*
+	* @param fn builtin
+	* @param cmd command struct
+	* @param in descriptor to read (STDIN_FILENO for the shell's stdin)
+	* @param out descriptor to write (STDOUT_FILENO for the shell's stdout)
+	* @return exit status of the builtin
+	*/
+int run_builtin(builtin_fn fn, command_t* cmd, int in, int out, int err) {
+	io_ctx io = { in, stdout, stderr };
+	int status, fd = -1;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Redirected streams get their own FILE; stdout and stderr sent to the
+	// same place share one so their output stays in order
+	////////////////////////////////////////////////////////////////////////////////
+	if ( out != STDOUT_FILENO ) {
+		fd = fdreg_track(fcntl(out, F_DUPFD_CLOEXEC, 3), FD_COMMAND, command_num, "builtin stdout");
+		if ( fd < 0 || !(io.out = fdopen(fd, "w")) ) {
+			fprintf(stderr, "\nError redirecting builtin output. ERRNO\"%d\"\n", errno);
+			if ( fd >= 0 )
+				fdreg_close(fd);
+			return EXIT_FAILURE;
+		}
+	}
+	if ( err == out )
+		io.err = io.out;
+	else if ( err != STDERR_FILENO ) {
+		fd = fdreg_track(fcntl(err, F_DUPFD_CLOEXEC, 3), FD_COMMAND, command_num, "builtin stderr");
+		if ( fd < 0 || !(io.err = fdopen(fd, "w")) ) {
+			fprintf(stderr, "\nError redirecting builtin output. ERRNO\"%d\"\n", errno);
+			if ( fd >= 0 )
+				fdreg_close(fd);
+			if ( io.out != stdout ) {
+				fdreg_forget(fileno(io.out));
+				fclose(io.out);
+			}
+			return EXIT_FAILURE;
+		}
+	}
+
+	TRACE_BEGIN(t_builtin);
+	status = fn(cmd, &io);
+	TRACE_END(TRACE_BUILTIN, t_builtin, cmd->tok[0]);
+
+	if ( io.err != stderr && io.err != io.out ) {
+		fdreg_forget(fileno(io.err));
+		fclose(io.err);
+	}
+	if ( io.out != stdout ) {
+		fdreg_forget(fileno(io.out));
+		fclose(io.out);
+	}
+	return status;
+}
+
+/**
+	* Body of a forked builtin helper
+	*
+	* @param arg builtin_call to run
+	* @return exit status
+	*/
+static int builtin_child(void* arg) {
+	builtin_call* call = arg;
+	io_ctx io = { STDIN_FILENO, stdout, stderr };
+
+	// The job set belongs to the shell - don't let jobs/output steal events
+	fdreg_close(job_event_fd);
+	job_event_fd = -1;
+	trace_child();
+	spawn_detach();
+
+	return call->fn(call->cmd, &io);
+}
+
+/**
+	* Run a builtin in a forked helper with the queued file actions applied
+	*
+	* @param sp launch description
+	* @param fn builtin
+	* @param cmd command struct
+	* @return pid of the helper, or -1 on failure
+	*/
+pid_t spawn_builtin(spawn_t* sp, builtin_fn fn, command_t* cmd) {
+	builtin_call call = { fn, cmd };
+
+	return spawn_function(sp, builtin_child, &call);
+}
+
+/**************************************************************************
+ * File Execution Functions 
+ **************************************************************************/
+
+/**
+	* Bring a whole script into memory. Regular files are mapped privately
+	* (tokenizing writes NULs into the copy-on-write pages); pipes and
+	* terminals are read to the end.
+	*
+	* @param script script struct, data/size/mapped are filled in
+	* @param fd open script descriptor
+	* @return bool success
+	*/
+static bool read_script(script_t* script, int fd) {
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+
+	script->data = NULL;
+	script->size = 0;
+	script->mapped = false;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// mmap - the final line needs a spare byte for its NUL, which the zero
+	// filled tail of the last page provides unless the file fills it exactly
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 ) {
+		char* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+		if ( data != MAP_FAILED ) {
+			if ( data[st.st_size - 1] == '\n' || st.st_size % page ) {
+				madvise(data, st.st_size, MADV_SEQUENTIAL);
+				script->data = data;
+				script->size = st.st_size;
+				script->mapped = true;
+				return true;
+			}
+			munmap(data, st.st_size);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Slurp
+	////////////////////////////////////////////////////////////////////////////////
+	size_t cap = READER_CHUNK_SIZE;
+	if ( !(script->data = malloc(cap + 1)) )
+		return false;
+
+	for ( ;; ) {
+		ssize_t n;
+
+		if ( cap - script->size < READER_CHUNK_SIZE ) {
+			char* grown = realloc(script->data, cap * 2 + 1);
+			if ( !grown )
+				return false;
+			script->data = grown;
+			cap *= 2;
+		}
+
+		n = read(fd, script->data + script->size, cap - script->size);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 ) {
+			fprintf(stderr, "Error reading script. ERRNO\"%d\"\n", errno);
+			return false;
+		}
+		if ( n == 0 )
+			break;
+		script->size += n;
+	}
+	script->data[script->size] = '\0';
+	return true;
+}
+
+/**
+	* Next line of a script being parsed. The line is NUL terminated in
+	* place, with its newline (and carriage return) removed.
+	*
+	* @param src script cursor, advanced past the line
+	* @param line set to the start of the line
+	* @return length of the line, or -1 at the end of the script
+	*/
+static ssize_t script_getline(void* src, char** line) {
+	script_cursor* cur = src;
+	char* nl;
+	size_t len;
+
+	if ( cur->p >= cur->end )
+		return -1;
+	nl = memchr(cur->p, '\n', cur->end - cur->p);
+	len = (nl ? nl : cur->end) - cur->p;
+	(*cur->num_lines)++;
+
+	*line = cur->p;
+	if ( len && cur->p[len - 1] == '\r' )
+		len--;
+	cur->p[len] = '\0';
+	cur->p = nl ? nl + 1 : cur->end;
+	return len;
+}
+
+/**
+	* Load and parse a whole script up front. Every syntax error is reported
+	* before anything runs.
+	*
+	* @param script script struct to fill in
+	* @param fd open script descriptor
+	* @param name script name used in error messages
+	* @return bool true if the script loaded and is free of syntax errors
+	*/
+bool load_script(script_t* script, int fd, const char* name) {
+	size_t lines = 0, errors = 0;
+	script_cursor cur;
+	ssize_t len;
+	char* line;
+	char* p;
+	char* end;
+
+	memset(&script->mem, 0, sizeof(script->mem));
+	script->cmds = NULL;
+	script->num_cmds = 0;
+	script->num_lines = 0;
+
+	if ( !read_script(script, fd) )
+		return false;
+	end = script->data + script->size;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Size the command list from the line count
+	////////////////////////////////////////////////////////////////////////////////
+	for ( p = script->data; p < end && (p = memchr(p, '\n', end - p)); p++ )
+		lines++;
+	if ( script->size && end[-1] != '\n' )
+		lines++;
+	if ( !(script->cmds = arena_alloc(&script->mem, (lines + 1) * sizeof(command_t))) )
+		return false;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parse every line in place. A here-document body is taken from the
+	// lines that follow its command, which are then not parsed themselves.
+	////////////////////////////////////////////////////////////////////////////////
+	cur = (script_cursor) { script->data, end, &script->num_lines };
+	while ( (len = script_getline(&cur, &line)) >= 0 ) {
+		command_t* cmd = &script->cmds[script->num_cmds];
+		const char* bad;
+
+		if ( !parse_command(cmd, line, len, &script->mem) )
+			return false;
+
+		// Blank lines and comments never reach the run loop
+		if ( !cmd->toklen || cmd->tok[0][0] == '#' )
+			continue;
+
+		if ( (bad = syntax_error(cmd)) ) {
+			fprintf(stderr, "quash: %s:%zu: syntax error near unexpected token `%s'\n",
+				name, script->num_lines, bad);
+			errors++;
+		}
+		else if ( !read_heredoc(cmd, script_getline, &cur, &script->mem) )
+			return false;
+		script->num_cmds++;
+	}
+
+	return errors == 0;
+}
+
+/**
+	* Release everything owned by a loaded script
+	*
+	* @param script script struct
+	*/
+void free_script(script_t* script) {
+	if ( script->mapped )
+		munmap(script->data, script->size);
+	else
+		free(script->data);
+	arena_free(&script->mem);
+	script->data = NULL;
+}
+
+/**
+	* Write a worker's output straight to stdout
+	*
+	* @param data bytes to write
+	* @param len number of bytes
+	*/
+static void write_through(const char* data, size_t len) {
+	size_t off = 0;
+
+	fflush(stdout);
+	while ( off < len ) {
+		ssize_t n = write(STDOUT_FILENO, data + off, len - off);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			break;
+		off += n;
+	}
+}
+
+/**
+	* Write a finished command's output to stdout and release it
+	*
+	* @param out buffer
+	*/
+static void emit_output(out_buf* out) {
+	write_through(out->data, out->len);
+	free(out->data);
+	out->data = NULL;
+	out->len = out->cap = 0;
+}
+
+/**
+	* Move everything currently readable from a worker's pipe into its buffer
+	*
+	* @param slot worker slot
+	* @param out the worker's output buffer
+	*/
+static void drain_worker(worker_slot* slot, out_buf* out) {
+	char buf[READER_CHUNK_SIZE];
+	ssize_t n;
+
+	while ( slot->fd >= 0 ) {
+		n = read(slot->fd, buf, sizeof(buf));
+		if ( n > 0 ) {
+			// Out of memory - give up on ordering rather than lose output
+			if ( !out_append(out, buf, n) ) {
+				emit_output(out);
+				write_through(buf, n);
+			}
+			continue;
+		}
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n == 0 || errno != EAGAIN ) {
+			fdreg_close(slot->fd);
+			slot->fd = -1;
+		}
+		break;
+	}
+}
+
+/**
+	* Write a finished command's output, then report it on stderr if it
+	* failed. The failure also becomes $?, so the last one reported is the
+	* shell's exit status.
+	*
+	* @param script loaded script
+	* @param outs output buffers, indexed by script position
+	* @param statuses exit statuses, indexed by script position
+	* @param index script position of the command
+	*/
+static void emit_command(script_t* script, out_buf* outs, int* statuses, size_t index) {
+	emit_output(&outs[index]);
+	if ( statuses[index] ) {
+		fprintf(stderr, "quash: command %zu (%s) exited with status %d\n",
+			index + 1, script->cmds[index].tok[0], statuses[index]);
+		last_status = statuses[index];
+	}
+}
+
+/**
+	* Fork a worker running one script command with stdout and stderr going
+	* into a pipe
+	*
+	* @param slot worker slot to fill in
+	* @param cmd command to run
+	* @param index position of the command in the script
+	* @param envp environment variables
+	* @return bool success
+	*/
+static bool start_worker(worker_slot* slot, command_t* cmd, size_t index, char* envp[]) {
+	int file_desc[2];
+
+	if ( pipe2(file_desc, O_CLOEXEC) < 0 ) {
+		fprintf(stderr, "\nError in pipe creation. ERRNO:%d\n", errno);
+		return false;
+	}
+	fdreg_track(file_desc[0], FD_WORKER, (int) index, "worker output pipe");
+	fdreg_track(file_desc[1], FD_WORKER, (int) index, "worker output pipe");
+
+	fflush(stdout);
+	fflush(stderr);
+	clock_gettime(CLOCK_MONOTONIC, &slot->started);
+	slot->pid = fork();
+	if ( slot->pid < 0 ) {
+		fprintf(stderr, "Error forking parallel worker. ERRNO\"%d\"\n", errno);
+		fdreg_close(file_desc[0]);
+		fdreg_close(file_desc[1]);
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Child - run the command as if it were the only one
+	////////////////////////////////////////////////////////////////////////////////
+	if ( slot->pid == 0 ) {
+		dup2(file_desc[1], STDOUT_FILENO);
+		dup2(file_desc[1], STDERR_FILENO);
+		drop_inherited_fds();		// this pipe and every other worker's
+
+		signal(SIGCHLD, SIG_DFL);
+		sigprocmask(SIG_UNBLOCK, &sigmask_1, NULL);
+		trace_child();
+		spawn_detach();
+
+		run_quash(cmd, envp);
+		fflush(stdout);
+		_exit(last_status);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parent - keep the read end, non-blocking so a drain never stalls
+	////////////////////////////////////////////////////////////////////////////////
+	fdreg_close(file_desc[1]);
+	fcntl(file_desc[0], F_SETFL, O_NONBLOCK);
+	slot->fd = file_desc[0];
+	slot->index = index;
+	return true;
+}
+
+/**
+	* Run a loaded script with up to parallel_jobs commands in flight. Each
+	* command's stdout and stderr are collected in their own buffer and
+	* written out in script order (or as commands finish with --unordered),
+	* followed by a note on stderr for any command that failed.
+	* A single poll() loop over the workers' pipes and the SIGCHLD signalfd
+	* drives everything.
+	*
+	* @param script loaded script
+	* @param envp environment variables
+	* @return number of commands started
+	*/
+static size_t exec_parallel(script_t* script, char* envp[]) {
+	int num_slots = parallel_jobs, active = 0, i;
+	worker_slot* slots = calloc(num_slots, sizeof(worker_slot));
+	struct pollfd* fds = calloc(num_slots + 1, sizeof(struct pollfd));
+	out_buf* outs = calloc(script->num_cmds, sizeof(out_buf));
+	bool* done = calloc(script->num_cmds, sizeof(bool));
+	int* statuses = calloc(script->num_cmds, sizeof(int));
+	size_t next = 0, emitted = 0;
+	bool stop = false;
+	int sfd = sigchld_fd, exit_code = -1;
+
+	if ( !slots || !fds || !outs || !done || !statuses ) {
+		fprintf(stderr, "quash: out of memory for %d parallel jobs\n", num_slots);
+		free(slots); free(fds); free(outs); free(done); free(statuses);
+		return 0;
+	}
+	for ( i = 0; i < num_slots; i++ )
+		slots[i].pid = slots[i].fd = -1;
+
+	while ( emitted < next || (!stop && next < script->num_cmds) ) {
+		////////////////////////////////////////////////////////////////////////////////
+		// Fill free slots
+		////////////////////////////////////////////////////////////////////////////////
+		for ( i = 0; i < num_slots && !stop && next < script->num_cmds; i++ ) {
+			command_t* cmd = &script->cmds[next];
+
+			if ( slots[i].pid >= 0 )
+				continue;
+			if ( !strcmp(cmd->tok[0], "exit") || !strcmp(cmd->tok[0], "quit") ) {
+				if ( cmd->toklen > 1 )
+					exit_code = atoi(cmd->tok[1]) & 0xff;
+				stop = true;
+				break;
+			}
+			if ( !start_worker(&slots[i], cmd, next, envp) ) {
+				stop = true;
+				break;
+			}
+			next++;
+			active++;
+		}
+		if ( !active && emitted == next )
+			break;
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Wait for output or exits
+		////////////////////////////////////////////////////////////////////////////////
+		int nfds = 0;
+		fds[nfds].fd = sfd;
+		fds[nfds++].events = POLLIN;
+		for ( i = 0; i < num_slots; i++ ) {
+			if ( slots[i].fd >= 0 ) {
+				fds[nfds].fd = slots[i].fd;
+				fds[nfds++].events = POLLIN;
+			}
+		}
+		if ( poll(fds, nfds, sfd < 0 ? 10 : -1) < 0 && errno != EINTR )
+			break;
+
+		for ( i = 0; i < num_slots; i++ ) {
+			if ( slots[i].fd >= 0 )
+				drain_worker(&slots[i], &outs[slots[i].index]);
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Reap every worker that has exited
+		////////////////////////////////////////////////////////////////////////////////
+		struct signalfd_siginfo si;
+		while ( sfd >= 0 && read(sfd, &si, sizeof(si)) > 0 ) {}
+
+		pid_t p;
+		int wait_status;
+		struct rusage ru;
+		usage u;
+		while ( active && (p = wait4(-1, &wait_status, WNOHANG, &ru)) > 0 ) {
+			for ( i = 0; i < num_slots && slots[i].pid != p; i++ ) {}
+			if ( i == num_slots )
+				continue;
+
+			// A worker's rusage covers the command it ran
+			usage_from_rusage(&u, &ru, &slots[i].started, NULL);
+			usage_record(script->cmds[slots[i].index].tok[0], &u);
+
+			drain_worker(&slots[i], &outs[slots[i].index]);
+			if ( slots[i].fd >= 0 ) {
+				fdreg_close(slots[i].fd);
+				slots[i].fd = -1;
+			}
+			done[slots[i].index] = true;
+			statuses[slots[i].index] = exit_status(wait_status);
+			if ( parallel_unordered ) {
+				emit_command(script, outs, statuses, slots[i].index);
+				emitted++;
+			}
+			slots[i].pid = -1;
+			active--;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Emit finished output in script order
+		////////////////////////////////////////////////////////////////////////////////
+		while ( !parallel_unordered && emitted < next && done[emitted] )
+			emit_command(script, outs, statuses, emitted++);
+	}
+
+	free(slots);
+	free(fds);
+	free(outs);
+	free(done);
+	free(statuses);
+	if ( exit_code >= 0 )
+		last_status = exit_code;
+	return next;
+}
+
+/**
+	* Executes any Quash commands from the given file 
+	*
+	* The script is loaded and parsed completely before the first command
+	* runs. The script is argv[optind] when given, otherwise stdin.
+	*
+	* @param argc argument count from the command line
+	* @param argv argument vector from the command line
+	* @param envp environment variables
+	* @return exit status of the last command run, or the one given to exit
+	*/
+int exec_from_file(char** argv, int argc, char* envp[]) {
+	
+	////////////////////////////////////////////////////////////////////////////////
+	// Args
+	////////////////////////////////////////////////////////////////////////////////
+	script_t script;
+	const char* name = "stdin";
+	int fd = STDIN_FILENO;
+	struct timespec t0, t1, t2;
+	size_t i;
+
+	if ( optind < argc ) {
+		name = argv[optind];
+		if ( (fd = fdreg_track(open(name, O_RDONLY | O_CLOEXEC), FD_SHELL, 0, "script")) < 0 ) {
+			fprintf(stderr, "quash: %s: Cannot open script. ERRNO\"%d\"\n", name, errno);
+			return EXIT_FAILURE;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Load and parse the whole script
+	////////////////////////////////////////////////////////////////////////////////
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	TRACE_BEGIN(t_read);
+	bool loaded = load_script(&script, fd, name);
+	TRACE_END(TRACE_READ, t_read, name);
+	if ( fd != STDIN_FILENO )
+		fdreg_close(fd);
+	if ( !loaded ) {
+		free_script(&script);
+		return 2;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Command Loop
 	////////////////////////////////////////////////////////////////////////////////
-	while (get_command(&cmd, stdin)) {
-		run_quash(&cmd, envp);
+	start_from_file();
+	if ( parallel_jobs > 1 )
+		i = exec_parallel(&script, vars_envp());
+	else {
+		for ( i = 0; i < script.num_cmds && running_from_file; i++ ) {
+			run_quash(&script.cmds[i], vars_envp());
+			arena_reset(&cmd_arena);
+			if ( job_count() )
+				reap_jobs();
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Report parse cost separately from execution cost
+	////////////////////////////////////////////////////////////////////////////////
+	if ( report_timing ) {
+		double parse = elapsed_ms(&t0, &t1), exec = elapsed_ms(&t1, &t2);
+		fprintf(stderr, "quash: parsed %zu lines in %.3f ms (%.0f lines/sec, %s)\n",
+			script.num_lines, parse, parse > 0 ? script.num_lines / (parse / 1e3) : 0.0,
+			script.mapped ? "mmap" : "read");
+		fprintf(stderr, "quash: executed %zu commands in %.3f ms (%.0f lines/sec)\n",
+			i, exec, exec > 0 ? i / (exec / 1e3) : 0.0);
+		usage_summary(stderr);
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Terminate File execution and start normal program execution
 	////////////////////////////////////////////////////////////////////////////////
 	terminate_from_file();
+	free_script(&script);
+	return last_status;
 }
 
 /**************************************************************************
@@ -422,36 +2443,88 @@ void exec_from_file(char** argv, int argc, char* envp[]) {
  **************************************************************************/
 
 /**
-	* Runs the specified Quash command
+	* Runs the specified Quash command
+	*
+	* @param cmd command struct
+	* @param envp environment variables
+	*/
+void run_quash(command_t* cmd, char** envp) {
+	command_t expanded;
+
+	command_num++;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Variables are expanded now, not when the line was parsed, so a script
+	// sees the values assigned by the commands before it
+	////////////////////////////////////////////////////////////////////////////////
+	if ( cmd->expand ) {
+		if ( !expand_command(cmd, &expanded, &cmd_arena) ) {
+			fprintf(stderr, "quash: out of memory expanding `%s'\n", cmd->tok[0]);
+			expanded.toklen = 0;
+		}
+		cmd = &expanded;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Do nothing -- just print the cwd to display we're still in the shell.
+	// exit and quit are builtins like any other.
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !cmd->toklen ) {}
+	else {
+		TRACE_BEGIN(t_cmd);
+		last_status = exec_command(cmd, envp);
+		TRACE_END(TRACE_COMMAND, t_cmd, cmd->tok[0]);
+	}
+
+	// Nothing a finished command opened outlives it
+	fdreg_close_owner(FD_COMMAND, command_num);
+
+	if ( running )
+		print_init();
+}
+
+/**
+	* Time Implementation
 	*
-	* @param cmd command struct
+	* Runs the command following "time" and reports on stderr the wall time
+	* it took and the resources used by every child it waited for, like the
+	* shell keyword (so "time a | b" times the whole pipeline).
+	*
+	* @param cmd command struct, starting with "time"
 	* @param envp environment variables
+	* @return RETURN_CODE of the timed command
 	*/
-void run_quash(command_t* cmd, char** envp) {
-	////////////////////////////////////////////////////////////////////////////////
-	// Command Decision Structure
-	////////////////////////////////////////////////////////////////////////////////
-	if ( !strcmp(cmd->cmdstr, "exit") || !strcmp(cmd->cmdstr, "quit") )
-		terminate(); // Exit Quash
+int exec_timed_command(command_t* cmd, char* envp[])
+{
+	command_t timed = *cmd;
+	struct timespec start, now;
+	struct rusage self0, self1;
+	int RETURN_CODE = EXIT_SUCCESS;
+
+	timed.tok++;
+	timed.toklen--;
+
+	memset(&fg_usage, 0, sizeof(fg_usage));
+	getrusage(RUSAGE_SELF, &self0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( timed.toklen )
+		RETURN_CODE = exec_command(&timed, envp);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	getrusage(RUSAGE_SELF, &self1);
+
 	////////////////////////////////////////////////////////////////////////////////
-	// Do nothing -- just print the cwd to display we're still in the shell.
+	// Wall time covers the whole command, not the sum of its stages; CPU time
+	// the shell spent itself (builtins) is added to that of the children
 	////////////////////////////////////////////////////////////////////////////////
-	else if ( !cmd->cmdlen ) {}
-	else if ( strcmp(cmd->tok[0], "cd") == 0 )
-		cd(cmd);
-	else if ( strcmp(cmd->tok[0], "echo") == 0 )
-		echo(cmd);
-	else if ( !strcmp(cmd->tok[0], "jobs") )
-		jobs(cmd);
-	else if ( !strcmp(cmd->tok[0], "kill") )
-		kill_proc(cmd);
-	else if ( !strcmp(cmd->tok[0], "set") )
-		set(cmd);
-	else
-		exec_command(cmd, envp);
-
-	if ( running )
-		print_init();
+	fg_usage.wall_ms = elapsed_ms(&start, &now);
+	fg_usage.user_ms += (self1.ru_utime.tv_sec - self0.ru_utime.tv_sec) * 1e3
+		+ (self1.ru_utime.tv_usec - self0.ru_utime.tv_usec) / 1e3;
+	fg_usage.sys_ms += (self1.ru_stime.tv_sec - self0.ru_stime.tv_sec) * 1e3
+		+ (self1.ru_stime.tv_usec - self0.ru_stime.tv_usec) / 1e3;
+	fflush(stdout);
+	usage_print(stderr, &fg_usage);
+	fputc('\n', stderr);
+	return RETURN_CODE;
 }
 
 /**
@@ -464,44 +2537,48 @@ void run_quash(command_t* cmd, char** envp) {
 int exec_command(command_t* cmd, char* envp[])
 {
 	////////////////////////////////////////////////////////////////////////////////
-	// Command Flag Initializations
+	// time <command> - run the rest of the line and report what it used
 	////////////////////////////////////////////////////////////////////////////////
-	bool b_bool = false;	//background
-	bool i_bool = false;	//input redirection
-	bool o_bool = false;	//output redirection
-	bool p_bool = false;	//pipe
+	if ( !strcmp(cmd->tok[0], "time") )
+		return exec_timed_command(cmd, envp);
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Walk command tokens and flip flags
+	// NAME=VALUE on its own assigns a shell variable
 	////////////////////////////////////////////////////////////////////////////////
-	int i = 1;
-	for (; i < cmd->toklen; i++) {
-		if ( !strcmp(cmd->tok[i], "&") )
-			b_bool = true;
-		else if ( !strcmp(cmd->tok[i], "<") )
-			i_bool = true;
-		else if ( !strcmp(cmd->tok[i], ">") )
-			o_bool = true;
-		else if ( !strcmp(cmd->tok[i], "|") )
-			p_bool = true;
+	if ( cmd->toklen == 1 && is_assignment(cmd->tok[0]) ) {
+		if ( assign(cmd->tok[0], false) )
+			return EXIT_SUCCESS;
+		fprintf(stderr, "quash: %s: Cannot assign variable\n", cmd->tok[0]);
+		return EXIT_FAILURE;
 	}
 
+	TRACE_BEGIN(t_dispatch);
+
 	////////////////////////////////////////////////////////////////////////////////
-	// Execute designated command
+	// Operators were classified while tokenizing - only a plain command can
+	// run as a builtin in place
 	////////////////////////////////////////////////////////////////////////////////
 	int RETURN_CODE = 0;
-	// we have access to numArgs here and this will be portable
-	if ( b_bool ) {
+	builtin_fn fn = NULL;
+	if ( !cmd->ops )
+		fn = find_builtin(cmd->tok[0]);
+	TRACE_END(TRACE_DISPATCH, t_dispatch, cmd->tok[0]);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Execute designated command
+	////////////////////////////////////////////////////////////////////////////////
+	if ( cmd->ops & OP_BACKGROUND ) {
 		cmd->tok[cmd->toklen - 1] = '\0'; // remove & token
 		cmd->toklen--;
+		cmd->ops &= ~OP_BACKGROUND;
 		RETURN_CODE = exec_backg_command(cmd, envp);
 	} 
-	else if ( i_bool )
-		RETURN_CODE = exec_redir_command(cmd, true, envp);
-	else if ( o_bool )
-		RETURN_CODE = exec_redir_command(cmd, false, envp);
-	else if ( p_bool )
+	else if ( cmd->ops & OP_PIPE )
 		RETURN_CODE = exec_pipe_command(cmd, envp);
+	else if ( cmd->ops & OP_REDIRECT )
+		RETURN_CODE = exec_redir_command(cmd, envp);
+	else if ( fn )
+		RETURN_CODE = run_builtin(fn, cmd, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
 	else
 		RETURN_CODE = exec_basic_command(cmd, envp);
 	return RETURN_CODE;
@@ -521,142 +2598,394 @@ int exec_basic_command(command_t* cmd, char* envp[])
 	////////////////////////////////////////////////////////////////////////////////
 	pid_t p;
 	int wait_status;
+	struct timespec start;
 	signal(SIGINT, mask_signal);	
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Fork And Verify Process
+	// Spawn And Verify Process
 	////////////////////////////////////////////////////////////////////////////////
-	p = fork();
-	if ( p < 0 ) {
-		fprintf(stderr, "Error forking basic command. Error:%d\n", errno);
-		exit(EXIT_FAILURE);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( (p = spawn_command(NULL, cmd->tok, envp)) < 0 ) {
+		wait_status = launch_status(errno);
+		signal(SIGINT, unmask_signal);
+		return wait_status;
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Parent
+	// Wait for the child
 	////////////////////////////////////////////////////////////////////////////////
-	if ( p != 0 ) {
-		if ( waitpid(p, &wait_status, 0) < 0 ) {
-			signal(SIGINT, unmask_signal);
-			fprintf(stderr, "Error with basic command's child	%d. ERRNO\"%d\"\n", p, errno);
-			return EXIT_FAILURE;
-		}
-		if ( WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == EXIT_FAILURE )
-			return EXIT_FAILURE;
+	if ( wait_child(p, &wait_status, cmd->tok[0], &start) < 0 ) {
 		signal(SIGINT, unmask_signal);
-		return EXIT_SUCCESS;
+		fprintf(stderr, "Error with basic command's child	%d. ERRNO\"%d\"\n", p, errno);
+		return EXIT_FAILURE;
 	}
-	
+	signal(SIGINT, unmask_signal);
+	return exit_status(wait_status);
+}
+
+/**
+	* Descriptor to read inline data from. Data that fits in a pipe is
+	* written into one; anything larger goes into a memfd sealed against
+	* changes, so writing it never blocks waiting for a reader that has not
+	* started yet and nothing touches the filesystem.
+	*
+	* @param data bytes to read back
+	* @param len length of data
+	* @return close-on-exec descriptor positioned at the start of the data,
+	* or -1 on error with errno set
+	*/
+static int here_fd(const char* data, size_t len) {
+	int file_desc[2], fd, out, cap;
+	size_t off = 0;
+	ssize_t n;
+
+	if ( pipe2(file_desc, O_CLOEXEC) < 0 )
+		return -1;
+	fdreg_track(file_desc[0], FD_COMMAND, command_num, "here-document pipe");
+	fdreg_track(file_desc[1], FD_COMMAND, command_num, "here-document pipe");
+	if ( (cap = fcntl(file_desc[1], F_GETPIPE_SZ)) > 0 && len <= (size_t) cap ) {
+		fd = file_desc[0];
+		out = file_desc[1];
+	}
+	else {
+		fdreg_close(file_desc[0]);
+		fdreg_close(file_desc[1]);
+		fd = fdreg_track(memfd_create("quash-here", MFD_CLOEXEC | MFD_ALLOW_SEALING),
+			FD_COMMAND, command_num, "here-document memfd");
+		if ( fd < 0 )
+			return -1;
+		out = fd;
+	}
+
+	while ( off < len ) {
+		if ( (n = write(out, data + off, len - off)) < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 ) {
+			int saved = errno;
+			if ( out != fd )
+				fdreg_close(out);
+			fdreg_close(fd);
+			errno = saved;
+			return -1;
+		}
+		off += n;
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
-	// Child
+	// Pipe - the reader sees end of file once the data is drained.
+	// Memfd - make it read-only for good and rewind it.
 	////////////////////////////////////////////////////////////////////////////////
+	if ( out != fd )
+		fdreg_close(out);
 	else {
-		if ( execvpe(cmd->tok[0], cmd->tok, envp) < 0	&& errno == 2 ) {
-			fprintf(stderr, "Command: \"%s\" not found.\n", cmd->tok[0]);
-			exit(EXIT_FAILURE);
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+		lseek(fd, 0, SEEK_SET);
+	}
+	return fd;
+}
+
+/**
+	* Descriptor to read a command's here-document or here-string from
+	*
+	* @param cmd command struct
+	* @param r REDIR_HEREDOC or REDIR_HERESTRING redirection
+	* @return descriptor, or -1 on error
+	*/
+static int here_input(command_t* cmd, const redirect_t* r) {
+	out_buf data = { NULL, 0, 0 };
+	bool ok;
+	int fd;
+
+	if ( r->kind == REDIR_HERESTRING )
+		ok = out_append(&data, r->word, strlen(r->word)) && out_append(&data, "\n", 1);
+	else if ( cmd->here_expand && memchr(cmd->here, '$', cmd->here_len) )
+		ok = expand_word(cmd->here, &data, false);
+	else
+		return here_fd(cmd->here ? cmd->here : "", cmd->here_len);
+
+	fd = ok ? here_fd(data.data, data.len) : -1;
+	free(data.data);
+	return fd;
+}
+
+/**
+	* Move a command's redirections out of its argument vector, keeping
+	* their order
+	*
+	* @param cmd command struct, left with only its arguments
+	* @param redirs receives up to MAX_REDIRS redirections
+	* @param num receives the number of redirections
+	* @return bool false if a redirection is malformed (reported)
+	*/
+static bool take_redirs(command_t* cmd, redirect_t* redirs, size_t* num) {
+	size_t i, j = 1, len;
+	char* end;
+
+	*num = 0;
+	for ( i = 1; i < cmd->toklen; i++ ) {
+		char* t = cmd->tok[i];
+		redirect_t r;
+
+		if ( !(len = redir_parse(t, &r)) ) {
+			cmd->tok[j++] = t;
+			continue;
 		}
-		else {
-			fprintf(stderr, "Error executing %s. ERRNO\"%d\"\n", cmd->tok[0], errno);
-			exit(EXIT_FAILURE);
+
+		// A word that expanded to nothing leaves the operator without one
+		if ( !(r.word = t[len] ? t + len : cmd->tok[++i]) ) {
+			fprintf(stderr, "quash: %s: ambiguous redirect\n", t);
+			return false;
+		}
+		if ( *num == MAX_REDIRS ) {
+			fprintf(stderr, "quash: %s: too many redirections\n", cmd->tok[0]);
+			return false;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// N>&M copies a descriptor and N>&- closes one; >&file is &>file
+		////////////////////////////////////////////////////////////////////////////////
+		if ( r.kind == REDIR_DUP ) {
+			r.src = (int) strtol(r.word, &end, 10);
+			if ( !strcmp(r.word, "-") )
+				r.kind = REDIR_CLOSE;
+			else if ( end == r.word || *end || r.src < 0 ) {
+				if ( t[0] != '>' ) {
+					fprintf(stderr, "quash: %s: ambiguous redirect\n", r.word);
+					return false;
+				}
+				r.kind = REDIR_WRITE;
+				r.fd = -1;
+			}
+		}
+		redirs[(*num)++] = r;
+	}
+	cmd->toklen = j;
+	cmd->tok[j] = NULL;
+	return true;
+}
+
+/**
+	* Descriptor a child would find at fd once the file actions queued so
+	* far have run
+	*
+	* @param sp launch description
+	* @param fd descriptor in the child
+	* @return descriptor of the shell it is a copy of, or -1 if it is closed.
+	* Only stdin, stdout and stderr are inherited from the shell; its other
+	* descriptors are its own.
+	*/
+static int redir_source(spawn_t* sp, int fd) {
+	int i;
+
+	for ( i = sp->num_actions - 1; i >= 0; i-- ) {
+		if ( sp->actions[i].fd == fd )
+			return (sp->actions[i].type == SPAWN_DUP2) ? sp->actions[i].src : -1;
+	}
+	return (fd <= STDERR_FILENO) ? fd : -1;
+}
+
+/**
+	* Take a command's redirections, open their files (close-on-exec) and
+	* queue them in order as file actions. The source of every N>&M is
+	* resolved against the actions already queued, so each backend (the fork
+	* server included) is handed the descriptor itself rather than a
+	* number that only means something in the child.
+	*
+	* @param cmd command struct, left with only its arguments
+	* @param sp launch description to add to
+	* @param opened receives the descriptors opened, to close once the
+	* command has started
+	* @param num_opened receives the number of descriptors opened
+	* @return bool false on error (reported); opened is still filled in
+	*/
+static bool redir_prepare(command_t* cmd, spawn_t* sp, int* opened, size_t* num_opened) {
+	redirect_t redirs[MAX_REDIRS];
+	size_t i, num;
+	bool ok = true;
+	int fd;
+
+	*num_opened = 0;
+	if ( !take_redirs(cmd, redirs, &num) )
+		return false;
+
+	for ( i = 0; ok && i < num; i++ ) {
+		redirect_t* r = &redirs[i];
+
+		switch ( r->kind ) {
+			case REDIR_DUP:
+				if ( (fd = redir_source(sp, r->src)) < 0 ) {
+					fprintf(stderr, "quash: %d: Bad file descriptor\n", r->src);
+					return false;
+				}
+				ok = spawn_add_dup2(sp, fd, r->fd);
+				continue;
+			case REDIR_CLOSE:
+				ok = spawn_add_close(sp, r->fd);
+				continue;
+			case REDIR_READ:
+				fd = fdreg_track(open(r->word, O_RDONLY | O_CLOEXEC),
+					FD_COMMAND, command_num, "redirection");
+				break;
+			case REDIR_WRITE:
+			case REDIR_APPEND:
+				fd = fdreg_track(open(r->word, O_WRONLY | O_CREAT | O_CLOEXEC
+					| (r->kind == REDIR_APPEND ? O_APPEND : O_TRUNC),
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH), FD_COMMAND, command_num, "redirection");
+				break;
+			default:
+				fd = here_input(cmd, r);
+				break;
 		}
-		exit(EXIT_SUCCESS);
+
+		if ( fd < 0 ) {
+			if ( r->kind == REDIR_HEREDOC || r->kind == REDIR_HERESTRING )
+				fprintf(stderr, "\nError creating here-document. ERRNO\"%d\"\n", errno);
+			else
+				fprintf(stderr, "\nError opening %s. ERRNO\"%d\"\n", r->word, errno);
+			return false;
+		}
+		opened[(*num_opened)++] = fd;
+		if ( r->fd < 0 )
+			ok = spawn_add_dup2(sp, fd, STDOUT_FILENO) && spawn_add_dup2(sp, fd, STDERR_FILENO);
+		else
+			ok = spawn_add_dup2(sp, fd, r->fd);
+	}
+
+	if ( !ok )
+		fprintf(stderr, "quash: %s: too many redirections\n", cmd->tok[0]);
+	return ok;
+}
+
+/**
+	* Close the descriptors redir_prepare() opened
+	*
+	* @param opened descriptors
+	* @param num number of descriptors
+	*/
+static void redir_release(int* opened, size_t num) {
+	while ( num )
+		fdreg_close(opened[--num]);
+}
+
+/**
+	* Work out whether a builtin can run in the shell on the descriptors a
+	* launch description would give a child: only stdin, stdout and stderr
+	* may be touched, and none of them closed
+	*
+	* @param sp launch description
+	* @param fds receives the builtin's stdin, stdout and stderr
+	* @return true if the builtin can run in the shell
+	*/
+static bool redir_in_shell(spawn_t* sp, int fds[3]) {
+	int i;
+
+	for ( i = 0; i < sp->num_actions; i++ ) {
+		if ( sp->actions[i].fd > STDERR_FILENO )
+			return false;
+	}
+	for ( i = STDIN_FILENO; i <= STDERR_FILENO; i++ ) {
+		if ( (fds[i] = redir_source(sp, i)) < 0 )
+			return false;
 	}
+	return true;
 }
 
 /**
-	* Executes any command with an I/O redirection present 
+	* Spawns a pipeline stage (a forked helper for builtins) and redirects
+	* its file streams for use in iterative fashion. The stage's own
+	* redirections are applied after the pipe ends, in order.
 	*
 	* @param cmd command struct
-	* @param io true is stdin, false is stdout
+	* @param fsi file descriptor in
+	* @param fso file descriptor out
+	* @param status if not NULL, a builtin may run in the shell itself; its
+	* exit status is stored here and 0 is returned. A failed launch stores
+	* 127 or 126 here.
 	* @param envp environment variables
-	* @return RETURN_CODE
+	* @return pid of the spawned stage, 0 if it ran in the shell, or -1 on
+	* failure
 	*/
-int exec_redir_command(command_t* cmd, bool io, char* envp[])
+int iterative_fork_helper (command_t* cmd, int fsi, int fso, int* status, char* envp[])
 {
+	int opened[MAX_REDIRS], fds[3];
+	size_t num_opened = 0;
+	spawn_t sp;
+	pid_t p;
+	spawn_reset(&sp);
+
 	////////////////////////////////////////////////////////////////////////////////
-	// Mask Inturrept Signals and Initialize Variables
+	// Redirect for STDOUT and STDIN - the pipe ends are close-on-exec, and a
+	// forked builtin helper closes everything above stderr itself
 	////////////////////////////////////////////////////////////////////////////////
-	pid_t p;
-	int wait_status;
-	int file_desc;
-	signal(SIGINT, mask_signal);	
+	if ( fso != STDOUT_FILENO )
+		spawn_add_dup2(&sp, fso, STDOUT_FILENO);
+	if ( fsi != STDIN_FILENO )
+		spawn_add_dup2(&sp, fsi, STDIN_FILENO);
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Fork And Verify Process
+	// Then the command's own redirections, left to right
 	////////////////////////////////////////////////////////////////////////////////
-	p = fork();
-	if ( p < 0 ) {
-		fprintf(stderr, "Error forking redir command. ERRNO\"%d\"\n", errno);
-		exit(EXIT_FAILURE);
+	if ( (cmd->ops & OP_REDIRECT) && !redir_prepare(cmd, &sp, opened, &num_opened) ) {
+		redir_release(opened, num_opened);
+		return -1;
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Parent
+	// Execute Command - builtins run in the shell when allowed and the
+	// redirections only touch its standard descriptors, else in a forked helper
 	////////////////////////////////////////////////////////////////////////////////
-	if ( p != 0 ) {
-		if (waitpid(p, &wait_status, 0) == -1) {
-			fprintf(stderr, "Error with redir command's child	%d. ERRNO\"%d\"\n", p, errno);
-			return EXIT_FAILURE;
-		}
-		if ( WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == EXIT_FAILURE )
-			return EXIT_FAILURE;
-
-		signal(SIGINT, unmask_signal);
-		return EXIT_SUCCESS;
+	builtin_fn fn = find_builtin(cmd->tok[0]);
+	if ( fn && status && redir_in_shell(&sp, fds) ) {
+		*status = run_builtin(fn, cmd, fds[0], fds[1], fds[2]);
+		p = 0;
 	}
+	else if ( fn )
+		p = spawn_builtin(&sp, fn, cmd);
+	else if ( (p = spawn_command(&sp, cmd->tok, envp)) < 0 && status )
+		*status = launch_status(errno);
+	redir_release(opened, num_opened);
+	return p;
+}
 
+/**
+	* Executes any command with I/O redirections present. They are applied
+	* left to right, so "cmd > out 2>&1" sends both streams to out.
+	*
+	* @param cmd command struct
+	* @param envp environment variables
+	* @return RETURN_CODE
+	*/
+int exec_redir_command(command_t* cmd, char* envp[])
+{
 	////////////////////////////////////////////////////////////////////////////////
-	// Child
+	// Mask Inturrept Signals and Initialize Variables
 	////////////////////////////////////////////////////////////////////////////////
-	else {
-		////////////////////////////////////////////////////////////////////////////////
-		// Initialize and Verify File Descriptor
-		////////////////////////////////////////////////////////////////////////////////
-		if ( io )
-			file_desc = open(cmd->tok[cmd->toklen - 1], O_RDONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-		else
-			file_desc = open(cmd->tok[cmd->toklen - 1], O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
-		if ( file_desc < 0 ) {
-			fprintf(stderr, "\nError opening %s. ERRNO\"%d\"\n", cmd->tok[cmd->toklen - 1], errno);
-			exit(EXIT_FAILURE);
-		}
-
-		////////////////////////////////////////////////////////////////////////////////
-		// Redirect I/O Streams
-		////////////////////////////////////////////////////////////////////////////////
-		if ( io ) {
-			if (dup2(file_desc, STDIN_FILENO) < 0) {
-				fprintf(stderr, "\nError redirecting STDIN to %s. ERRNO\"%d\"\n", cmd->tok[cmd->toklen - 1], errno);
-				exit(EXIT_FAILURE);
-			}
-		}
-		else {
-			if (dup2(file_desc, STDOUT_FILENO) < 0) {
-				fprintf(stderr, "\nError redirecting STDOUT to %s. ERRNO\"%d\"\n", cmd->tok[cmd->toklen - 1], errno);
-				exit(EXIT_FAILURE);
-			}
-		}
+	pid_t p;
+	int wait_status, status = EXIT_FAILURE;
+	struct timespec start;
+	signal(SIGINT, mask_signal);	
 
-		////////////////////////////////////////////////////////////////////////////////
-		// Execute Command - remove last two redirection arguments
-		////////////////////////////////////////////////////////////////////////////////
-		close(file_desc);
-		cmd->tok[cmd->toklen - 1] = NULL;
-		cmd->tok[cmd->toklen - 2] = NULL;
-		cmd->toklen = cmd->toklen - 2;
+	////////////////////////////////////////////////////////////////////////////////
+	// Spawn And Verify Process - builtins write straight to their files from
+	// inside the shell
+	////////////////////////////////////////////////////////////////////////////////
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( (p = iterative_fork_helper(cmd, STDIN_FILENO, STDOUT_FILENO, &status, envp)) <= 0 ) {
+		signal(SIGINT, unmask_signal);
+		return status;			// 1 if a redirection failed
+	}
 
-		if ( execvpe(cmd->tok[0], cmd->tok, envp) < 0	&& errno == 2 ) {
-			fprintf(stderr, "Command: \"%s\" not found.\n", cmd->tok[0]);
-			exit(EXIT_FAILURE);
-		}
-		else {
-			fprintf(stderr, "Error executing %s. ERRNO\"%d\"\n", cmd->tok[0], errno);
-			exit(EXIT_FAILURE);
-		}
+	////////////////////////////////////////////////////////////////////////////////
+	// Wait for the child
+	////////////////////////////////////////////////////////////////////////////////
+	if ( wait_child(p, &wait_status, cmd->tok[0], &start) < 0 ) {
 		signal(SIGINT, unmask_signal);
-		exit(EXIT_SUCCESS);
+		fprintf(stderr, "Error with redir command's child	%d. ERRNO\"%d\"\n", p, errno);
+		return EXIT_FAILURE;
 	}
+
+	signal(SIGINT, unmask_signal);
+	return exit_status(wait_status);
 }
 
 /**
@@ -669,105 +2998,77 @@ int exec_redir_command(command_t* cmd, bool io, char* envp[])
 int exec_backg_command(command_t* cmd, char* envp[])
 {
 	pid_t p;
-	int wait_status;
-	int file_desc;
+	spawn_t sp;
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Handle and Initialize Signal Masking
+	// Map Child Process stdout and stderr into a pipe drained by the event loop
 	////////////////////////////////////////////////////////////////////////////////
-	struct sigaction action;
-	action.sa_sigaction = *job_handler;
-	action.sa_flags = SA_SIGINFO | SA_RESTART;
-	if ( sigaction(SIGCHLD, &action, NULL) < 0 )
-		fprintf(stderr, "Error background signal handler: ERRNO\"%d\"\n", errno);
-	sigprocmask(SIG_BLOCK, &sigmask_1, &sigmask_2);
+	int file_desc[2];
+
+	if ( pipe2(file_desc, O_CLOEXEC) < 0 ) {
+		fprintf(stderr, "\nError in pipe creation. ERRNO:%d\n", errno);
+		return EXIT_FAILURE;
+	}
+	fdreg_track(file_desc[0], FD_COMMAND, command_num, "job output pipe");
+	fdreg_track(file_desc[1], FD_COMMAND, command_num, "job output pipe");
+	fcntl(file_desc[0], F_SETFL, O_NONBLOCK);
+	fcntl(file_desc[0], F_SETPIPE_SZ, (int) output_ring_size);	// best effort
+
+	spawn_reset(&sp);
+	spawn_set_background(&sp);
+	spawn_add_dup2(&sp, file_desc[1], STDOUT_FILENO);
+	spawn_add_dup2(&sp, file_desc[1], STDERR_FILENO);
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Fork And Verify Process
+	// The job's own redirections win over the ring ("cmd >> log &")
 	////////////////////////////////////////////////////////////////////////////////
-	p = fork();
-	if ( p < 0 ) {
-		fprintf(stderr, "\nError forking background command. ERRNO\"%d\"\n", errno);
-		exit(EXIT_FAILURE);
+	int opened[MAX_REDIRS];
+	size_t num_opened = 0;
+	if ( (cmd->ops & OP_REDIRECT) && !redir_prepare(cmd, &sp, opened, &num_opened) ) {
+		redir_release(opened, num_opened);
+		fdreg_close(file_desc[0]);
+		fdreg_close(file_desc[1]);
+		return EXIT_FAILURE;
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Parent
+	// Spawn And Verify Process - builtins run in a forked helper
 	////////////////////////////////////////////////////////////////////////////////
-	if ( p != 0 ) {
-		////////////////////////////////////////////////////////////////////////////////
-		// Populate new job struct
-		////////////////////////////////////////////////////////////////////////////////
-		struct job create_job;
-		create_job.cmdstr = (char*) malloc(MAX_COMMAND_TITLE);
-		strcpy(create_job.cmdstr, cmd->tok[0]);
-		create_job.status = false; 
-		create_job.pid = p; 
-		create_job.jid = num_jobs;
-		
-		////////////////////////////////////////////////////////////////////////////////
-		// Augment Global all_jobs struct
-		////////////////////////////////////////////////////////////////////////////////
-		printf("[%d] %d running in background\n", num_jobs, p); 
-		all_jobs[num_jobs] = create_job;
-		num_jobs++;
-
-		////////////////////////////////////////////////////////////////////////////////
-		// Unmask Signals, and Wait for completion
-		////////////////////////////////////////////////////////////////////////////////
-		sigprocmask(SIG_UNBLOCK, &sigmask_1, &sigmask_2);
-		while (waitpid(p, &wait_status, WNOHANG) > 0) {} 
-		return EXIT_SUCCESS;
-
+	builtin_fn fn = find_builtin(cmd->tok[0]);
+	p = fn ? spawn_builtin(&sp, fn, cmd) : spawn_command(&sp, cmd->tok, envp);
+	redir_release(opened, num_opened);
+	fdreg_close(file_desc[1]);
+	if ( p < 0 ) {
+		fdreg_close(file_desc[0]);
+		return EXIT_FAILURE;
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Child
+	// Add the job to the job table
 	////////////////////////////////////////////////////////////////////////////////
+	job* create_job = job_add(p, cmd->tok[0]);
+	if ( create_job ) {
+		printf("[%d] %d running in background\n", create_job->jid, p); 
+		watch_job(create_job, file_desc[0]);
+	}
 	else {
-		////////////////////////////////////////////////////////////////////////////////
-		// Map Child Process to different output
-		////////////////////////////////////////////////////////////////////////////////
-		char temp_file[MAX_COMMAND_LENGTH];
-		char cpid [MAX_COMMAND_ARGLEN];
-		int ipid = getpid();
-
-		snprintf(cpid, MAX_COMMAND_ARGLEN,"%d",ipid);
-		strcpy(temp_file, cpid);
-		strcat(temp_file, "-temp_output.out");
-
-		file_desc = open(temp_file, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-		
-		if ( file_desc < 0 ) {
-			fprintf(stderr, "\nError opening %s. ERRNO\"%d\"\n", temp_file, errno);
-			exit(EXIT_FAILURE);
-		}
-
-		if ( dup2(file_desc, STDOUT_FILENO) < 0 ) {
-			fprintf(stderr, "\nError redirecting STDOUT to %s. ERRNO\"%d\"\n", temp_file, errno);
-			exit(EXIT_FAILURE);
-		}
+		fprintf(stderr, "Error tracking background job %d. ERRNO\"%d\"\n", p, errno);
+		fdreg_close(file_desc[0]);
+	}
 
-		if ( execvpe(cmd->tok[0], cmd->tok, envp) < 0	&& errno == 2 ) {
-			fprintf(stderr, "Command: \"%s\" not found.\n", cmd->tok[0]);
-			exit(EXIT_FAILURE);
-		}
-		else {
-			fprintf(stderr, "Error executing %s. ERRNO\"%d\"\n", cmd->tok[0], errno);
-			exit(EXIT_FAILURE);
-		}
-		signal(SIGINT, unmask_signal);
-		exit(EXIT_SUCCESS);
-	} 
-	
+	////////////////////////////////////////////////////////////////////////////////
+	// The job is reaped by reap_jobs() once its pidfd turns readable
+	////////////////////////////////////////////////////////////////////////////////
+	return EXIT_SUCCESS;
 }
 
 /**
-	* Executes any command with an | present
+	* Executes any command with an | present. Every stage runs in its own
+	* child and the whole pipeline is waited for.
 	*
 	* @param cmd command struct
 	* @param envp environment variables
-	* @return RETURN_CODE
+	* @return EXIT_SUCCESS, or the exit status of the rightmost failed stage
 	*/
 int exec_pipe_command(command_t* cmd, char* envp[]) {
 	////////////////////////////////////////////////////////////////////////////////
@@ -776,68 +3077,106 @@ int exec_pipe_command(command_t* cmd, char* envp[]) {
 	signal(SIGINT, mask_signal);
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Tokenize Piped Command into pieces
+	// Tokenize Piped Command into pieces - stages share the command's tokens
 	////////////////////////////////////////////////////////////////////////////////
-	int i = 0, j = 0, k = 0, num_cmds;
-	command_t* cmds = malloc(MAX_COMMAND_ARGLEN * sizeof *cmds);
-	cmds[0].tok = malloc( sizeof(char*) * MAX_COMMAND_ARGLEN );
-
+	int i = 0, j = 0, num_cmds = 1;
 	for ( ; i < cmd->toklen; i++ ) {
-		if ( !strcmp(cmd->tok[i], "|") ) {
-			//matches pipe
-			cmds[j].tok[k] = NULL;
-			cmds[j].toklen = k;
+		if ( token_op(cmd->tok[i]) == OP_PIPE )
+			num_cmds++;
+	}
+
+	command_t* cmds = arena_alloc(&cmd_arena, num_cmds * sizeof *cmds);
+	pid_t* pids = arena_alloc(&cmd_arena, num_cmds * sizeof *pids);
+	if ( !cmds || !pids ) {
+		fprintf(stderr, "quash: out of memory running pipeline `%s'\n", cmd->tok[0]);
+		signal(SIGINT, unmask_signal);
+		return EXIT_FAILURE;
+	}
+	for ( i = 0; i < num_cmds; i++ ) {
+		cmds[i] = *cmd;		// every stage can see the line's here-document
+		cmds[i].toklen = 0;
+		cmds[i].ops = OP_NONE;
+	}
+	cmds[0].tok = cmd->tok;
+
+	for ( i = 0; i < cmd->toklen; i++ ) {
+		cmd_op op = token_op(cmd->tok[i]);
+
+		if ( op == OP_PIPE ) {
+			//matches pipe - terminate this stage and start the next one after it
+			cmd->tok[i] = NULL;
 			j++;
-			cmds[j].tok = malloc( sizeof(char*) * MAX_COMMAND_ARGLEN );
-			k = 0;
+			cmds[j].tok = &cmd->tok[i + 1];
 		}
 		else {
-			cmds[j].tok[k] = malloc( sizeof(char) * MAX_COMMAND_TITLE );
-			strcpy(cmds[j].tok[k], cmd->tok[i]);
-			//debug printf("cmds[%d]->tok[%d] = %s\n", j, k, cmds[j].tok[k]);
-			k++;
+			if ( cmds[j].toklen )
+				cmds[j].ops |= op;	// the stage's own redirections
+			cmds[j].toklen++;
 		}
 	}
-	cmds[j].tok[k] = NULL;
-	cmds[j].toklen = k;
-	num_cmds = j;
-
-//debug
-/*	for (i = 0; i <= num_cmds; i ++) {
-		for (j = 0; j <= cmds[i].toklen; j++) {
-			printf("cmds[%d].tok[%d] = %s\n", i, j, cmds[i].tok[j]);
-		}
-	}*/
-
-	i = 0;
-	j = 0;
-	int file_desc[2];
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Create and link pipes 
+	// Spawn every stage. Pipes are close-on-exec, so each stage only keeps the
+	// two ends dup'd onto its stdin/stdout and the shell closes its copies as
+	// soon as the stage that needs them is running.
 	////////////////////////////////////////////////////////////////////////////////
-	for ( i = 0; i < num_cmds - 1; ++i ) {
-		if ( pipe(file_desc) < 0 ) {
-			fprintf(stderr, "\nError in pipe creation. ERRNO:%d\n", errno);
-			return EXIT_FAILURE;
+	int file_desc[2];
+	int in = STDIN_FILENO, out;
+	int builtin_status = EXIT_SUCCESS;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for ( i = 0; i < num_cmds; i++ ) {
+		out = STDOUT_FILENO;
+		if ( i < num_cmds - 1 ) {
+			if ( pipe2(file_desc, O_CLOEXEC) < 0 ) {
+				fprintf(stderr, "\nError in pipe creation. ERRNO:%d\n", errno);
+				break;
+			}
+			fdreg_track(file_desc[0], FD_COMMAND, command_num, "pipeline pipe");
+			fdreg_track(file_desc[1], FD_COMMAND, command_num, "pipeline pipe");
+			out = file_desc[1];
 		}
-		iterative_fork_helper(&cmds[i], j, file_desc[1], envp);
-		close(file_desc [1]);
-		j = file_desc[0];
-	}
 
-	if ( j != 0 )
-		dup2(j, STDIN_FILENO);
+		////////////////////////////////////////////////////////////////////////////////
+		// A builtin as the last stage runs in the shell on the pipe's read end
+		////////////////////////////////////////////////////////////////////////////////
+		pids[i] = iterative_fork_helper(&cmds[i], in, out,
+			i == num_cmds - 1 ? &builtin_status : NULL, envp);
+
+		if ( in != STDIN_FILENO )
+			fdreg_close(in);
+		if ( out != STDOUT_FILENO ) {
+			fdreg_close(out);
+			in = file_desc[0];
+		}
+	}
+	if ( in != STDIN_FILENO )
+		fdreg_close(in);
+	num_cmds = i;
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Execute final command
+	// Wait for the whole pipeline. Like pipefail, the pipeline fails with the
+	// status of the rightmost stage that failed (127 if it never started).
 	////////////////////////////////////////////////////////////////////////////////
-	if ( execvpe(cmds[i].tok[0], cmds[i].tok, envp) < 0 ) {
-		fprintf(stderr, "Error executing %s. ERRNO\"%d\"\n", cmd->tok[0], errno);
-		exit(EXIT_FAILURE);
+	int RETURN_CODE = EXIT_SUCCESS;
+	int wait_status;
+
+	for ( i = 0; i < num_cmds; i++ ) {
+		int status = pids[i] < 0 ? 127 : pids[i] ? 0 : builtin_status;
+
+		if ( pids[i] > 0 ) {
+			if ( wait_child(pids[i], &wait_status, cmds[i].tok[0], &start) < 0 )
+				wait_status = 127 << 8;
+			status = exit_status(wait_status);
+		}
+		if ( status )
+			RETURN_CODE = status;
 	}
+
 	signal(SIGINT, unmask_signal);
-	return EXIT_SUCCESS;
+	return RETURN_CODE;
 }
 
 /**************************************************************************
@@ -860,18 +3199,104 @@ int main(int argc, char** argv, char** envp) {
 	sigemptyset(&sigmask_1);
 	sigaddset(&sigmask_1, SIGCHLD);
 
+	////////////////////////////////////////////////////////////////////////////////
+	// SIGCHLD is only ever consumed through a descriptor, never a handler
+	////////////////////////////////////////////////////////////////////////////////
+	sigprocmask(SIG_BLOCK, &sigmask_1, &sigmask_2);
+	sigchld_fd = fdreg_track(signalfd(-1, &sigmask_1, SFD_CLOEXEC | SFD_NONBLOCK), FD_SHELL, 0, "SIGCHLD signalfd");
+	if ( sigchld_fd < 0 )
+		fprintf(stderr, "Error creating SIGCHLD descriptor. ERRNO\"%d\"\n", errno);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Background job output capture
+	////////////////////////////////////////////////////////////////////////////////
+	char* env;
+	if ( (env = getenv("QUASH_OUTPUT_RING")) && strtoul(env, NULL, 10) > 0 )
+		output_ring_size = strtoul(env, NULL, 10);
+	if ( (env = getenv("QUASH_OUTPUT_SPILL")) && *env )
+		output_spill_dir = env;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Background jobs are watched through pidfds when the kernel has them,
+	// otherwise through the SIGCHLD descriptor
+	////////////////////////////////////////////////////////////////////////////////
+	struct epoll_event ev;
+	int probe = pidfd_open(getpid(), 0);
+
+	job_event_fd = fdreg_track(epoll_create1(EPOLL_CLOEXEC), FD_SHELL, 0, "job epoll set");
+	if ( probe >= 0 ) {
+		use_pidfd = true;
+		close(probe);
+	}
+	else
+		watch_sigchld();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Select the process launch backend and set up tracing
+	////////////////////////////////////////////////////////////////////////////////
+	spawn_init();
+	trace_init();
+	text_init();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Shell variables start out as the exported environment
+	////////////////////////////////////////////////////////////////////////////////
+	vars_init(envp);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Options
+	////////////////////////////////////////////////////////////////////////////////
+	static struct option long_opts[] = {
+		{ "unordered", no_argument, NULL, 'u' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	char* end;
+	bool script_only = false;
+	while ( (opt = getopt_long(argc, argv, "+tj:", long_opts, NULL)) != -1 ) {
+		if ( opt == 't' )
+			report_timing = true;
+		else if ( opt == 'u' )
+			parallel_unordered = script_only = true;
+		else if ( opt == 'j' && (parallel_jobs = strtol(optarg, &end, 10)) > 0 && !*end )
+			script_only = true;
+		else {
+			fprintf(stderr, "Usage: %s [-t] [-j N [--unordered]] [script]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
 	// Input stems from FILE - Redirects command interpretation structure
 	////////////////////////////////////////////////////////////////////////////////
-	if ( !isatty( (fileno(stdin) ) ) ) {
-		exec_from_file(argv, argc, envp);
-		return EXIT_SUCCESS;
+	if ( optind < argc || !isatty(STDIN_FILENO) )
+		return exec_from_file(argv, argc, envp);
+
+	// -j and --unordered only mean something for a script
+	if ( script_only ) {
+		fprintf(stderr, "quash: -j and --unordered only apply to scripts\n");
+		fprintf(stderr, "Usage: %s [-t] [-j N [--unordered]] [script]\n", argv[0]);
+		return EXIT_FAILURE;
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Args
 	////////////////////////////////////////////////////////////////////////////////
 	command_t cmd;										//< Command holder argument
+	line_reader in;										//< Growable stdin line reader
+	const char* bad;									//< Misplaced token, if any
+	struct epoll_event evs[MAX_EVENTS];					//< Event loop wakeups
+	int i, n;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Event loop - stdin and the background job set
+	////////////////////////////////////////////////////////////////////////////////
+	event_fd = fdreg_track(epoll_create1(EPOLL_CLOEXEC), FD_SHELL, 0, "event loop epoll set");
+	ev.events = EPOLLIN;
+	ev.data.u64 = EVENT_STDIN;
+	epoll_ctl(event_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+	ev.data.u64 = EVENT_JOBS;
+	epoll_ctl(event_fd, EPOLL_CTL_ADD, job_event_fd, &ev);
 
 	start();
 	puts("Welcome to Quash!\nType \"exit\" or \"quit\" to leave this shell");
@@ -880,9 +3305,40 @@ int main(int argc, char** argv, char** envp) {
 	////////////////////////////////////////////////////////////////////////////////
 	// Main Execution Loop
 	////////////////////////////////////////////////////////////////////////////////
-	while ( is_running() && get_command(&cmd, stdin) ) {
-		run_quash(&cmd, envp);
+	reader_init(&in, STDIN_FILENO);
+	while ( is_running() ) {
+		////////////////////////////////////////////////////////////////////////////////
+		// Sleep until a line arrives, reporting finished jobs in the meantime
+		////////////////////////////////////////////////////////////////////////////////
+		bool input = reader_pending(&in);
+		while ( !input ) {
+			if ( (n = epoll_wait(event_fd, evs, MAX_EVENTS, -1)) < 0 ) {
+				if ( errno == EINTR )
+					continue;
+				input = true;		// fall back to a blocking read
+			}
+			for ( i = 0; i < n; i++ ) {
+				if ( evs[i].data.u64 == EVENT_STDIN )
+					input = true;
+				else if ( evs[i].data.u64 == EVENT_JOBS && reap_jobs() && !input )
+					print_init();
+			}
+		}
+
+		TRACE_BEGIN(t_read);
+		if ( !get_command(&cmd, &in) )
+			break;
+		TRACE_END(TRACE_READ, t_read, NULL);
+		if ( (bad = syntax_error(&cmd)) ) {
+			fprintf(stderr, "quash: syntax error near unexpected token `%s'\n", bad);
+			print_init();
+		}
+		else
+			run_quash(&cmd, vars_envp());
+		arena_reset(&cmd_arena);
 	}
 
-	return EXIT_SUCCESS;
+	if ( report_timing )
+		usage_summary(stderr);
+	return last_status;
 }
@@ -17,55 +17,223 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include "arena.h"
+#include "fastcopy.h"
+#include "fdreg.h"
+#include "job_table.h"
+#include "loadable.h"
+#include "path_hash.h"
+#include "reader.h"
+#include "spawn.h"
+#include "textutil.h"
+#include "trace.h"
+#include "usage.h"
+#include "vars.h"
+
+/**
+	* Specify the maximum number of events handled per event loop wakeup
+	*/
+#define MAX_EVENTS (64)
+
 /**
-	* Specify the maximum number of characters accepted by the command string
+	* Specify how many finished jobs keep their output for the output
+	* builtin. Past this the oldest is dropped.
 	*/
-#define MAX_COMMAND_TITLE (128)
+#define MAX_RETAINED_JOBS (32)
+
 /**
-	* Specify the maximum number of arguments in a command
+	* Specify the smallest read of command substitution output, and the pipe
+	* size asked for, in bytes
 	*/
-#define MAX_COMMAND_ARGLEN (32)
+#define SUBST_READ_SIZE (1 << 20)
+
 /**
-	* Specify the maximum number of characters accepted by the command string
+	* Specify the first size of an arena-backed out_buf in bytes
 	*/
-#define MAX_COMMAND_LENGTH (1024)
+#define OUT_ARENA_INIT_SIZE (256)
+
 /**
-	* Specify the maximum number of background jobs
+	* Specify the continuation prompt shown while a here-document is typed
 	*/
-#define MAX_NUM_JOBS (100)
+#define HEREDOC_PROMPT "> "
+
+/**
+	* Event loop sources, stored in epoll_event.data.u64
+	*/
+typedef enum event_source {
+	EVENT_STDIN,							///< a command line is ready
+	EVENT_JOBS,								///< the background job set has events
+	EVENT_SIGCHLD,							///< children have exited (no pidfd support)
+	EVENT_JOB,								///< a job's pidfd is ready (job ID in the high 32 bits)
+	EVENT_OUTPUT							///< a job wrote output (job ID in the high 32 bits)
+} event_source;
+
+/**
+	* Operators a command line can contain, recorded as bits of
+	* command_t.ops while the line is tokenized
+	*/
+typedef enum cmd_op {
+	OP_NONE = 0,							///< an ordinary word
+	OP_BACKGROUND = 1 << 0,					///< &
+	OP_REDIR_IN = 1 << 1,					///< <
+	OP_REDIR_OUT = 1 << 2,					///< >
+	OP_PIPE = 1 << 3,						///< |
+	OP_HEREDOC = 1 << 4,					///< <<WORD or <<-WORD
+	OP_HERESTRING = 1 << 5					///< <<<word
+} cmd_op;
+
+/**
+	* Specify the cmd_op bits of every redirection operator
+	*/
+#define OP_REDIRECT (OP_REDIR_IN | OP_REDIR_OUT | OP_HEREDOC | OP_HERESTRING)
+
+/**
+	* Specify the most redirections a single command may carry
+	*/
+#define MAX_REDIRS (MAX_SPAWN_ACTIONS)
+
+/**
+	* What a redirection does to its descriptor
+	*/
+typedef enum redir_kind {
+	REDIR_READ,								///< N<file
+	REDIR_WRITE,							///< N>file
+	REDIR_APPEND,							///< N>>file
+	REDIR_DUP,								///< N>&M or N<&M
+	REDIR_CLOSE,							///< N>&- or N<&-
+	REDIR_HEREDOC,							///< N<<WORD or N<<-WORD
+	REDIR_HERESTRING						///< N<<<word
+} redir_kind;
+
+/**
+	* One redirection of a command, taken out of its argument vector
+	*/
+typedef struct redirect_t {
+	redir_kind kind;						///< what to do
+	int fd;									///< descriptor redirected, -1 for both
+											///< stdout and stderr (&>file)
+	int src;								///< descriptor copied by REDIR_DUP
+	const char* word;						///< file name or here-string word
+} redirect_t;
 
 /**
 	* Holds information about a command.
 	*/
 typedef struct command_t {
-	char** tok;							///< tokenized command array
-	char cmdstr[MAX_COMMAND_LENGTH];	///< character buffer to store the
-										///< command string. You may want
-										///< to modify this to accept
-										///< arbitrarily long strings for
-										///< robustness.
+	char** tok;							///< tokenized command array (NULL terminated)
+	char* cmdstr;						///< command string, any length, owned by
+										///< the arena the command was parsed into
 	size_t cmdlen;						///< length of the cmdstr character buffer
 	size_t toklen;						///< tokenized command array length
+	unsigned ops;						///< cmd_op bits of the operators following
+										///< the command name
+	bool expand;						///< some token holds a $ to expand
+	char* here;							///< here-document body, NULL if none
+	size_t here_len;					///< length of the here-document body
+	bool here_expand;					///< expand $ in the body (delimiter unquoted)
 } command_t;
 
 /**
-	* Holds information about a running process (job).
+	* Holds a script loaded into memory and parsed into commands up front
+	*/
+typedef struct script_t {
+	char* data;							///< script text (mapped or read)
+	size_t size;						///< bytes of script text
+	bool mapped;						///< data is an mmap of the script file
+	command_t* cmds;					///< parsed, non-empty commands in order
+	size_t num_cmds;					///< number of parsed commands
+	size_t num_lines;					///< number of lines in the script
+	arena mem;							///< owns cmds and every token vector
+} script_t;
+
+/**
+	* Source of the lines following a command, read for its here-document
+	*
+	* @param src reader or script cursor
+	* @param line set to the NUL terminated line, without its newline
+	* @return length of the line, or -1 at end of input
 	*/
-typedef struct job {
-	char* cmdstr;							///< The command issued for this process
-	bool status;							///< Status for this process (running or not)
-	int pid;								///< Process ID #
-	int jid;								///< Job ID #
-} job;
+typedef ssize_t (*here_getline)(void* src, char** line);
+
+/**
+	* Position in a script's text while its lines are parsed
+	*/
+typedef struct script_cursor {
+	char* p;							///< start of the next line
+	char* end;							///< end of the script text
+	size_t* num_lines;					///< line counter to advance
+} script_cursor;
+
+/**
+	* Growable buffer collecting a parallel command's output, or a word and
+	* token list being expanded
+	*/
+typedef struct out_buf {
+	char* data;							///< collected bytes
+	size_t len;							///< bytes collected
+	size_t cap;							///< allocated size of data
+	arena* mem;							///< arena data comes from, NULL for the heap
+} out_buf;
+
+/**
+	* A parallel worker currently in flight
+	*/
+typedef struct worker_slot {
+	pid_t pid;							///< worker process, -1 if the slot is free
+	int fd;								///< read end of the worker's output pipe
+	size_t index;						///< script position of the worker's command
+	struct timespec started;			///< when the worker was forked
+} worker_slot;
+
+/**
+	* Standard streams handed to a builtin. Redirected builtins get the file
+	* or pipe here instead of having the shell's own descriptors swapped.
+	*/
+typedef struct io_ctx {
+	int in;								///< descriptor to read input from
+	FILE* out;							///< stream for regular output
+	FILE* err;							///< stream for diagnostics
+} io_ctx;
+
+/**
+	* Signature shared by the builtin commands
+	*/
+typedef int (*builtin_fn)(command_t* cmd, io_ctx* io);
+
+/**
+	* A slot of the builtin registry (see builtins.def)
+	*/
+typedef struct builtin_entry {
+	const char* name;					///< command name, NULL for an empty slot
+	builtin_fn fn;						///< implementation
+} builtin_entry;
+
+/**
+	* A builtin bound to its arguments, handed to a forked helper
+	*/
+typedef struct builtin_call {
+	builtin_fn fn;						///< builtin to run
+	command_t* cmd;						///< its command
+} builtin_call;
 
 /**
 	* Signal Masking Variable
@@ -127,32 +295,60 @@ void print_cmd_tokens(command_t* cmd);
 void print_init();
 
 /**
-	* Handles exiting signal from background processes
+	* Start watching a background job: its pidfd for completion and its
+	* output pipe for captured stdout/stderr
 	*
-	* @param signal int
-	* @param sig struct
-	* @param slot
+	* @param j new job
+	* @param out_fd non-blocking read end of the job's output pipe
 	*/
-void job_handler(int signal, siginfo_t* sig, void* slot);
+void watch_job(job* j, int out_fd);
+
+/**
+	* Services the background job set: captured output is moved into the
+	* jobs' rings, and finished jobs are reaped and reported as one batch.
+	* Never runs in signal context.
+	*
+	* @return number of background jobs that finished
+	*/
+int reap_jobs();
+
+/**
+	* Wait for a foreground child and account the resources it used to the
+	* session and to the foreground total read by the time keyword
+	*
+	* @param p child pid
+	* @param wait_status receives the child's wait status
+	* @param name command name
+	* @param start CLOCK_MONOTONIC time the child was started
+	* @return p, or -1 on failure
+	*/
+pid_t wait_child(pid_t p, int* wait_status, const char* name, const struct timespec* start);
 
 /* 
 	* Kill Command from jobs listing
 	*
 	* @param cmd command struct
+	* @param io standard streams
 	* @return: RETURN_CODE
 */
-int kill_proc(command_t* cmd);
+int kill_proc(command_t* cmd, io_ctx* io);
 
 /**
-	* Creates forks and redirects file streams for use in iterative fashion
+	* Spawns a pipeline stage (a forked helper for builtins) and redirects
+	* its file streams for use in iterative fashion. The stage's own
+	* redirections are applied after the pipe ends, in order.
 	*
 	* @param cmd command struct
 	* @param fsi file descriptor in
 	* @param fso file descriptor out
+	* @param status if not NULL, a builtin may run in the shell itself; its
+	* exit status is stored here and 0 is returned. A failed launch stores
+	* 127 or 126 here.
 	* @param envp environment variables
-	* @return RETURN_CODE
+	* @return pid of the spawned stage, 0 if it ran in the shell, or -1 on
+	* failure
 	*/
-int iterative_fork_helper (command_t* cmd, int fsi, int fso, char* envp[]);
+int iterative_fork_helper (command_t* cmd, int fsi, int fso, int* status, char* envp[]);
 
 /**************************************************************************
  * String Manipulation Functions 
@@ -161,13 +357,67 @@ int iterative_fork_helper (command_t* cmd, int fsi, int fso, char* envp[]);
 /**
 	*  Read in a command and setup the #command_t struct. Also perform some minor
 	*  modifications to the string to remove trailing newline characters.
+	*  Lines and argument lists may be of any length.
 	*
 	*  @param cmd - a command_t structure. The #command_t.cmdstr and
 	*               #command_t.cmdlen fields will be modified
-	*  @param in - an open file ready for reading
+	*  @param in - a line reader over an open descriptor
 	*  @return True if able to fill #command_t.cmdstr and false otherwise
 	*/
-bool get_command(command_t* cmd, FILE* in);
+bool get_command(command_t* cmd, line_reader* in);
+
+/**
+	*  Tokenize a command line in place, allocating the token vector from the
+	*  given arena.
+	*
+	*  @param cmd - a command_t structure to fill in
+	*  @param line - writable, NUL terminated command line
+	*  @param len - length of line
+	*  @param mem - arena that receives the token vector
+	*  @return True on success and false if out of memory
+	*/
+bool parse_command(command_t* cmd, char* line, size_t len, arena* mem);
+
+/**
+	*  Classify a token as one of the shell's operators
+	*
+	*  @param tok - a token
+	*  @return the token's cmd_op, or OP_NONE for an ordinary word
+	*/
+cmd_op token_op(const char* tok);
+
+/**
+	*  Read the body of a command's here-document from the lines following
+	*  it, up to the delimiter line. Nothing is read unless the command has
+	*  a << operator.
+	*
+	*  @param cmd - a parsed command_t structure; #command_t.here is set
+	*  @param next - reads the next line from src
+	*  @param src - reader or script cursor the command came from
+	*  @param mem - arena that receives the body
+	*  @return True on success and false if out of memory
+	*/
+bool read_heredoc(command_t* cmd, here_getline next, void* src, arena* mem);
+
+/**
+	*  Check a parsed command for misplaced |, <, > and & tokens
+	*
+	*  @param cmd - a parsed command_t structure
+	*  @return the offending token, or NULL if the command is well formed
+	*/
+const char* syntax_error(command_t* cmd);
+
+/**
+	*  Expand $NAME, ${NAME}, $? and $$ in the tokens of a command. Unset
+	*  variables expand to nothing, and a token left empty is dropped.
+	*
+	*  @param cmd - a parsed command_t structure
+	*  @param out - receives the expanded command
+	*  @param mem - arena that receives the expanded tokens and holds the
+	*  work buffers, so expansion never touches the heap
+	*  @return True on success and false if out of memory
+	*/
+bool expand_command(command_t* cmd, command_t* out, arena* mem);
 
 /**************************************************************************
  * Shell Fuctionality 
@@ -177,44 +427,298 @@ bool get_command(command_t* cmd, FILE* in);
 	* CD Implementation
 	*
 	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
 	* Note: chdir will make new dir's if they don't exist
  */
-void cd(command_t* cmd);
+int cd(command_t* cmd, io_ctx* io);
 
 /**
 	* Echo Implementation
 	*
 	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
  */
-void echo(command_t* cmd);
+int echo(command_t* cmd, io_ctx* io);
 
 /**
-	* Displays all currently running jobs
+	* Displays all currently running jobs. With -v finished jobs that still
+	* hold output are listed too, along with the resources they used.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
 	*/
-void jobs(command_t* cmd);
+int jobs(command_t* cmd, io_ctx* io);
 
 /**
 	* Set Implementation
 	*
-	* Assigns the specified environment variable (HOME or PATH),
-	* or displays an error for user mistakes.
+	* Assigns shell variables (set NAME=VALUE...) or lists them all (set)
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int set(command_t* cmd, io_ctx* io);
+
+/**
+	* Export Implementation
+	*
+	* Exports shell variables to launched commands (export NAME[=VALUE]...)
+	* or lists the exported ones (export)
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int export(command_t* cmd, io_ctx* io);
+
+/**
+	* Unset Implementation
+	*
+	* Removes shell variables (unset NAME...)
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int unset(command_t* cmd, io_ctx* io);
+
+/**
+	* Hash Implementation
+	*
+	* Displays the cached command paths and hit/miss counters, or forgets
+	* them all with -r.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int hash(command_t* cmd, io_ctx* io);
+
+/**
+	* Output Implementation
+	*
+	* Shows the stdout/stderr captured from a background job (output %jid),
+	* follows it live (output -f %jid) or lists jobs holding output.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int output(command_t* cmd, io_ctx* io);
+
+/**
+	* Stats Implementation
+	*
+	* Prints p50/p99/max latency of every traced phase, or turns tracing
+	* on/off and resets the histograms (stats on|off|reset). "stats arena"
+	* prints how many chunks the command arena has ever allocated, which
+	* stays flat once the shell reaches its steady state.
 	*
 	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
  */
-void set(command_t* cmd);
+int stats(command_t* cmd, io_ctx* io);
+
+/**
+	* fds Implementation
+	*
+	* Lists the shell's open descriptors with their owners; fails if any is
+	* untracked or inheritable
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int fds_proc(command_t* cmd, io_ctx* io);
+
+/**
+	* wc Implementation
+	*
+	* Counts lines, words and bytes (wc [-lwc] [file...]). Like grep, head,
+	* tail and cut it runs in the shell on the vectorized code in textutil.c,
+	* and options it does not implement run the real program instead.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int wc(command_t* cmd, io_ctx* io);
+
+/**
+	* grep Implementation
+	*
+	* Prints lines holding a fixed string (grep [-Fcnqv] pattern [file...])
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int grep(command_t* cmd, io_ctx* io);
+
+/**
+	* head Implementation
+	*
+	* Prints the first lines or bytes (head [-n N | -c N] [file...])
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int head(command_t* cmd, io_ctx* io);
+
+/**
+	* tail Implementation
+	*
+	* Prints the last lines (tail [-n N | -n +N] [file...])
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int tail(command_t* cmd, io_ctx* io);
+
+/**
+	* cut Implementation
+	*
+	* Prints selected bytes or fields (cut -b|-c|-f LIST [-d C] [-s] [file...])
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int cut(command_t* cmd, io_ctx* io);
+
+/**
+	* cat Implementation
+	*
+	* Concatenates files (cat [-u] [file...]). Like cp and tee it runs in the
+	* shell on fastcopy.c, which leaves the copying to the kernel
+	* (copy_file_range, splice, sendfile, tee) where it can.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int cat(command_t* cmd, io_ctx* io);
+
+/**
+	* cp Implementation
+	*
+	* Copies files (cp source dest, cp source... directory)
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int cp(command_t* cmd, io_ctx* io);
+
+/**
+	* tee Implementation
+	*
+	* Copies input to the output and to files (tee [-a] [file...])
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int tee_proc(command_t* cmd, io_ctx* io);
+
+/**
+	* Enable Implementation
+	*
+	* Loads builtins from a shared object (enable -f lib.so name...), unloads
+	* them (enable -d name...) or lists the loaded ones (enable).
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE
+ */
+int enable(command_t* cmd, io_ctx* io);
+
+/**
+	* Exit Implementation (exit and quit)
+	*
+	* Stops the shell once the current command finishes. "exit N" leaves
+	* with status N, plain exit with the status of the last command.
+	*
+	* @param cmd command struct
+	* @param io standard streams
+	* @return RETURN_CODE, which becomes the shell's exit status
+ */
+int quit(command_t* cmd, io_ctx* io);
+
+/**
+	* Look up a builtin by name in the generated perfect hash table: one hash
+	* and at most one string compare, however many builtins there are.
+	* Builtins loaded with enable -f are looked up next.
+	*
+	* @param name command name
+	* @return the builtin, or NULL if name is not a builtin
+	*/
+builtin_fn find_builtin(const char* name);
+
+/**
+	* Run a builtin in the shell on the given descriptors. The shell's own
+	* standard descriptors are left alone, so redirected builtins never fork.
+	*
+	* @param fn builtin
+	* @param cmd command struct
+	* @param in descriptor to read (STDIN_FILENO for the shell's stdin)
+	* @param out descriptor to write (STDOUT_FILENO for the shell's stdout)
+	* @param err descriptor for diagnostics (STDERR_FILENO for the shell's stderr)
+	* @return exit status of the builtin
+	*/
+int run_builtin(builtin_fn fn, command_t* cmd, int in, int out, int err);
+
+/**
+	* Run a builtin in a forked helper with the queued file actions applied
+	*
+	* @param sp launch description
+	* @param fn builtin
+	* @param cmd command struct
+	* @return pid of the helper, or -1 on failure
+	*/
+pid_t spawn_builtin(spawn_t* sp, builtin_fn fn, command_t* cmd);
 
 /**************************************************************************
  * File Execution Functions 
  **************************************************************************/
 
+/**
+	* Load and parse a whole script up front. Every syntax error is reported
+	* before anything runs.
+	*
+	* @param script script struct to fill in
+	* @param fd open script descriptor
+	* @param name script name used in error messages
+	* @return true if the script loaded and is free of syntax errors
+	*/
+bool load_script(script_t* script, int fd, const char* name);
+
+/**
+	* Release everything owned by a loaded script
+	*
+	* @param script script struct
+	*/
+void free_script(script_t* script);
+
 /**
 	* Executes any Quash commands from the given file 
 	*
+	* The script (argv[optind], or stdin) is mapped or read completely and
+	* parsed before the first command runs.
+	*
 	* @param argc argument count from the command line
 	* @param argv argument vector from the command line
 	* @param envp environment variables
+	* @return exit status of the last command run, or the one given to exit
 	*/
-void exec_from_file(char** argv, int argc, char* envp[]);
+int exec_from_file(char** argv, int argc, char* envp[]);
 
 /**************************************************************************
  * Execution Functions 
@@ -228,6 +732,18 @@ void exec_from_file(char** argv, int argc, char* envp[]);
 	*/
 void run_quash(command_t* cmd, char** envp);
 
+/**
+	* Time Implementation
+	*
+	* Runs the command following "time" and reports on stderr the wall time
+	* it took and the resources used by every child it waited for
+	*
+	* @param cmd command struct, starting with "time"
+	* @param envp environment variables
+	* @return RETURN_CODE of the timed command
+ */
+int exec_timed_command(command_t* cmd, char* envp[]);
+
 /**
 	* Command Decision Structure
 	*
@@ -247,14 +763,14 @@ int exec_command(command_t* cmd, char* envp[]);
 int exec_basic_command(command_t* cmd, char* envp[]);
 
 /**
-	* Executes any command with an I/O redirection present 
+	* Executes any command with I/O redirections present. They are applied
+	* left to right, so "cmd > out 2>&1" sends both streams to out.
 	*
 	* @param cmd command struct
-	* @param io true is stdin, false is stdout
 	* @param envp environment variables
 	* @return RETURN_CODE
 	*/
-int exec_redir_command(command_t* cmd, bool io, char* envp[]);
+int exec_redir_command(command_t* cmd, char* envp[]);
 
 /**
 	* Executes any command with an & present 
@@ -266,11 +782,12 @@ int exec_redir_command(command_t* cmd, bool io, char* envp[]);
 int exec_backg_command(command_t* cmd, char* envp[]);
 
 /**
-	* Executes any command with an | present
+	* Executes any command with an | present. Every stage runs in its own
+	* child and the whole pipeline is waited for.
 	*
 	* @param cmd command struct
 	* @param envp environment variables
-	* @return RETURN_CODE
+	* @return EXIT_SUCCESS, or the exit status of the rightmost failed stage
 	*/
 int exec_pipe_command(command_t* cmd, char* envp[]);
 
@@ -0,0 +1,68 @@
+/**
+	* @file quash_builtin.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Stable C interface for loadable builtins. A shared object defines one
+	* quash_builtin descriptor per builtin, named quash_builtin_<name>
+	* (QUASH_BUILTIN does this), and is loaded with "enable -f lib.so name".
+	* This header is all a loadable builtin needs from quash. New fields are
+	* only ever appended to the structures below.
+	*/
+
+#ifndef QUASH_BUILTIN_H
+#define QUASH_BUILTIN_H
+
+#include <stddef.h>
+
+/**
+	* Specify the interface version. Loading fails if a builtin was built
+	* against a different version.
+	*/
+#define QUASH_BUILTIN_ABI_VERSION (1)
+
+/**
+	* Specify the prefix of the descriptor symbol quash looks for
+	*/
+#define QUASH_BUILTIN_SYMBOL_PREFIX "quash_builtin_"
+
+/**
+	* Arguments and standard descriptors handed to a loadable builtin
+	*/
+typedef struct quash_builtin_args {
+	size_t size;							///< sizeof(quash_builtin_args) as quash knows it
+	int argc;								///< number of arguments, argv[0] is the name
+	char** argv;							///< arguments (NULL terminated)
+	int in;									///< descriptor to read input from
+	int out;								///< descriptor to write output to
+	int err;								///< descriptor to write diagnostics to
+} quash_builtin_args;
+
+/**
+	* Signature of a loadable builtin
+	*
+	* @param args arguments and descriptors, only valid during the call
+	* @return exit status
+	*/
+typedef int (*quash_builtin_fn)(const quash_builtin_args* args);
+
+/**
+	* Descriptor exported by a shared object for each builtin it provides
+	*/
+typedef struct quash_builtin {
+	unsigned abi_version;					///< QUASH_BUILTIN_ABI_VERSION it was built against
+	const char* name;						///< command name
+	quash_builtin_fn fn;					///< implementation
+} quash_builtin;
+
+/**
+	* Define the descriptor of a loadable builtin
+	*
+	* @param name command name (an identifier)
+	* @param fn implementation
+	*/
+#define QUASH_BUILTIN(name, fn) \
+	const quash_builtin quash_builtin_##name = { QUASH_BUILTIN_ABI_VERSION, #name, fn }
+
+#endif // QUASH_BUILTIN_H
@@ -0,0 +1,153 @@
+/**
+ * @file reader.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Growable line reader
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "reader.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Make room for at least READER_CHUNK_SIZE more bytes, first by sliding
+	* the unconsumed bytes to the front and then by doubling the buffer.
+	*
+	* @param r reader
+	* @return true on success
+	*/
+static bool reader_reserve(line_reader* r) {
+	size_t pending = r->end - r->start;
+	size_t cap = r->cap ? r->cap : READER_CHUNK_SIZE;
+	char* buf;
+
+	if ( r->start ) {
+		memmove(r->buf, r->buf + r->start, pending);
+		r->start = 0;
+		r->end = pending;
+	}
+
+	while ( cap - pending < READER_CHUNK_SIZE )
+		cap *= 2;
+	if ( cap == r->cap )
+		return true;
+
+	if ( !(buf = realloc(r->buf, cap + 1)) )
+		return false;
+	r->buf = buf;
+	r->cap = cap;
+	return true;
+}
+
+/**
+	* Find the end of the next buffered line
+	*
+	* @param r reader
+	* @return pointer to the newline, or NULL if no complete line is buffered
+	*/
+static char* reader_find_newline(line_reader* r) {
+	if ( r->end == r->start )
+		return NULL;
+	return memchr(r->buf + r->start, '\n', r->end - r->start);
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Set up a reader for a descriptor
+	*
+	* @param r reader
+	* @param fd descriptor to read
+	*/
+void reader_init(line_reader* r, int fd) {
+	r->fd = fd;
+	r->buf = NULL;
+	r->cap = 0;
+	r->start = 0;
+	r->end = 0;
+	r->eof = false;
+}
+
+/**
+	* Read the next line
+	*
+	* @param r reader
+	* @param line set to the start of the line
+	* @return length of the line, or -1 at end of input
+	*/
+ssize_t reader_getline(line_reader* r, char** line) {
+	char* nl;
+	size_t len;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Fill until a newline shows up or the input runs dry
+	////////////////////////////////////////////////////////////////////////////////
+	while ( !(nl = reader_find_newline(r)) && !r->eof ) {
+		ssize_t n;
+
+		if ( !reader_reserve(r) )
+			return -1;
+		n = read(r->fd, r->buf + r->end, r->cap - r->end);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			r->eof = true;
+		else
+			r->end += n;
+	}
+
+	if ( r->end == r->start )
+		return -1;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Cut the line out of the buffer
+	////////////////////////////////////////////////////////////////////////////////
+	*line = r->buf + r->start;
+	if ( nl ) {
+		len = nl - *line;
+		r->start += len + 1;
+	}
+	else {
+		// Final line without a newline - the reserve left a spare byte
+		len = r->end - r->start;
+		r->start = r->end;
+	}
+
+	if ( len && (*line)[len - 1] == '\r' )
+		len--;
+	(*line)[len] = '\0';
+	return len;
+}
+
+/**
+	* Query whether a complete line is already buffered
+	*
+	* @param r reader
+	* @return true if a line (or the final unterminated line) is buffered
+	*/
+bool reader_pending(line_reader* r) {
+	return reader_find_newline(r) != NULL || (r->eof && r->end > r->start);
+}
+
+/**
+	* Release the reader's buffer
+	*
+	* @param r reader
+	*/
+void reader_free(line_reader* r) {
+	free(r->buf);
+	reader_init(r, r->fd);
+}
@@ -0,0 +1,70 @@
+/**
+	* @file reader.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Growable line reader. Reads a descriptor in large chunks and hands out
+	* complete lines of any length.
+	*/
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+	* Specify how many bytes the reader asks the kernel for at a time
+	*/
+#define READER_CHUNK_SIZE (65536)
+
+/**
+	* Holds a descriptor and the bytes read from it but not yet consumed
+	*/
+typedef struct line_reader {
+	int fd;									///< descriptor being read
+	char* buf;								///< buffered bytes
+	size_t cap;								///< allocated size of buf
+	size_t start;							///< first unconsumed byte
+	size_t end;								///< one past the last buffered byte
+	bool eof;								///< read() has reported end of file
+} line_reader;
+
+/**
+	* Set up a reader for a descriptor. No memory is allocated until the
+	* first read.
+	*
+	* @param r reader
+	* @param fd descriptor to read
+	*/
+void reader_init(line_reader* r, int fd);
+
+/**
+	* Read the next line. The trailing newline (and carriage return) is
+	* removed and the line is NUL terminated. The returned memory belongs to
+	* the reader and is only valid until the next call.
+	*
+	* @param r reader
+	* @param line set to the start of the line
+	* @return length of the line, or -1 at end of input
+	*/
+ssize_t reader_getline(line_reader* r, char** line);
+
+/**
+	* Query whether a complete line is already buffered, i.e. whether
+	* reader_getline() can return without blocking.
+	*
+	* @param r reader
+	* @return true if a line (or the final unterminated line) is buffered
+	*/
+bool reader_pending(line_reader* r);
+
+/**
+	* Release the reader's buffer (the descriptor is left open)
+	*
+	* @param r reader
+	*/
+void reader_free(line_reader* r);
+
+#endif // READER_H
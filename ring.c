@@ -0,0 +1,225 @@
+/**
+ * @file ring.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Bounded ring buffer for captured job output
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "ring.h"
+#include "fdreg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Write a whole buffer to a descriptor
+	*
+	* @param fd descriptor
+	* @param data bytes to write
+	* @param len number of bytes
+	* @return true if every byte was written
+	*/
+static bool ring_write_all(int fd, const char* data, size_t len) {
+	while ( len ) {
+		ssize_t n = write(fd, data, len);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+	* Make room for need bytes of storage, doubling from RING_INIT_SIZE up to
+	* the capacity. The ring never wraps before its storage reaches the
+	* capacity, so the bytes held are always at the front while it grows.
+	*
+	* @param r ring
+	* @param need bytes of storage needed, at most cap
+	* @return true on success, false if out of memory
+	*/
+static bool ring_reserve(ring_buf* r, size_t need) {
+	size_t size = r->size ? r->size : RING_INIT_SIZE;
+	char* grown;
+
+	if ( need <= r->size )
+		return true;
+	while ( size < need )
+		size *= 2;
+	if ( size > r->cap )
+		size = r->cap;
+	if ( !(grown = realloc(r->data, size)) )
+		return false;
+	r->data = grown;
+	r->size = size;
+	return true;
+}
+
+/**
+	* Remove the oldest bytes from the ring, moving them to the spill file
+	* if one is configured
+	*
+	* @param r ring
+	* @param len number of bytes to evict
+	*/
+static void ring_evict(ring_buf* r, size_t len) {
+	size_t first = len < r->cap - r->head ? len : r->cap - r->head;
+
+	if ( r->spill_dir && r->spill_fd < 0 )
+		r->spill_fd = fdreg_track(open(r->spill_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600),
+			FD_JOB, r->owner, "output spill file");
+
+	if ( r->spill_fd >= 0
+		&& ring_write_all(r->spill_fd, r->data + r->head, first)
+		&& ring_write_all(r->spill_fd, r->data, len - first) )
+		r->spilled += len;
+
+	r->head = (r->head + len) % r->cap;
+	r->len -= len;
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Set up an empty ring
+	*
+	* @param r ring
+	* @param cap capacity in bytes
+	* @param spill_dir directory for the spill file, or NULL to drop old bytes
+	*/
+void ring_init(ring_buf* r, size_t cap, const char* spill_dir) {
+	r->data = NULL;
+	r->size = 0;
+	r->cap = cap ? cap : RING_DEFAULT_SIZE;
+	r->head = 0;
+	r->len = 0;
+	r->total = 0;
+	r->spill_dir = spill_dir;
+	r->spill_fd = -1;
+	r->spilled = 0;
+	r->owner = 0;
+}
+
+/**
+	* Append bytes, evicting (or spilling) the oldest bytes when full
+	*
+	* @param r ring
+	* @param data bytes to append
+	* @param len number of bytes
+	* @return true on success, false if out of memory
+	*/
+bool ring_write(ring_buf* r, const char* data, size_t len) {
+	size_t tail, first;
+
+	if ( !ring_reserve(r, len < r->cap - r->len ? r->len + len : r->cap) )
+		return false;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Only the newest cap bytes of a huge write can stay in the ring
+	////////////////////////////////////////////////////////////////////////////////
+	if ( len > r->cap ) {
+		ring_evict(r, r->len);
+		if ( r->spill_fd >= 0 && ring_write_all(r->spill_fd, data, len - r->cap) )
+			r->spilled += len - r->cap;
+		r->total += len - r->cap;
+		data += len - r->cap;
+		len = r->cap;
+		r->head = 0;
+	}
+	if ( r->len + len > r->cap )
+		ring_evict(r, r->len + len - r->cap);
+
+	tail = (r->head + r->len) % r->cap;
+	first = len < r->cap - tail ? len : r->cap - tail;
+	memcpy(r->data + tail, data, first);
+	memcpy(r->data, data + first, len - first);
+	r->len += len;
+	r->total += len;
+	return true;
+}
+
+/**
+	* Oldest byte offset still available
+	*
+	* @param r ring
+	* @return absolute offset
+	*/
+size_t ring_start(ring_buf* r) {
+	size_t in_ring = r->total - r->len;
+
+	// The spill file is only usable if it holds everything before the ring
+	if ( r->spill_fd >= 0 && r->spilled == in_ring )
+		return 0;
+	return in_ring;
+}
+
+/**
+	* Write everything from an absolute offset up to the newest byte
+	*
+	* @param r ring
+	* @param from absolute offset to start at
+	* @param fd descriptor to write to
+	* @return the offset following the last byte written
+	*/
+size_t ring_dump(ring_buf* r, size_t from, int fd) {
+	size_t ring_first = r->total - r->len;
+	char buf[8192];
+
+	if ( from < ring_start(r) )
+		from = ring_start(r);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Spilled bytes first
+	////////////////////////////////////////////////////////////////////////////////
+	while ( from < ring_first ) {
+		size_t want = ring_first - from < sizeof(buf) ? ring_first - from : sizeof(buf);
+		ssize_t n = pread(r->spill_fd, buf, want, from);
+
+		if ( n <= 0 || !ring_write_all(fd, buf, n) )
+			return from;
+		from += n;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Then the ring, which may wrap around once
+	////////////////////////////////////////////////////////////////////////////////
+	if ( from < r->total ) {
+		size_t pos = (r->head + (from - ring_first)) % r->cap;
+		size_t len = r->total - from;
+		size_t first = len < r->cap - pos ? len : r->cap - pos;
+
+		if ( !ring_write_all(fd, r->data + pos, first)
+			|| !ring_write_all(fd, r->data, len - first) )
+			return from;
+		from = r->total;
+	}
+	return from;
+}
+
+/**
+	* Release the ring's storage and spill file
+	*
+	* @param r ring
+	*/
+void ring_free(ring_buf* r) {
+	free(r->data);
+	if ( r->spill_fd >= 0 )
+		fdreg_close(r->spill_fd);
+	ring_init(r, r->cap, r->spill_dir);
+}
@@ -0,0 +1,99 @@
+/**
+	* @file ring.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Bounded ring buffer holding the most recent output of a background job.
+	* Bytes pushed out of the ring are either dropped or, when a spill
+	* directory is configured, appended to an anonymous spill file.
+	*/
+
+#ifndef RING_H
+#define RING_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+	* Specify the default ring capacity in bytes
+	*/
+#define RING_DEFAULT_SIZE (65536)
+
+/**
+	* Specify the first allocation for a ring's storage. It doubles as output
+	* arrives, up to the ring capacity, so jobs that print little stay small.
+	*/
+#define RING_INIT_SIZE (4096)
+
+/**
+	* Holds a job's captured output. Offsets are absolute: byte n is the n-th
+	* byte the job ever wrote.
+	*/
+typedef struct ring_buf {
+	char* data;								///< ring storage, allocated on first write
+	size_t size;							///< bytes allocated for data, at most cap
+	size_t cap;								///< ring capacity
+	size_t head;							///< position of the oldest byte in data
+	size_t len;								///< bytes currently held in data
+	size_t total;							///< bytes ever written
+	const char* spill_dir;					///< directory for the spill file, NULL to drop
+	int spill_fd;							///< spill file, -1 until the ring first overflows
+	size_t spilled;							///< bytes held in the spill file
+	int owner;								///< job ID the spill file is registered to
+} ring_buf;
+
+/**
+	* Set up an empty ring. No memory is allocated until the first write.
+	*
+	* @param r ring
+	* @param cap capacity in bytes
+	* @param spill_dir directory for the spill file, or NULL to drop old bytes
+	*/
+void ring_init(ring_buf* r, size_t cap, const char* spill_dir);
+
+/**
+	* Append bytes, evicting (or spilling) the oldest bytes when full
+	*
+	* @param r ring
+	* @param data bytes to append
+	* @param len number of bytes
+	* @return true on success, false if out of memory
+	*/
+bool ring_write(ring_buf* r, const char* data, size_t len);
+
+/**
+	* Oldest byte offset still available (in the spill file or the ring)
+	*
+	* @param r ring
+	* @return absolute offset
+	*/
+size_t ring_start(ring_buf* r);
+
+/**
+	* Write everything from an absolute offset up to the newest byte to a
+	* descriptor. Offsets that have already been dropped start at the oldest
+	* available byte.
+	*
+	* @param r ring
+	* @param from absolute offset to start at
+	* @param fd descriptor to write to
+	* @return the offset following the last byte written (r->total on success)
+	*/
+size_t ring_dump(ring_buf* r, size_t from, int fd);
+
+/**
+	* Release the ring's storage and spill file
+	*
+	* @param r ring
+	*/
+void ring_free(ring_buf* r);
+
+#endif // RING_H
@@ -0,0 +1,457 @@
+/**
+ * @file spawn.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Quash process launch engine
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "spawn.h"
+#include "path_hash.h"
+#include "trace.h"
+#include "zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Backend used for every launch
+	*/
+static spawn_mode mode = SPAWN_POSIX;
+
+/**
+	* A child reaped before its waiter got to it
+	*/
+typedef struct spawn_reaped {
+	pid_t pid;								///< child pid
+	int status;								///< wait status
+	struct rusage ru;						///< resource usage
+} spawn_reaped;
+
+/**
+	* Stashed statuses. Empty except after the SIGCHLD fallback has run, so
+	* the launch and wait paths only ever test num_reaped.
+	*/
+static spawn_reaped* reaped = NULL;
+static size_t num_reaped = 0, reaped_cap = 0;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Take a stashed status out of the stash
+	*
+	* @param pid child pid
+	* @param status receives the wait status, may be NULL
+	* @param ru receives the resource usage, may be NULL
+	* @return true if pid was stashed
+	*/
+static bool spawn_unstash(pid_t pid, int* status, struct rusage* ru) {
+	size_t i;
+
+	for ( i = 0; i < num_reaped && reaped[i].pid != pid; i++ ) {}
+	if ( i == num_reaped )
+		return false;
+	if ( status )
+		*status = reaped[i].status;
+	if ( ru )
+		*ru = reaped[i].ru;
+	reaped[i] = reaped[--num_reaped];
+	return true;
+}
+
+/**
+	* Report a failed launch the same way for every backend
+	*
+	* @param name command name
+	* @param err errno value describing the failure
+	*/
+static void spawn_error(const char* name, int err) {
+	if ( err == ENOENT )
+		fprintf(stderr, "Command: \"%s\" not found.\n", name);
+	else
+		fprintf(stderr, "Error executing %s. ERRNO\"%d\"\n", name, err);
+}
+
+/**
+	* Lowest descriptor a child has no use for: everything from here up is
+	* shut off before exec, so nothing the shell (or a loadable builtin)
+	* left inheritable can leak into it
+	*
+	* @param sp launch description, may be NULL
+	* @return first descriptor above stderr and every file action target
+	*/
+static int spawn_first_unused(spawn_t* sp) {
+	int first = STDERR_FILENO + 1, i;
+
+	for ( i = 0; sp && i < sp->num_actions; i++ ) {
+		if ( sp->actions[i].fd >= first )
+			first = sp->actions[i].fd + 1;
+	}
+	return first;
+}
+
+/**
+	* posix_spawn backend. glibc implements this with
+	* clone(CLONE_VM|CLONE_VFORK), so the cost does not grow with our heap.
+	*
+	* @param sp launch description
+	* @param path resolved executable path
+	* @param argv argument vector
+	* @param envp environment variables
+	* @return pid, or -1 with errno set to the launch error
+	*/
+static pid_t spawn_posix(spawn_t* sp, const char* path, char* argv[], char* envp[]) {
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t p = -1;
+	int i, err;
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&attr);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Translate queued actions
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 0; sp && i < sp->num_actions; i++ ) {
+		if ( sp->actions[i].type == SPAWN_DUP2 )
+			posix_spawn_file_actions_adddup2(&fa, sp->actions[i].src, sp->actions[i].fd);
+		else
+			posix_spawn_file_actions_addclose(&fa, sp->actions[i].fd);
+	}
+	posix_spawn_file_actions_addclosefrom_np(&fa, spawn_first_unused(sp));
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Children start with an empty signal mask and default dispositions,
+	// whatever the shell happens to be blocking right now
+	////////////////////////////////////////////////////////////////////////////////
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGPIPE);
+	sigaddset(&mask, SIGCHLD);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	if ( (err = posix_spawn(&p, path, &fa, &attr, argv, envp)) ) {
+		errno = err;
+		p = -1;
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	return p;
+}
+
+/**
+	* fork + execve backend
+	*
+	* @param sp launch description
+	* @param path resolved executable path
+	* @param argv argument vector
+	* @param envp environment variables
+	* @return pid, or -1 with errno set to the launch error
+	*/
+static pid_t spawn_fork(spawn_t* sp, const char* path, char* argv[], char* envp[]) {
+	pid_t p;
+	int err;
+
+	p = fork();
+	if ( p != 0 )
+		return p;
+
+	spawn_child_setup(sp);
+	execve(path, argv, envp);
+	err = errno;
+	spawn_error(argv[0], err);
+	_exit(err == ENOENT ? 127 : 126);
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Select the launch backend from $QUASH_SPAWN ("fork", "zygote" or
+	* "posix"). The zygote's fork server is started here, while the shell's
+	* image is still small.
+	*/
+void spawn_init() {
+	char* env = getenv("QUASH_SPAWN");
+
+	if ( env && !strcmp(env, "fork") )
+		mode = SPAWN_FORK;
+	else if ( env && !strcmp(env, "zygote") ) {
+		mode = SPAWN_ZYGOTE;
+		if ( !zygote_start() ) {
+			fprintf(stderr, "Error starting fork server. ERRNO\"%d\"\n", errno);
+			mode = SPAWN_POSIX;
+		}
+	}
+	else
+		mode = SPAWN_POSIX;
+}
+
+/**
+	* Stop using the fork server in a forked child of the shell; the child
+	* launches directly from then on
+	*/
+void spawn_detach() {
+	if ( mode != SPAWN_ZYGOTE )
+		return;
+	zygote_stop();
+	mode = SPAWN_POSIX;
+}
+
+/**
+	* Query the launch backend currently in use
+	*
+	* @return active spawn_mode
+	*/
+spawn_mode spawn_get_mode() {
+	return mode;
+}
+
+/**
+	* Reset a launch description to "no file actions"
+	*
+	* @param sp launch description
+	*/
+void spawn_reset(spawn_t* sp) {
+	sp->num_actions = 0;
+	sp->background = false;
+}
+
+/**
+	* Mark a launch as a background job. Background jobs are reaped through
+	* the job table, so they are always children of the shell itself.
+	*
+	* @param sp launch description
+	*/
+void spawn_set_background(spawn_t* sp) {
+	sp->background = true;
+}
+
+/**
+	* Queue a dup2(src, fd) in the child
+	*
+	* @param sp launch description
+	* @param src descriptor to duplicate
+	* @param fd descriptor number it should end up as
+	* @return true on success, false if the action list is full
+	*/
+bool spawn_add_dup2(spawn_t* sp, int src, int fd) {
+	if ( sp->num_actions >= MAX_SPAWN_ACTIONS )
+		return false;
+	sp->actions[sp->num_actions].type = SPAWN_DUP2;
+	sp->actions[sp->num_actions].src = src;
+	sp->actions[sp->num_actions].fd = fd;
+	sp->num_actions++;
+	return true;
+}
+
+/**
+	* Queue a close(fd) in the child
+	*
+	* @param sp launch description
+	* @param fd descriptor to close
+	* @return true on success, false if the action list is full
+	*/
+bool spawn_add_close(spawn_t* sp, int fd) {
+	if ( sp->num_actions >= MAX_SPAWN_ACTIONS )
+		return false;
+	sp->actions[sp->num_actions].type = SPAWN_CLOSE;
+	sp->actions[sp->num_actions].src = -1;
+	sp->actions[sp->num_actions].fd = fd;
+	sp->num_actions++;
+	return true;
+}
+
+/**
+	* Launch argv[0] (resolved through the path hash) with the queued file
+	* actions applied.
+	*
+	* @param sp launch description, may be NULL for no file actions
+	* @param argv NULL terminated argument vector
+	* @param envp environment variables
+	* @return pid of the new process, or -1 with errno set to the launch error
+	*/
+pid_t spawn_command(spawn_t* sp, char* argv[], char* envp[]) {
+	const char* path;
+	int attempt, err;
+	pid_t p = -1;
+	TRACE_BEGIN(t_spawn);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Anything still sitting in our stdio buffers belongs before the child's
+	// output (and must not be duplicated into a forked child)
+	////////////////////////////////////////////////////////////////////////////////
+	fflush(stdout);
+	fflush(stderr);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Resolve through the path hash, retrying once with a fresh $PATH search if
+	// the cached binary has disappeared since it was hashed
+	////////////////////////////////////////////////////////////////////////////////
+	for ( attempt = 0; attempt < 2; attempt++ ) {
+		if ( !(path = path_hash_lookup(argv[0])) ) {
+			spawn_error(argv[0], ENOENT);
+			errno = ENOENT;
+			return -1;
+		}
+
+		p = -2;
+		if ( mode == SPAWN_ZYGOTE && !(sp && sp->background) ) {
+			if ( (p = zygote_spawn(sp, path, argv, envp)) == -2 && !zygote_running() )
+				mode = SPAWN_POSIX;		// the fork server is gone
+		}
+		if ( p == -2 && mode == SPAWN_FORK )
+			p = spawn_fork(sp, path, argv, envp);
+		else if ( p == -2 )
+			p = spawn_posix(sp, path, argv, envp);
+
+		if ( p >= 0 || errno != ENOENT || path == argv[0] )
+			break;
+		path_hash_forget(argv[0]);
+	}
+
+	err = errno;
+	if ( p < 0 )
+		spawn_error(argv[0], err);
+	else if ( num_reaped )
+		spawn_unstash(p, NULL, NULL);	// a stale entry for a recycled pid
+	TRACE_END(TRACE_SPAWN, t_spawn, argv[0]);
+	errno = err;			// callers map it to an exit status of 127 or 126
+	return p;
+}
+
+/**
+	* Run a function in a forked child with the queued file actions applied.
+	* Used for shell builtins that have to run in their own process (upstream
+	* pipeline stages, background jobs).
+	*
+	* @param sp launch description, may be NULL for no file actions
+	* @param fn function to run, its return value is the child's exit status
+	* @param arg argument passed to fn
+	* @return pid of the new process, or -1 on failure
+	*/
+pid_t spawn_function(spawn_t* sp, int (*fn)(void* arg), void* arg) {
+	pid_t p;
+	int status;
+	TRACE_BEGIN(t_spawn);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if ( (p = fork()) < 0 ) {
+		fprintf(stderr, "Error forking builtin. ERRNO\"%d\"\n", errno);
+		return -1;
+	}
+	if ( p != 0 ) {
+		if ( num_reaped )
+			spawn_unstash(p, NULL, NULL);	// a stale entry for a recycled pid
+		TRACE_END(TRACE_SPAWN, t_spawn, NULL);
+		return p;
+	}
+
+	spawn_child_setup(sp);
+
+	// No exec follows, so close-on-exec never happens. Close the shell's
+	// descriptors by hand - a pipe end kept open here would stop the stage
+	// reading it from ever seeing end of file, or the writer from SIGPIPE.
+	close_range(3, ~0U, 0);
+	status = fn(arg);
+	fflush(stdout);
+	fflush(stderr);
+	_exit(status);
+}
+
+/**
+	* Child side of a fork - apply file actions and give the child the default
+	* signal dispositions and an empty signal mask
+	*
+	* @param sp launch description, may be NULL
+	*/
+void spawn_child_setup(spawn_t* sp) {
+	sigset_t mask;
+	int i;
+
+	for ( i = 0; sp && i < sp->num_actions; i++ ) {
+		if ( sp->actions[i].type == SPAWN_CLOSE )
+			close(sp->actions[i].fd);
+		else if ( sp->actions[i].src == sp->actions[i].fd )
+			fcntl(sp->actions[i].fd, F_SETFD, 0);	// dup2 onto itself keeps close-on-exec
+		else if ( dup2(sp->actions[i].src, sp->actions[i].fd) < 0 ) {
+			fprintf(stderr, "\nError redirecting fd %d. ERRNO\"%d\"\n", sp->actions[i].fd, errno);
+			_exit(EXIT_FAILURE);
+		}
+	}
+
+	// Marked rather than closed - the caller may still need its descriptors
+	// (a builtin helper, the fork server's exec status pipe) up to exec
+	close_range(spawn_first_unused(sp), ~0U, CLOSE_RANGE_CLOEXEC);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+/**
+	* Keep the status of a foreground child reaped by someone else
+	*
+	* @param pid child pid
+	* @param status wait status
+	* @param ru resource usage
+	*/
+void spawn_stash(pid_t pid, int status, const struct rusage* ru) {
+	spawn_reaped* grown;
+
+	if ( num_reaped == reaped_cap ) {
+		size_t cap = reaped_cap ? reaped_cap * 2 : SPAWN_STASH_INIT_SIZE;
+		if ( !(grown = realloc(reaped, cap * sizeof(spawn_reaped))) ) {
+			fprintf(stderr, "Error keeping the status of child %d. ERRNO\"%d\"\n", pid, errno);
+			return;
+		}
+		reaped = grown;
+		reaped_cap = cap;
+	}
+	reaped[num_reaped++] = (spawn_reaped) { pid, status, *ru };
+}
+
+/**
+	* Wait for a foreground child, whichever backend launched it
+	*
+	* @param pid child pid
+	* @param status receives the wait status
+	* @param ru receives the resource usage
+	* @return pid, or -1 with errno set on failure
+	*/
+pid_t spawn_wait(pid_t pid, int* status, struct rusage* ru) {
+	pid_t p;
+
+	if ( num_reaped && spawn_unstash(pid, status, ru) )
+		return pid;
+	while ( (p = wait4(pid, status, 0, ru)) < 0 && errno == EINTR );
+	if ( p < 0 && errno == ECHILD && zygote_running() )
+		p = zygote_wait(pid, status, ru);
+	return p;
+}
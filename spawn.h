@@ -0,0 +1,170 @@
+/**
+	* @file spawn.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Quash process launch engine. Every external command is started through
+	* this interface so the shell never has to copy its own address space just
+	* to call exec.
+	*/
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/**
+	* Specify the maximum number of file actions a single launch may carry
+	*/
+#define MAX_SPAWN_ACTIONS (16)
+
+/**
+	* Specify the initial room for children reaped before their waiter
+	*/
+#define SPAWN_STASH_INIT_SIZE (16)
+
+/**
+	* Launch backends understood by the engine
+	*/
+typedef enum spawn_mode {
+	SPAWN_POSIX,							///< posix_spawn (clone(CLONE_VM|CLONE_VFORK) in glibc)
+	SPAWN_FORK,								///< classic fork + execve, kept for comparison
+	SPAWN_ZYGOTE							///< fork server started with the shell (zygote.h)
+} spawn_mode;
+
+/**
+	* A single file action applied in the child before exec
+	*/
+typedef struct spawn_action {
+	enum { SPAWN_DUP2, SPAWN_CLOSE } type;	///< what to do with the descriptor
+	int fd;									///< target descriptor
+	int src;								///< source descriptor for SPAWN_DUP2
+} spawn_action;
+
+/**
+	* Holds everything needed to launch a single process
+	*/
+typedef struct spawn_t {
+	spawn_action actions[MAX_SPAWN_ACTIONS];	///< ordered file actions
+	int num_actions;							///< number of file actions queued
+	bool background;							///< reaped by the job table, never by the fork server
+} spawn_t;
+
+/**
+	* Select the launch backend from $QUASH_SPAWN ("fork", "zygote" or
+	* "posix"). The zygote's fork server is started here, while the shell's
+	* image is still small.
+	*/
+void spawn_init();
+
+/**
+	* Stop using the fork server in a forked child of the shell; the child
+	* launches directly from then on
+	*/
+void spawn_detach();
+
+/**
+	* Query the launch backend currently in use
+	*
+	* @return active spawn_mode
+	*/
+spawn_mode spawn_get_mode();
+
+/**
+	* Reset a launch description to "no file actions"
+	*
+	* @param sp launch description
+	*/
+void spawn_reset(spawn_t* sp);
+
+/**
+	* Queue a dup2(src, fd) in the child
+	*
+	* @param sp launch description
+	* @param src descriptor to duplicate
+	* @param fd descriptor number it should end up as
+	* @return true on success, false if the action list is full
+	*/
+bool spawn_add_dup2(spawn_t* sp, int src, int fd);
+
+/**
+	* Mark a launch as a background job. Background jobs are reaped through
+	* the job table, so they are always children of the shell itself.
+	*
+	* @param sp launch description
+	*/
+void spawn_set_background(spawn_t* sp);
+
+/**
+	* Queue a close(fd) in the child
+	*
+	* @param sp launch description
+	* @param fd descriptor to close
+	* @return true on success, false if the action list is full
+	*/
+bool spawn_add_close(spawn_t* sp, int fd);
+
+/**
+	* Launch argv[0] (resolved through the path hash) with the queued file
+	* actions applied.
+	* Launch failures are reported on stderr.
+	*
+	* @param sp launch description, may be NULL for no file actions
+	* @param argv NULL terminated argument vector
+	* @param envp environment variables
+	* @return pid of the new process, or -1 with errno set to the launch error
+	*/
+pid_t spawn_command(spawn_t* sp, char* argv[], char* envp[]);
+
+/**
+	* Run a function in a forked child with the queued file actions applied.
+	* Used for shell builtins that have to run in their own process.
+	*
+	* @param sp launch description, may be NULL for no file actions
+	* @param fn function to run, its return value is the child's exit status
+	* @param arg argument passed to fn
+	* @return pid of the new process, or -1 on failure
+	*/
+pid_t spawn_function(spawn_t* sp, int (*fn)(void* arg), void* arg);
+
+/**
+	* Child side of a fork - apply file actions and give the child the default
+	* signal dispositions and an empty signal mask
+	*
+	* @param sp launch description, may be NULL
+	*/
+void spawn_child_setup(spawn_t* sp);
+
+/**
+	* Keep the status of a foreground child that was reaped by someone other
+	* than its waiter (the SIGCHLD fallback draining every exited child), so
+	* spawn_wait can still hand it over
+	*
+	* @param pid child pid
+	* @param status wait status
+	* @param ru resource usage
+	*/
+void spawn_stash(pid_t pid, int status, const struct rusage* ru);
+
+/**
+	* Wait for a foreground child, whichever backend launched it. A status
+	* kept by spawn_stash is returned without waiting.
+	*
+	* @param pid child pid
+	* @param status receives the wait status
+	* @param ru receives the resource usage
+	* @return pid, or -1 with errno set on failure
+	*/
+pid_t spawn_wait(pid_t pid, int* status, struct rusage* ru);
+
+#endif // SPAWN_H
@@ -0,0 +1,1544 @@
+/**
+ * @file textutil.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * In-process text utilities and their vectorized kernels
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "textutil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) && !defined(QUASH_NO_SIMD)
+#include <immintrin.h>
+#define TEXT_X86
+#endif
+
+/**************************************************************************
+ * Private Types
+ **************************************************************************/
+/**
+	* Buffered output
+	*/
+typedef struct text_out {
+	int fd;									///< descriptor written to
+	bool failed;							///< a write failed, the rest is dropped
+	size_t len;								///< bytes buffered
+	char buf[TEXT_OUT_SIZE];				///< pending output
+} text_out;
+
+/**
+	* Block reader handing out whole lines
+	*/
+typedef struct text_in {
+	int fd;									///< descriptor read from
+	char* buf;								///< input block
+	size_t cap;								///< allocated size of buf
+	size_t start;							///< first byte not handed out yet
+	size_t scan;							///< bytes before this hold no unseen newline
+	size_t end;								///< end of the bytes read
+	bool eof;								///< fd has no more input
+} text_in;
+
+/**
+	* A range of fields or bytes in a cut list (1-based, inclusive)
+	*/
+typedef struct text_range {
+	size_t lo;								///< first position
+	size_t hi;								///< last position, SIZE_MAX for open ended
+} text_range;
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Kernel set in use
+	*/
+static text_simd simd = TEXT_SCALAR;
+
+/**************************************************************************
+ * Kernels
+ **************************************************************************/
+/**
+	* Count a byte, one at a time
+	*/
+static size_t count_scalar(const char* buf, size_t len, char c) {
+	size_t count = 0, i;
+
+	for ( i = 0; i < len; i++ )
+		count += buf[i] == c;
+	return count;
+}
+
+/**
+	* Find a string with the C library
+	*/
+static const char* find_scalar(const char* hay, size_t len, const char* needle, size_t nlen) {
+	return memmem(hay, len, needle, nlen);
+}
+
+#ifdef TEXT_X86
+/**
+	* Count a byte 16 bytes at a time. Matches are summed in byte lanes for
+	* up to 255 blocks, then folded into the total with a SAD.
+	*/
+__attribute__((target("sse2")))
+static size_t count_sse2(const char* buf, size_t len, char c) {
+	const __m128i want = _mm_set1_epi8(c);
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0, i = 0;
+
+	while ( len - i >= 16 ) {
+		size_t blocks = (len - i) / 16;
+		__m128i acc = zero, sums;
+
+		if ( blocks > 255 )
+			blocks = 255;
+		for ( ; blocks; blocks--, i += 16 ) {
+			__m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, want));
+		}
+		sums = _mm_sad_epu8(acc, zero);
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+	return count + count_scalar(buf + i, len - i, c);
+}
+
+/**
+	* Count a byte 32 bytes at a time
+	*/
+__attribute__((target("avx2")))
+static size_t count_avx2(const char* buf, size_t len, char c) {
+	const __m256i want = _mm256_set1_epi8(c);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t count = 0, i = 0;
+
+	while ( len - i >= 32 ) {
+		size_t blocks = (len - i) / 32;
+		__m256i acc = zero, sums;
+
+		if ( blocks > 255 )
+			blocks = 255;
+		for ( ; blocks; blocks--, i += 32 ) {
+			__m256i v = _mm256_loadu_si256((const __m256i*) (buf + i));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, want));
+		}
+		sums = _mm256_sad_epu8(acc, zero);
+		count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+			+ _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+	}
+	return count + count_sse2(buf + i, len - i, c);
+}
+
+/**
+	* Find a string 16 candidate positions at a time: positions whose first
+	* and last bytes both match are the only ones compared in full
+	*/
+__attribute__((target("sse2")))
+static const char* find_sse2(const char* hay, size_t len, const char* needle, size_t nlen) {
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+	size_t i;
+
+	for ( i = 0; i + nlen - 1 + 16 <= len; i += 16 ) {
+		__m128i f = _mm_loadu_si128((const __m128i*) (hay + i));
+		__m128i l = _mm_loadu_si128((const __m128i*) (hay + i + nlen - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first),
+			_mm_cmpeq_epi8(l, last)));
+
+		while ( mask ) {
+			unsigned bit = __builtin_ctz(mask);
+
+			if ( !memcmp(hay + i + bit + 1, needle + 1, nlen - 2) )
+				return hay + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return find_scalar(hay + i, len - i, needle, nlen);
+}
+
+/**
+	* Find a string 32 candidate positions at a time
+	*/
+__attribute__((target("avx2")))
+static const char* find_avx2(const char* hay, size_t len, const char* needle, size_t nlen) {
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+	size_t i;
+
+	for ( i = 0; i + nlen - 1 + 32 <= len; i += 32 ) {
+		__m256i f = _mm256_loadu_si256((const __m256i*) (hay + i));
+		__m256i l = _mm256_loadu_si256((const __m256i*) (hay + i + nlen - 1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first),
+			_mm256_cmpeq_epi8(l, last)));
+
+		while ( mask ) {
+			unsigned bit = __builtin_ctz(mask);
+
+			if ( !memcmp(hay + i + bit + 1, needle + 1, nlen - 2) )
+				return hay + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return find_sse2(hay + i, len - i, needle, nlen);
+}
+#endif // TEXT_X86
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Write a whole buffer to a descriptor
+	*
+	* @param fd descriptor
+	* @param data bytes to write
+	* @param len number of bytes
+	* @return true if every byte was written
+	*/
+static bool write_all(int fd, const char* data, size_t len) {
+	while ( len ) {
+		ssize_t n = write(fd, data, len);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+	* Write out everything buffered
+	*
+	* @param o output
+	*/
+static void out_flush(text_out* o) {
+	if ( o->len && !o->failed && !write_all(o->fd, o->buf, o->len) )
+		o->failed = true;
+	o->len = 0;
+}
+
+/**
+	* Append bytes to the output. Large writes skip the buffer.
+	*
+	* @param o output
+	* @param data bytes
+	* @param len number of bytes
+	*/
+static void out_write(text_out* o, const char* data, size_t len) {
+	if ( o->len + len > sizeof(o->buf) ) {
+		out_flush(o);
+		if ( len >= sizeof(o->buf) ) {
+			if ( !o->failed && !write_all(o->fd, data, len) )
+				o->failed = true;
+			return;
+		}
+	}
+	memcpy(o->buf + o->len, data, len);
+	o->len += len;
+}
+
+/**
+	* Append a line, adding the newline if it has none
+	*
+	* @param o output
+	* @param line line
+	* @param len length of line
+	*/
+static void out_line(text_out* o, const char* line, size_t len) {
+	out_write(o, line, len);
+	if ( !len || line[len - 1] != '\n' )
+		out_write(o, "\n", 1);
+}
+
+/**
+	* Append formatted text
+	*
+	* @param o output
+	* @param fmt printf format
+	*/
+__attribute__((format(printf, 2, 3)))
+static void out_printf(text_out* o, const char* fmt, ...) {
+	char line[512];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if ( n > 0 )
+		out_write(o, line, (size_t) n < sizeof(line) ? (size_t) n : sizeof(line) - 1);
+}
+
+/**
+	* Set up output to a descriptor
+	*
+	* @param fd descriptor
+	* @return output, or NULL if out of memory
+	*/
+static text_out* out_open(int fd) {
+	text_out* o = malloc(sizeof(text_out));
+
+	if ( o ) {
+		o->fd = fd;
+		o->failed = false;
+		o->len = 0;
+	}
+	return o;
+}
+
+/**
+	* Flush and release output
+	*
+	* @param o output
+	* @return true if everything was written
+	*/
+static bool out_close(text_out* o) {
+	bool ok;
+
+	out_flush(o);
+	ok = !o->failed;
+	free(o);
+	return ok;
+}
+
+/**
+	* Set up a block reader
+	*
+	* @param r reader
+	* @param fd descriptor
+	* @return true on success, false if out of memory
+	*/
+static bool in_open(text_in* r, int fd) {
+	r->fd = fd;
+	r->cap = TEXT_BUF_SIZE;
+	r->start = 0;
+	r->scan = 0;
+	r->end = 0;
+	r->eof = false;
+	return (r->buf = malloc(r->cap)) != NULL;
+}
+
+/**
+	* Next block of whole lines. The final line of the input may lack its
+	* newline.
+	*
+	* @param r reader
+	* @param block set to the start of the block
+	* @return length of the block, 0 at end of input, -1 on error
+	*/
+static ssize_t in_lines(text_in* r, char** block) {
+	for ( ;; ) {
+		size_t pending = r->end - r->start;
+		char* nl = r->end > r->scan ? memrchr(r->buf + r->scan, '\n', r->end - r->scan) : NULL;
+		ssize_t n;
+
+		// Only newly read bytes are searched, so a huge line costs one pass
+		r->scan = r->end;
+		if ( nl || (r->eof && pending) ) {
+			size_t len = nl ? (size_t) (nl + 1 - (r->buf + r->start)) : pending;
+
+			*block = r->buf + r->start;
+			r->start += len;
+			return len;
+		}
+		if ( r->eof )
+			return 0;
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Only part of a line is buffered - slide it down, grow if it fills
+		// the whole block, and read more
+		////////////////////////////////////////////////////////////////////////////////
+		memmove(r->buf, r->buf + r->start, pending);
+		r->start = 0;
+		r->scan = r->end = pending;
+		if ( r->end == r->cap ) {
+			char* grown = realloc(r->buf, r->cap * 2);
+
+			if ( !grown )
+				return -1;
+			r->buf = grown;
+			r->cap *= 2;
+		}
+
+		n = read(r->fd, r->buf + r->end, r->cap - r->end);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 )
+			return -1;
+		if ( n == 0 )
+			r->eof = true;
+		r->end += n;
+	}
+}
+
+/**
+	* Release a block reader
+	*
+	* @param r reader
+	*/
+static void in_close(text_in* r) {
+	free(r->buf);
+	r->buf = NULL;
+}
+
+/**
+	* Open an input operand
+	*
+	* @param name file name, "-" for standard input
+	* @param in descriptor standing for standard input
+	* @param err descriptor for diagnostics
+	* @param tool utility name used in messages
+	* @return descriptor, or -1 after reporting the failure
+	*/
+static int open_input(const char* name, int in, int err, const char* tool) {
+	int fd;
+
+	if ( !strcmp(name, "-") )
+		return in;
+	if ( (fd = open(name, O_RDONLY | O_CLOEXEC)) >= 0 )
+		return fd;
+
+	// Same wording as coreutils
+	if ( !strcmp(tool, "head") || !strcmp(tool, "tail") )
+		dprintf(err, "%s: cannot open '%s' for reading: %s\n", tool, name, strerror(errno));
+	else
+		dprintf(err, "%s: %s: %s\n", tool, name, strerror(errno));
+	return fd;
+}
+
+/**
+	* Close an input operand unless it is standard input
+	*
+	* @param fd descriptor
+	* @param in descriptor standing for standard input
+	*/
+static void close_input(int fd, int in) {
+	if ( fd != in )
+		close(fd);
+}
+
+/**
+	* Parse a non-negative count
+	*
+	* @param s text
+	* @param n receives the count
+	* @return true if s is a plain decimal number
+	*/
+static bool parse_count(const char* s, size_t* n) {
+	char* end;
+
+	if ( !s || *s < '0' || *s > '9' )
+		return false;
+	errno = 0;
+	*n = strtoull(s, &end, 10);
+	return !*end && !errno;
+}
+
+/**
+	* Offset of the last n lines of a buffer
+	*
+	* @param buf bytes
+	* @param len number of bytes
+	* @param n number of lines
+	* @return offset of the first of the last n lines, 0 if there are fewer
+	*/
+static size_t last_lines(const char* buf, size_t len, size_t n) {
+	size_t end = len;
+
+	if ( !n )
+		return len;
+	if ( end && buf[end - 1] == '\n' )
+		end--;		// the final newline ends the last line
+	while ( n-- ) {
+		const char* nl = memrchr(buf, '\n', end);
+
+		if ( !nl )
+			return 0;
+		end = nl - buf;
+	}
+	return end + 1;
+}
+
+/**
+	* Offset just past the n-th newline of a buffer
+	*
+	* @param buf bytes
+	* @param len number of bytes
+	* @param n newlines to skip (fewer than text_count(buf, len, '\n'))
+	* @return offset following the n-th newline
+	*/
+static size_t skip_lines(const char* buf, size_t len, size_t n) {
+	const char* p = buf;
+
+	while ( n-- )
+		p = (const char*) memchr(p, '\n', len - (p - buf)) + 1;
+	return p - buf;
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Pick the kernels
+	*/
+void text_init() {
+	char* env = getenv("QUASH_SIMD");
+	text_simd best = TEXT_SCALAR;
+
+#ifdef TEXT_X86
+	__builtin_cpu_init();
+	best = __builtin_cpu_supports("avx2") ? TEXT_AVX2 : TEXT_SSE2;
+#endif
+
+	simd = best;
+	if ( env && !strcmp(env, "scalar") )
+		simd = TEXT_SCALAR;
+	else if ( env && !strcmp(env, "sse2") && best >= TEXT_SSE2 )
+		simd = TEXT_SSE2;
+}
+
+/**
+	* Kernel set in use
+	*
+	* @return kernel set
+	*/
+text_simd text_get_simd() {
+	return simd;
+}
+
+/**
+	* Count the occurrences of a byte
+	*
+	* @param buf bytes to search
+	* @param len number of bytes
+	* @param c byte to count
+	* @return number of occurrences
+	*/
+size_t text_count(const char* buf, size_t len, char c) {
+#ifdef TEXT_X86
+	if ( simd == TEXT_AVX2 )
+		return count_avx2(buf, len, c);
+	if ( simd == TEXT_SSE2 )
+		return count_sse2(buf, len, c);
+#endif
+	return count_scalar(buf, len, c);
+}
+
+/**
+	* Find the first occurrence of a string
+	*
+	* @param hay bytes to search
+	* @param len number of bytes
+	* @param needle string to find
+	* @param nlen length of needle
+	* @return start of the first occurrence, or NULL if there is none
+	*/
+const char* text_find(const char* hay, size_t len, const char* needle, size_t nlen) {
+	if ( !nlen )
+		return hay;
+	if ( nlen > len )
+		return NULL;
+	if ( nlen == 1 )
+		return memchr(hay, needle[0], len);
+#ifdef TEXT_X86
+	if ( simd == TEXT_AVX2 )
+		return find_avx2(hay, len, needle, nlen);
+	if ( simd == TEXT_SSE2 )
+		return find_sse2(hay, len, needle, nlen);
+#endif
+	return find_scalar(hay, len, needle, nlen);
+}
+
+/**************************************************************************
+ * Utilities
+ **************************************************************************/
+
+/**
+	* Count lines, words and bytes of one input
+	*
+	* @param fd input
+	* @param want_lines count lines
+	* @param want_words count words
+	* @param counts receives lines, words and bytes
+	* @return true on success
+	*/
+static bool wc_fd(int fd, bool want_lines, bool want_words, size_t counts[3]) {
+	struct stat st;
+	bool in_word = false;
+	text_in r;
+	ssize_t len;
+	char* block;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Bytes alone of a regular file don't need reading
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !want_lines && !want_words && !fstat(fd, &st) && S_ISREG(st.st_mode) ) {
+		off_t at = lseek(fd, 0, SEEK_CUR);
+
+		if ( at >= 0 && at <= st.st_size ) {
+			counts[2] = st.st_size - at;
+			return true;
+		}
+	}
+
+	if ( !in_open(&r, fd) )
+		return false;
+	while ( (len = in_lines(&r, &block)) > 0 ) {
+		counts[2] += len;
+		if ( want_lines )
+			counts[0] += text_count(block, len, '\n');
+		if ( want_words ) {
+			ssize_t i;
+
+			for ( i = 0; i < len; i++ ) {
+				unsigned char c = block[i];
+				bool space = c == ' ' || (c >= '\t' && c <= '\r');
+
+				counts[1] += !space && !in_word;
+				in_word = !space;
+			}
+		}
+	}
+	in_close(&r);
+	return len == 0;
+}
+
+/**
+	* wc [-lwc] [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int text_wc(int argc, char** argv, int in, int out, int err) {
+	bool want[3] = { false, false, false };
+	size_t total[3] = { 0, 0, 0 };
+	int i, f, cols = 0, width = 1, nfiles, status = EXIT_SUCCESS;
+	char* stdin_only[] = { "-", NULL };
+	char** files;
+	text_out* o;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Options
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		char* p;
+
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		for ( p = argv[i] + 1; *p; p++ ) {
+			if ( *p == 'l' )
+				want[0] = true;
+			else if ( *p == 'w' )
+				want[1] = true;
+			else if ( *p == 'c' )
+				want[2] = true;
+			else
+				return TEXT_UNSUPPORTED;
+		}
+	}
+	if ( !want[0] && !want[1] && !want[2] )
+		want[0] = want[1] = want[2] = true;
+	cols = want[0] + want[1] + want[2];
+
+	nfiles = argc - i;
+	files = nfiles ? argv + i : stdin_only;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Column width as coreutils picks it: wide enough for the total size of
+	// regular files, at least 7 when anything else is read
+	////////////////////////////////////////////////////////////////////////////////
+	if ( cols > 1 || nfiles > 1 ) {
+		size_t size = 0;
+		bool special = false;
+
+		for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+			struct stat st;
+
+			if ( !strcmp(files[f], "-") ? fstat(in, &st) : stat(files[f], &st) )
+				continue;
+			if ( S_ISREG(st.st_mode) )
+				size += st.st_size;
+			else
+				special = true;
+		}
+		for ( width = 1; size >= 10; size /= 10 )
+			width++;
+		if ( special && width < 7 )
+			width = 7;
+	}
+
+	if ( !(o = out_open(out)) )
+		return EXIT_FAILURE;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Count every input
+	////////////////////////////////////////////////////////////////////////////////
+	for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+		size_t counts[3] = { 0, 0, 0 };
+		int fd = open_input(files[f], in, err, "wc");
+		int c;
+		bool sep = false;
+
+		if ( fd < 0 ) {
+			status = EXIT_FAILURE;
+			continue;
+		}
+		if ( !wc_fd(fd, want[0], want[1], counts) ) {
+			dprintf(err, "wc: %s: %s\n", files[f], strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		close_input(fd, in);
+
+		for ( c = 0; c < 3; c++ ) {
+			if ( want[c] ) {
+				out_printf(o, "%s%*zu", sep ? " " : "", width, counts[c]);
+				sep = true;
+			}
+			total[c] += counts[c];
+		}
+		if ( nfiles )
+			out_printf(o, " %s", files[f]);
+		out_write(o, "\n", 1);
+	}
+
+	if ( nfiles > 1 ) {
+		int c;
+		bool sep = false;
+
+		for ( c = 0; c < 3; c++ ) {
+			if ( want[c] ) {
+				out_printf(o, "%s%*zu", sep ? " " : "", width, total[c]);
+				sep = true;
+			}
+		}
+		out_write(o, " total\n", 7);
+	}
+	return out_close(o) ? status : EXIT_FAILURE;
+}
+
+/**
+	* grep settings
+	*/
+typedef struct grep_opts {
+	const char* pattern;					///< fixed string searched for
+	size_t plen;							///< length of pattern
+	bool count;								///< -c: print the number of selected lines
+	bool number;							///< -n: prefix lines with their number
+	bool quiet;								///< -q: print nothing, stop at the first match
+	bool invert;							///< -v: select lines that don't match
+	const char* prefix;						///< file name to prefix lines with, or NULL
+} grep_opts;
+
+/**
+	* Print one selected line with its prefixes
+	*
+	* @param o output
+	* @param g settings
+	* @param lineno 1-based line number
+	* @param line line
+	* @param len length of line, including its newline if it has one
+	*/
+static void grep_line(text_out* o, grep_opts* g, size_t lineno, const char* line, size_t len) {
+	if ( g->prefix )
+		out_printf(o, "%s:", g->prefix);
+	if ( g->number )
+		out_printf(o, "%zu:", lineno);
+	out_line(o, line, len);
+}
+
+/**
+	* Handle a run of lines that don't match
+	*
+	* @param o output
+	* @param g settings
+	* @param lineno number of the line before the run, advanced past it
+	* @param selected number of selected lines, advanced for -v
+	* @param run lines
+	* @param len length of the run
+	*/
+static void grep_misses(text_out* o, grep_opts* g, size_t* lineno, size_t* selected,
+	const char* run, size_t len) {
+	size_t lines;
+
+	if ( !len )
+		return;
+	lines = text_count(run, len, '\n') + (run[len - 1] != '\n');
+
+	if ( g->invert && !g->count && !g->quiet ) {
+		////////////////////////////////////////////////////////////////////////////////
+		// Without prefixes the whole run goes out in one piece
+		////////////////////////////////////////////////////////////////////////////////
+		if ( !g->prefix && !g->number )
+			out_line(o, run, len);
+		else {
+			const char* p = run;
+			const char* end = run + len;
+			size_t n = *lineno;
+
+			while ( p < end ) {
+				const char* nl = memchr(p, '\n', end - p);
+				const char* next = nl ? nl + 1 : end;
+
+				grep_line(o, g, ++n, p, next - p);
+				p = next;
+			}
+		}
+	}
+	if ( g->invert )
+		*selected += lines;
+	*lineno += lines;
+}
+
+/**
+	* Search one input
+	*
+	* @param o output
+	* @param g settings
+	* @param fd input
+	* @param selected receives the number of selected lines
+	* @return true on success
+	*/
+static bool grep_fd(text_out* o, grep_opts* g, int fd, size_t* selected) {
+	size_t lineno = 0;
+	text_in r;
+	ssize_t len;
+	char* block;
+
+	*selected = 0;
+	if ( !in_open(&r, fd) )
+		return false;
+
+	while ( (len = in_lines(&r, &block)) > 0 ) {
+		const char* p = block;
+		const char* end = block + len;
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Jump from match to match - the lines in between are misses
+		////////////////////////////////////////////////////////////////////////////////
+		while ( p < end ) {
+			const char* m = text_find(p, end - p, g->pattern, g->plen);
+			const char* start;
+			const char* stop;
+
+			if ( !m ) {
+				grep_misses(o, g, &lineno, selected, p, end - p);
+				break;
+			}
+			start = memrchr(p, '\n', m - p);
+			start = start ? start + 1 : p;
+			stop = memchr(m, '\n', end - m);
+			stop = stop ? stop + 1 : end;
+
+			grep_misses(o, g, &lineno, selected, p, start - p);
+			lineno++;
+			if ( !g->invert ) {
+				++*selected;
+				if ( g->quiet )
+					break;
+				if ( !g->count )
+					grep_line(o, g, lineno, start, stop - start);
+			}
+			p = stop;
+		}
+		if ( g->quiet && *selected )
+			break;
+	}
+	in_close(&r);
+	return len >= 0;
+}
+
+/**
+	* grep [-Fcnqv] [-e] pattern [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return 0 if a line was selected, 1 if none, 2 on error, or TEXT_UNSUPPORTED
+	*/
+int text_grep(int argc, char** argv, int in, int out, int err) {
+	grep_opts g = { NULL, 0, false, false, false, false, NULL };
+	bool fixed = false, error = false;
+	size_t any = 0;
+	char* stdin_only[] = { "-", NULL };
+	char** files;
+	int i, f, nfiles;
+	text_out* o;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Options
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		char* p;
+
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		for ( p = argv[i] + 1; *p; p++ ) {
+			if ( *p == 'F' )
+				fixed = true;
+			else if ( *p == 'c' )
+				g.count = true;
+			else if ( *p == 'n' )
+				g.number = true;
+			else if ( *p == 'q' )
+				g.quiet = true;
+			else if ( *p == 'v' )
+				g.invert = true;
+			else if ( *p == 'e' && !g.pattern ) {
+				g.pattern = p[1] ? p + 1 : argv[++i];
+				break;
+			}
+			else
+				return TEXT_UNSUPPORTED;
+		}
+		if ( i >= argc )
+			return TEXT_UNSUPPORTED;
+	}
+	if ( !g.pattern ) {
+		if ( i >= argc )
+			return TEXT_UNSUPPORTED;
+		g.pattern = argv[i++];
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Anything that could be a regular expression goes to the real grep
+	////////////////////////////////////////////////////////////////////////////////
+	if ( strchr(g.pattern, '\n') || (!fixed && strpbrk(g.pattern, "\\.[]*^$")) )
+		return TEXT_UNSUPPORTED;
+	g.plen = strlen(g.pattern);
+
+	nfiles = argc - i;
+	files = nfiles ? argv + i : stdin_only;
+	if ( !(o = out_open(out)) )
+		return 2;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Search every input
+	////////////////////////////////////////////////////////////////////////////////
+	for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+		int fd = open_input(files[f], in, err, "grep");
+		size_t selected;
+
+		if ( fd < 0 ) {
+			error = true;
+			continue;
+		}
+		g.prefix = nfiles > 1 ? files[f] : NULL;
+		if ( !grep_fd(o, &g, fd, &selected) ) {
+			dprintf(err, "grep: %s: %s\n", files[f], strerror(errno));
+			error = true;
+		}
+		close_input(fd, in);
+
+		if ( g.count && !g.quiet ) {
+			if ( g.prefix )
+				out_printf(o, "%s:", g.prefix);
+			out_printf(o, "%zu\n", selected);
+		}
+		any += selected;
+		if ( g.quiet && any )
+			break;
+	}
+
+	if ( !out_close(o) )
+		error = true;
+	if ( g.quiet && any )
+		return 0;
+	return error ? 2 : any ? 0 : 1;
+}
+
+/**
+	* Parse the line or byte count of head and tail (-n N, -nN, -N, -c N)
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param i index of the option, advanced past its value
+	* @param n receives the count
+	* @param bytes set for -c
+	* @param from_start set for a +N count (tail)
+	* @return false if the option is not understood
+	*/
+static bool parse_span(int argc, char** argv, int* i, size_t* n, bool* bytes, bool* from_start) {
+	char* opt = argv[*i];
+	char* val;
+
+	if ( opt[1] >= '0' && opt[1] <= '9' )
+		return parse_count(opt + 1, n);
+	if ( (opt[1] != 'n' && opt[1] != 'c') || (opt[1] == 'c' && !bytes) )
+		return false;
+	if ( opt[1] == 'c' )
+		*bytes = true;
+
+	val = opt[2] ? opt + 2 : (*i + 1 < argc ? argv[++*i] : NULL);
+	if ( val && *val == '+' && from_start ) {
+		*from_start = true;
+		val++;
+	}
+	return parse_count(val, n);
+}
+
+/**
+	* Copy the first lines or bytes of one input
+	*
+	* @param o output
+	* @param fd input
+	* @param n number of lines or bytes
+	* @param bytes count bytes instead of lines
+	* @return true on success
+	*/
+static bool head_fd(text_out* o, int fd, size_t n, bool bytes) {
+	text_in r;
+	ssize_t len = 0;
+	char* block;
+
+	if ( !in_open(&r, fd) )
+		return false;
+	while ( n && (len = in_lines(&r, &block)) > 0 ) {
+		size_t take = len;
+
+		if ( bytes ) {
+			if ( take > n )
+				take = n;
+			n -= take;
+		}
+		else {
+			size_t lines = text_count(block, len, '\n');
+
+			if ( lines < n )
+				n -= lines;
+			else {
+				take = skip_lines(block, len, n);
+				n = 0;
+			}
+		}
+		out_write(o, block, take);
+	}
+	in_close(&r);
+	return len >= 0;
+}
+
+/**
+	* head [-n N | -N | -c N] [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int text_head(int argc, char** argv, int in, int out, int err) {
+	size_t n = 10;
+	bool bytes = false;
+	char* stdin_only[] = { "-", NULL };
+	char** files;
+	int i, f, nfiles, status = EXIT_SUCCESS;
+	text_out* o;
+
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		if ( !parse_span(argc, argv, &i, &n, &bytes, NULL) )
+			return TEXT_UNSUPPORTED;
+	}
+
+	nfiles = argc - i;
+	files = nfiles ? argv + i : stdin_only;
+	if ( !(o = out_open(out)) )
+		return EXIT_FAILURE;
+
+	for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+		int fd = open_input(files[f], in, err, "head");
+
+		if ( fd < 0 ) {
+			status = EXIT_FAILURE;
+			continue;
+		}
+		if ( nfiles > 1 )
+			out_printf(o, "%s==> %s <==\n", f ? "\n" : "",
+				strcmp(files[f], "-") ? files[f] : "standard input");
+		if ( !head_fd(o, fd, n, bytes) ) {
+			dprintf(err, "head: %s: %s\n", files[f], strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		close_input(fd, in);
+	}
+	return out_close(o) ? status : EXIT_FAILURE;
+}
+
+/**
+	* Copy the last lines of a seekable input, reading backwards from the end
+	*
+	* @param o output
+	* @param fd input, positioned at the first byte that counts
+	* @param size size of the file
+	* @param n number of lines
+	* @return true on success, false on error or if fd can't be read this way
+	*/
+static bool tail_seekable(text_out* o, int fd, off_t size, size_t n) {
+	off_t base = lseek(fd, 0, SEEK_CUR);
+	off_t pos, start;
+	char* buf;
+	char last;
+
+	if ( base < 0 )
+		return false;
+	if ( base >= size || !n )
+		return true;
+	if ( !(buf = malloc(TEXT_BUF_SIZE)) )
+		return false;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Walk back a block at a time, counting newlines until n lines are found
+	////////////////////////////////////////////////////////////////////////////////
+	if ( pread(fd, &last, 1, size - 1) != 1 )
+		goto fail;
+	pos = size - (last == '\n');
+	start = base;
+	while ( pos > base ) {
+		size_t chunk = pos - base < TEXT_BUF_SIZE ? pos - base : TEXT_BUF_SIZE;
+		size_t lines;
+
+		if ( pread(fd, buf, chunk, pos - chunk) != (ssize_t) chunk )
+			goto fail;
+		lines = text_count(buf, chunk, '\n');
+		if ( lines >= n ) {
+			const char* nl = buf + chunk;
+
+			while ( n-- )
+				nl = memrchr(buf, '\n', nl - buf);
+			start = pos - chunk + (nl - buf) + 1;
+			break;
+		}
+		n -= lines;
+		pos -= chunk;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Copy from there to the end
+	////////////////////////////////////////////////////////////////////////////////
+	while ( start < size ) {
+		size_t chunk = size - start < TEXT_BUF_SIZE ? size - start : TEXT_BUF_SIZE;
+		ssize_t got = pread(fd, buf, chunk, start);
+
+		if ( got <= 0 )
+			goto fail;
+		out_write(o, buf, got);
+		start += got;
+	}
+	free(buf);
+	return true;
+
+fail:
+	free(buf);
+	return false;
+}
+
+/**
+	* Copy the last lines of a stream, keeping only what could still be
+	* part of them
+	*
+	* @param o output
+	* @param fd input
+	* @param n number of lines
+	* @return true on success
+	*/
+static bool tail_stream(text_out* o, int fd, size_t n) {
+	size_t cap = 2 * TEXT_BUF_SIZE, len = 0, keep;
+	char* buf = malloc(cap);
+
+	if ( !buf )
+		return false;
+	for ( ;; ) {
+		ssize_t got;
+
+		if ( len == cap ) {
+			////////////////////////////////////////////////////////////////////////////////
+			// Full - drop everything before the last n lines, or grow if the
+			// last n lines are all there is
+			////////////////////////////////////////////////////////////////////////////////
+			if ( (keep = last_lines(buf, len, n)) ) {
+				memmove(buf, buf + keep, len - keep);
+				len -= keep;
+			}
+			else {
+				char* grown = realloc(buf, cap * 2);
+
+				if ( !grown ) {
+					free(buf);
+					return false;
+				}
+				buf = grown;
+				cap *= 2;
+			}
+		}
+		got = read(fd, buf + len, cap - len);
+		if ( got < 0 && errno == EINTR )
+			continue;
+		if ( got < 0 ) {
+			free(buf);
+			return false;
+		}
+		if ( got == 0 )
+			break;
+		len += got;
+	}
+
+	keep = last_lines(buf, len, n);
+	out_write(o, buf + keep, len - keep);
+	free(buf);
+	return true;
+}
+
+/**
+	* Copy one input from a line on (tail -n +N)
+	*
+	* @param o output
+	* @param fd input
+	* @param skip number of lines to leave out
+	* @return true on success
+	*/
+static bool tail_from(text_out* o, int fd, size_t skip) {
+	text_in r;
+	ssize_t len;
+	char* block;
+
+	if ( !in_open(&r, fd) )
+		return false;
+	while ( (len = in_lines(&r, &block)) > 0 ) {
+		size_t off = 0;
+
+		if ( skip ) {
+			size_t lines = text_count(block, len, '\n');
+
+			if ( lines < skip ) {
+				skip -= lines;
+				continue;
+			}
+			off = skip_lines(block, len, skip);
+			skip = 0;
+		}
+		out_write(o, block + off, len - off);
+	}
+	in_close(&r);
+	return len == 0;
+}
+
+/**
+	* tail [-n N | -n +N | -N] [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int text_tail(int argc, char** argv, int in, int out, int err) {
+	size_t n = 10;
+	bool from_start = false;
+	char* stdin_only[] = { "-", NULL };
+	char** files;
+	int i, f, nfiles, status = EXIT_SUCCESS;
+	text_out* o;
+
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		if ( !parse_span(argc, argv, &i, &n, NULL, &from_start) )
+			return TEXT_UNSUPPORTED;
+	}
+
+	nfiles = argc - i;
+	files = nfiles ? argv + i : stdin_only;
+	if ( !(o = out_open(out)) )
+		return EXIT_FAILURE;
+
+	for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+		int fd = open_input(files[f], in, err, "tail");
+		struct stat st;
+		bool ok;
+
+		if ( fd < 0 ) {
+			status = EXIT_FAILURE;
+			continue;
+		}
+		if ( nfiles > 1 )
+			out_printf(o, "%s==> %s <==\n", f ? "\n" : "",
+				strcmp(files[f], "-") ? files[f] : "standard input");
+
+		if ( from_start )
+			ok = tail_from(o, fd, n ? n - 1 : 0);
+		else if ( !fstat(fd, &st) && S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) >= 0 )
+			ok = tail_seekable(o, fd, st.st_size, n);
+		else
+			ok = tail_stream(o, fd, n);
+		if ( !ok ) {
+			dprintf(err, "tail: %s: %s\n", files[f], strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		close_input(fd, in);
+	}
+	return out_close(o) ? status : EXIT_FAILURE;
+}
+
+/**
+	* Order ranges by their first position
+	*/
+static int cmp_range(const void* a, const void* b) {
+	const text_range* x = a;
+	const text_range* y = b;
+	return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+/**
+	* Parse a cut list (N, N-M, N-, -M, separated by commas) into sorted,
+	* non-overlapping ranges
+	*
+	* @param list list text
+	* @param ranges receives the ranges
+	* @param num receives the number of ranges
+	* @return false if the list is malformed
+	*/
+static bool parse_list(const char* list, text_range* ranges, size_t* num) {
+	const char* p = list;
+	size_t i, n = 0;
+
+	while ( *p ) {
+		text_range r = { 1, SIZE_MAX };
+		bool open_lo = *p == '-';
+		char* end;
+
+		if ( n == TEXT_MAX_RANGES )
+			return false;
+		if ( *p != '-' ) {
+			if ( *p < '0' || *p > '9' || !(r.lo = strtoull(p, &end, 10)) )
+				return false;
+			p = end;
+			r.hi = r.lo;
+		}
+		if ( *p == '-' ) {
+			p++;
+			r.hi = SIZE_MAX;
+			if ( *p >= '0' && *p <= '9' ) {
+				r.hi = strtoull(p, &end, 10);
+				p = end;
+			}
+			else if ( open_lo )
+				return false;		// a lone "-"
+		}
+		if ( r.hi < r.lo || (*p && *p != ',') )
+			return false;
+		ranges[n++] = r;
+		if ( *p == ',' )
+			p++;
+	}
+	if ( !n )
+		return false;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Sort and merge overlapping or adjacent ranges
+	////////////////////////////////////////////////////////////////////////////////
+	qsort(ranges, n, sizeof(text_range), cmp_range);
+	*num = 1;
+	for ( i = 1; i < n; i++ ) {
+		text_range* last = &ranges[*num - 1];
+
+		if ( last->hi == SIZE_MAX || ranges[i].lo <= last->hi + 1 ) {
+			if ( ranges[i].hi > last->hi )
+				last->hi = ranges[i].hi;
+		}
+		else
+			ranges[(*num)++] = ranges[i];
+	}
+	return true;
+}
+
+/**
+	* cut settings
+	*/
+typedef struct cut_opts {
+	text_range ranges[TEXT_MAX_RANGES];		///< selected positions
+	size_t num;								///< number of ranges
+	bool fields;							///< -f: positions are fields
+	char delim;								///< field delimiter
+	bool only_delimited;					///< -s: skip lines without a delimiter
+} cut_opts;
+
+/**
+	* Cut one line
+	*
+	* @param o output
+	* @param c settings
+	* @param line line without its newline
+	* @param len length of line
+	*/
+static void cut_line(text_out* o, cut_opts* c, const char* line, size_t len) {
+	size_t i;
+
+	if ( !c->fields ) {
+		for ( i = 0; i < c->num && c->ranges[i].lo <= len; i++ ) {
+			size_t hi = c->ranges[i].hi < len ? c->ranges[i].hi : len;
+			out_write(o, line + c->ranges[i].lo - 1, hi - c->ranges[i].lo + 1);
+		}
+	}
+	else if ( !memchr(line, c->delim, len) ) {
+		if ( c->only_delimited )
+			return;
+		out_write(o, line, len);
+	}
+	else {
+		size_t field = 1, pos = 0;
+		bool first = true;
+
+		i = 0;
+		for ( ;; ) {
+			const char* d = memchr(line + pos, c->delim, len - pos);
+			size_t stop = d ? (size_t) (d - line) : len;
+
+			while ( i < c->num && c->ranges[i].hi < field )
+				i++;
+			if ( i == c->num )
+				break;
+			if ( field >= c->ranges[i].lo ) {
+				if ( !first )
+					out_write(o, &c->delim, 1);
+				out_write(o, line + pos, stop - pos);
+				first = false;
+			}
+			if ( !d )
+				break;
+			pos = stop + 1;
+			field++;
+		}
+	}
+	out_write(o, "\n", 1);
+}
+
+/**
+	* cut -b LIST | -c LIST | -f LIST [-d C] [-s] [file...]
+	*
+	* @param argc number of arguments
+	* @param argv arguments
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+int text_cut(int argc, char** argv, int in, int out, int err) {
+	cut_opts c = { .num = 0, .fields = false, .delim = '\t', .only_delimited = false };
+	const char* list = NULL;
+	bool delim_given = false;
+	char* stdin_only[] = { "-", NULL };
+	char** files;
+	int i, f, nfiles, status = EXIT_SUCCESS;
+	text_out* o;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Options
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++ ) {
+		char opt = argv[i][1];
+		char* val;
+
+		if ( !strcmp(argv[i], "--") ) {
+			i++;
+			break;
+		}
+		if ( opt == 's' && !argv[i][2] ) {
+			c.only_delimited = true;
+			continue;
+		}
+		if ( (opt != 'b' && opt != 'c' && opt != 'f' && opt != 'd')
+			|| !(val = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL)) )
+			return TEXT_UNSUPPORTED;
+
+		if ( opt == 'd' ) {
+			if ( strlen(val) != 1 )
+				return TEXT_UNSUPPORTED;
+			c.delim = val[0];
+			delim_given = true;
+		}
+		else {
+			if ( list )
+				return TEXT_UNSUPPORTED;
+			list = val;
+			c.fields = opt == 'f';
+		}
+	}
+	if ( !list || ((delim_given || c.only_delimited) && !c.fields)
+		|| !parse_list(list, c.ranges, &c.num) )
+		return TEXT_UNSUPPORTED;
+
+	nfiles = argc - i;
+	files = nfiles ? argv + i : stdin_only;
+	if ( !(o = out_open(out)) )
+		return EXIT_FAILURE;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Cut every line of every input
+	////////////////////////////////////////////////////////////////////////////////
+	for ( f = 0; f < (nfiles ? nfiles : 1); f++ ) {
+		int fd = open_input(files[f], in, err, "cut");
+		text_in r;
+		ssize_t len = -1;
+		char* block;
+
+		if ( fd < 0 ) {
+			status = EXIT_FAILURE;
+			continue;
+		}
+		if ( in_open(&r, fd) ) {
+			while ( (len = in_lines(&r, &block)) > 0 ) {
+				const char* p = block;
+				const char* end = block + len;
+
+				while ( p < end ) {
+					const char* nl = memchr(p, '\n', end - p);
+					const char* stop = nl ? nl : end;
+
+					cut_line(o, &c, p, stop - p);
+					p = stop + 1;
+				}
+			}
+			in_close(&r);
+		}
+		if ( len < 0 ) {
+			dprintf(err, "cut: %s: %s\n", files[f], strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		close_input(fd, in);
+	}
+	return out_close(o) ? status : EXIT_FAILURE;
+}
@@ -0,0 +1,127 @@
+/**
+	* @file textutil.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* In-process text utilities (wc, grep -F, head, tail and cut) built on
+	* vectorized kernels. Newline counting and substring search use AVX2 or
+	* SSE2 when the CPU has them and a scalar fallback otherwise. Input is
+	* read in large blocks and processed a block of whole lines at a time.
+	*/
+
+#ifndef TEXTUTIL_H
+#define TEXTUTIL_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+
+/**
+	* Specify the size of an input block in bytes
+	*/
+#define TEXT_BUF_SIZE (1 << 20)
+
+/**
+	* Specify the size of the output buffer in bytes
+	*/
+#define TEXT_OUT_SIZE (1 << 16)
+
+/**
+	* Specify the maximum number of ranges in a cut list
+	*/
+#define TEXT_MAX_RANGES (64)
+
+/**
+	* Returned by a utility that was given an option it does not implement,
+	* so the caller can run the real program instead
+	*/
+#define TEXT_UNSUPPORTED (-1)
+
+/**
+	* Kernel sets, best last
+	*/
+typedef enum text_simd {
+	TEXT_SCALAR,							///< portable C
+	TEXT_SSE2,								///< 16 bytes per step
+	TEXT_AVX2								///< 32 bytes per step
+} text_simd;
+
+/**
+	* Signature shared by the utilities
+	*
+	* @param argc number of arguments
+	* @param argv arguments, argv[0] is the utility's name
+	* @param in descriptor standing for standard input
+	* @param out descriptor to write results to
+	* @param err descriptor to write diagnostics to
+	* @return exit status, or TEXT_UNSUPPORTED
+	*/
+typedef int (*text_fn)(int argc, char** argv, int in, int out, int err);
+
+/**
+	* Pick the kernels: the best the CPU supports, or the set named by
+	* QUASH_SIMD (avx2, sse2 or scalar)
+	*/
+void text_init();
+
+/**
+	* Kernel set in use
+	*
+	* @return kernel set
+	*/
+text_simd text_get_simd();
+
+/**
+	* Count the occurrences of a byte
+	*
+	* @param buf bytes to search
+	* @param len number of bytes
+	* @param c byte to count
+	* @return number of occurrences
+	*/
+size_t text_count(const char* buf, size_t len, char c);
+
+/**
+	* Find the first occurrence of a string
+	*
+	* @param hay bytes to search
+	* @param len number of bytes
+	* @param needle string to find
+	* @param nlen length of needle
+	* @return start of the first occurrence, or NULL if there is none
+	*/
+const char* text_find(const char* hay, size_t len, const char* needle, size_t nlen);
+
+/**
+	* wc [-lwc] [file...]
+	*/
+int text_wc(int argc, char** argv, int in, int out, int err);
+
+/**
+	* grep [-Fcnqv] [-e] pattern [file...] - fixed strings only. A pattern
+	* without regular expression characters is matched as a fixed string.
+	*/
+int text_grep(int argc, char** argv, int in, int out, int err);
+
+/**
+	* head [-n N | -N | -c N] [file...]
+	*/
+int text_head(int argc, char** argv, int in, int out, int err);
+
+/**
+	* tail [-n N | -n +N | -N] [file...]
+	*/
+int text_tail(int argc, char** argv, int in, int out, int err);
+
+/**
+	* cut -b LIST | -c LIST | -f LIST [-d C] [-s] [file...]
+	*/
+int text_cut(int argc, char** argv, int in, int out, int err);
+
+#endif // TEXTUTIL_H
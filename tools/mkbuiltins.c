@@ -0,0 +1,150 @@
+/**
+ * @file mkbuiltins.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Build time generator for the builtin registry. Searches for a hash seed
+ * that gives every builtin in builtins.def its own table slot and prints
+ * the resulting table (builtin_table.h) on stdout.
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin_hash.h"
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Specify how many seeds are tried per table size before doubling it
+	*/
+#define MAX_SEEDS (1u << 20)
+
+/**
+	* Specify the largest table worth generating
+	*/
+#define MAX_TABLE_SIZE (1u << 16)
+
+/**
+	* The builtins as listed in builtins.def
+	*/
+static const struct {
+	const char* name;
+	const char* fn;
+} builtins[] = {
+#define BUILTIN(name, fn) { name, #fn },
+#include "builtins.def"
+#undef BUILTIN
+};
+
+/**
+	* Specify the number of builtins
+	*/
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Check whether a seed gives every builtin its own slot
+	*
+	* @param seed seed to try
+	* @param size table size (power of two)
+	* @param owner scratch array of size entries, filled with the builtin
+	*              index owning each slot (-1 for empty)
+	* @return true if no two builtins share a slot
+	*/
+static bool try_seed(uint32_t seed, uint32_t size, int* owner) {
+	size_t i;
+
+	memset(owner, -1, size * sizeof(int));
+	for ( i = 0; i < NUM_BUILTINS; i++ ) {
+		uint32_t slot = builtin_hash(builtins[i].name, seed) & (size - 1);
+
+		if ( owner[slot] >= 0 )
+			return false;
+		owner[slot] = i;
+	}
+	return true;
+}
+
+/**
+	* Print the generated header
+	*
+	* @param seed seed found
+	* @param size table size
+	* @param owner builtin index owning each slot
+	*/
+static void emit(uint32_t seed, uint32_t size, const int* owner) {
+	uint32_t slot;
+
+	printf("/**\n\t* @file builtin_table.h\n\t*\n");
+	printf("\t* Generated by tools/mkbuiltins from builtins.def - do not edit\n\t*/\n\n");
+	printf("/**\n\t* Specify the seed giving every builtin its own slot\n\t*/\n");
+	printf("#define BUILTIN_HASH_SEED (0x%08xu)\n\n", seed);
+	printf("/**\n\t* Specify the number of registry slots (power of two)\n\t*/\n");
+	printf("#define BUILTIN_TABLE_SIZE (%u)\n\n", size);
+	printf("/**\n\t* Builtins by builtin_hash(name, BUILTIN_HASH_SEED) & (BUILTIN_TABLE_SIZE - 1)\n\t*/\n");
+	printf("static const builtin_entry builtin_table[BUILTIN_TABLE_SIZE] = {\n");
+	for ( slot = 0; slot < size; slot++ ) {
+		if ( owner[slot] >= 0 )
+			printf("\t[%u] = { \"%s\", %s },\n", slot, builtins[owner[slot]].name,
+				builtins[owner[slot]].fn);
+	}
+	printf("};\n");
+}
+
+/**************************************************************************
+ * MAIN
+ **************************************************************************/
+
+/**
+	* Generator entry point
+	*
+	* @return EXIT_SUCCESS once the table has been printed
+	*/
+int main() {
+	uint32_t size = 1, seed;
+	size_t i, j;
+	int* owner;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A duplicate name could never be given its own slot
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 0; i < NUM_BUILTINS; i++ ) {
+		for ( j = i + 1; j < NUM_BUILTINS; j++ ) {
+			if ( !strcmp(builtins[i].name, builtins[j].name) ) {
+				fprintf(stderr, "mkbuiltins: builtin \"%s\" listed twice\n", builtins[i].name);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Smallest table first, doubling it whenever no seed fits
+	////////////////////////////////////////////////////////////////////////////////
+	while ( size < NUM_BUILTINS )
+		size *= 2;
+	for ( ; size <= MAX_TABLE_SIZE; size *= 2 ) {
+		if ( !(owner = malloc(size * sizeof(int))) )
+			return EXIT_FAILURE;
+		for ( seed = 0; seed < MAX_SEEDS; seed++ ) {
+			if ( try_seed(seed, size, owner) ) {
+				emit(seed, size, owner);
+				free(owner);
+				return EXIT_SUCCESS;
+			}
+		}
+		free(owner);
+	}
+
+	fprintf(stderr, "mkbuiltins: no perfect hash found\n");
+	return EXIT_FAILURE;
+}
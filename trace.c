@@ -0,0 +1,257 @@
+/**
+ * @file trace.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Hot-path tracing spans and latency histograms
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "trace.h"
+#include "fdreg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**************************************************************************
+ * Public Variables
+ **************************************************************************/
+/**
+	* Whether spans are being recorded
+	*/
+bool trace_on = false;
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Per-phase histograms
+	*/
+static trace_hist hists[TRACE_NUM_PHASES];
+
+/**
+	* Phase names, as shown by the stats builtin and in the trace file
+	*/
+static const char* phase_names[TRACE_NUM_PHASES] = {
+	"read", "dispatch", "builtin", "spawn", "wait", "command"
+};
+
+/**
+	* Chrome trace output, NULL if not requested
+	*/
+static FILE* trace_file = NULL;
+
+/**
+	* Process the trace file belongs to
+	*/
+static pid_t trace_pid = 0;
+
+/**
+	* Whether an event has been written (events are comma separated)
+	*/
+static bool trace_written = false;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Histogram bucket of a value: exact below 2^TRACE_SUB_BITS, then
+	* 2^TRACE_SUB_BITS linear sub-buckets per power of two
+	*
+	* @param v value
+	* @return bucket index
+	*/
+static int trace_bucket(uint64_t v) {
+	int e;
+
+	if ( v < (1 << TRACE_SUB_BITS) )
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return ((e - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS)
+		+ ((v >> (e - TRACE_SUB_BITS)) & ((1 << TRACE_SUB_BITS) - 1));
+}
+
+/**
+	* Largest value that lands in a bucket
+	*
+	* @param b bucket index
+	* @return upper bound of the bucket
+	*/
+static uint64_t trace_bucket_top(int b) {
+	int e, sub;
+
+	if ( b < (1 << TRACE_SUB_BITS) )
+		return b;
+	e = (b >> TRACE_SUB_BITS) + TRACE_SUB_BITS - 1;
+	sub = b & ((1 << TRACE_SUB_BITS) - 1);
+	return (((uint64_t) (1 << TRACE_SUB_BITS) + sub + 1) << (e - TRACE_SUB_BITS)) - 1;
+}
+
+/**
+	* Value at a percentile of a histogram
+	*
+	* @param h histogram
+	* @param p percentile (0-100)
+	* @return bucket upper bound at that rank, capped at the maximum
+	*/
+static uint64_t trace_percentile(trace_hist* h, double p) {
+	uint64_t rank = (uint64_t) (p / 100.0 * h->count + 0.5), seen = 0;
+	int b;
+
+	if ( rank < 1 )
+		rank = 1;
+	for ( b = 0; b < TRACE_BUCKETS; b++ ) {
+		seen += h->buckets[b];
+		if ( seen >= rank )
+			return trace_bucket_top(b) < h->max ? trace_bucket_top(b) : h->max;
+	}
+	return h->max;
+}
+
+/**
+	* Write a JSON string body, escaping quotes, backslashes and controls
+	*
+	* @param s string
+	*/
+static void trace_json_str(const char* s) {
+	for ( ; *s; s++ ) {
+		if ( *s == '"' || *s == '\\' )
+			fprintf(trace_file, "\\%c", *s);
+		else if ( (unsigned char) *s < 0x20 )
+			fprintf(trace_file, "\\u%04x", *s);
+		else
+			fputc(*s, trace_file);
+	}
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Monotonic clock in nanoseconds
+	*
+	* @return current time
+	*/
+uint64_t trace_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+	* Finish a span: add it to its phase histogram and the trace file
+	*
+	* @param phase phase the span belongs to
+	* @param start trace_now() at the start of the span
+	* @param name command the span belongs to, may be NULL
+	*/
+void trace_record(trace_phase phase, uint64_t start, const char* name) {
+	uint64_t end = trace_now(), dur = end - start;
+	trace_hist* h = &hists[phase];
+
+	h->count++;
+	h->buckets[trace_bucket(dur)]++;
+	if ( dur > h->max )
+		h->max = dur;
+
+	if ( !trace_file )
+		return;
+	fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"quash\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+		"\"pid\":%d,\"tid\":%d", trace_written ? "," : "", phase_names[phase],
+		start / 1e3, dur / 1e3, trace_pid, trace_pid);
+	if ( name ) {
+		fputs(",\"args\":{\"cmd\":\"", trace_file);
+		trace_json_str(name);
+		fputs("\"}", trace_file);
+	}
+	fputc('}', trace_file);
+	trace_written = true;
+}
+
+/**
+	* Turn tracing on from $QUASH_STATS / $QUASH_TRACE. $QUASH_TRACE names
+	* the file the Chrome trace JSON is written to.
+	*/
+void trace_init() {
+	const char* path = getenv("QUASH_TRACE");
+	const char* stats = getenv("QUASH_STATS");
+
+	if ( stats && *stats )
+		trace_enable(true);
+	if ( !path || !*path )
+		return;
+
+	if ( !(trace_file = fopen(path, "we")) ) {
+		fprintf(stderr, "quash: cannot open trace file %s\n", path);
+		return;
+	}
+	fdreg_track(fileno(trace_file), FD_SHELL, 0, "trace file");
+	trace_pid = getpid();
+	fputc('[', trace_file);
+	atexit(trace_close);
+	trace_enable(true);
+}
+
+/**
+	* Turn span recording on or off
+	*
+	* @param on true to record spans
+	*/
+void trace_enable(bool on) {
+	trace_on = on;
+}
+
+/**
+	* Clear every phase histogram
+	*/
+void trace_reset() {
+	memset(hists, 0, sizeof(hists));
+}
+
+/**
+	* Print count, p50, p99 and max of every phase
+	*
+	* @param out stream
+	*/
+void trace_print(FILE* out) {
+	int i;
+
+	fprintf(out, "%-10s %10s %12s %12s %12s\n", "phase", "count", "p50(us)", "p99(us)", "max(us)");
+	for ( i = 0; i < TRACE_NUM_PHASES; i++ ) {
+		trace_hist* h = &hists[i];
+
+		if ( !h->count ) {
+			fprintf(out, "%-10s %10d %12s %12s %12s\n", phase_names[i], 0, "-", "-", "-");
+			continue;
+		}
+		fprintf(out, "%-10s %10lu %12.1f %12.1f %12.1f\n", phase_names[i], (unsigned long) h->count,
+			trace_percentile(h, 50) / 1e3, trace_percentile(h, 99) / 1e3, h->max / 1e3);
+	}
+}
+
+/**
+	* Stop writing the trace file in a forked child, which must not write the
+	* parent's buffered events a second time
+	*/
+void trace_child() {
+	trace_file = NULL;		// the stdio buffer is the parent's - never flush it here
+}
+
+/**
+	* Finish and close the trace file
+	*/
+void trace_close() {
+	if ( !trace_file || getpid() != trace_pid )
+		return;
+	fputs("\n]\n", trace_file);
+	fdreg_forget(fileno(trace_file));
+	fclose(trace_file);
+	trace_file = NULL;
+}
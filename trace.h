@@ -0,0 +1,136 @@
+/**
+	* @file trace.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Hot-path tracing. Each phase of running a command (reading it,
+	* dispatching it, spawning, waiting, builtins) is timed with the
+	* monotonic clock into a per-phase log-linear latency histogram, and
+	* optionally written out as Chrome trace / Perfetto JSON spans.
+	*
+	* Tracing is off unless $QUASH_STATS or $QUASH_TRACE is set (or the stats
+	* builtin turns it on); while off every span costs a single branch.
+	* Building with -DQUASH_NO_TRACE removes the spans altogether.
+	*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+	* Specify the number of sub-buckets per power of two, as a bit count.
+	* Two bits bound the error of a reported percentile to 25%.
+	*/
+#define TRACE_SUB_BITS (2)
+
+/**
+	* Specify the number of histogram buckets (covers every 64 bit value)
+	*/
+#define TRACE_BUCKETS (64 << TRACE_SUB_BITS)
+
+/**
+	* Phases a command goes through
+	*/
+typedef enum trace_phase {
+	TRACE_READ,								///< get_command: read and tokenize a line
+	TRACE_DISPATCH,							///< operator scan and builtin lookup
+	TRACE_BUILTIN,							///< builtin run inside the shell
+	TRACE_SPAWN,							///< launch of a child (fork/posix_spawn + exec)
+	TRACE_WAIT,								///< waiting for a foreground child
+	TRACE_COMMAND,							///< whole command, dispatch to completion
+	TRACE_NUM_PHASES
+} trace_phase;
+
+/**
+	* Latency histogram of a phase, in nanoseconds
+	*/
+typedef struct trace_hist {
+	uint64_t count;							///< number of spans
+	uint64_t max;							///< longest span
+	uint32_t buckets[TRACE_BUCKETS];		///< log-linear span counts
+} trace_hist;
+
+/**
+	* Whether spans are being recorded. Only ever tested through TRACE_BEGIN.
+	*/
+extern bool trace_on;
+
+/**
+	* Monotonic clock in nanoseconds
+	*
+	* @return current time
+	*/
+uint64_t trace_now();
+
+/**
+	* Finish a span: add it to its phase histogram and the trace file
+	*
+	* @param phase phase the span belongs to
+	* @param start trace_now() at the start of the span
+	* @param name command the span belongs to, may be NULL
+	*/
+void trace_record(trace_phase phase, uint64_t start, const char* name);
+
+#ifndef QUASH_NO_TRACE
+/**
+	* Start a span named t (0 while tracing is off)
+	*/
+#define TRACE_BEGIN(t) uint64_t t = trace_on ? trace_now() : 0
+
+/**
+	* Finish the span t started with TRACE_BEGIN
+	*/
+#define TRACE_END(phase, t, name) do { if ( t ) trace_record(phase, t, name); } while ( 0 )
+#else
+#define TRACE_BEGIN(t) const uint64_t t = 0
+#define TRACE_END(phase, t, name) ((void) (t))
+#endif
+
+/**
+	* Turn tracing on from $QUASH_STATS / $QUASH_TRACE. $QUASH_TRACE names
+	* the file the Chrome trace JSON is written to.
+	*/
+void trace_init();
+
+/**
+	* Turn span recording on or off
+	*
+	* @param on true to record spans
+	*/
+void trace_enable(bool on);
+
+/**
+	* Clear every phase histogram
+	*/
+void trace_reset();
+
+/**
+	* Print count, p50, p99 and max of every phase
+	*
+	* @param out stream
+	*/
+void trace_print(FILE* out);
+
+/**
+	* Stop writing the trace file in a forked child, which must not write the
+	* parent's buffered events a second time
+	*/
+void trace_child();
+
+/**
+	* Finish and close the trace file
+	*/
+void trace_close();
+
+#endif // TRACE_H
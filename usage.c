@@ -0,0 +1,172 @@
+/**
+ * @file usage.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Per-command resource accounting
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "usage.h"
+
+#include <string.h>
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Resources used by every command of the session
+	*/
+static usage session = { 0 };
+
+/**
+	* Number of commands accounted to the session
+	*/
+static unsigned long session_cmds = 0;
+
+/**
+	* Most expensive commands by CPU time, most expensive first
+	*/
+static struct {
+	char name[USAGE_NAME_LEN];
+	usage u;
+} top[USAGE_TOP_N];
+
+/**
+	* Number of valid entries in top
+	*/
+static int num_top = 0;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Milliseconds in a timeval
+	*
+	* @param tv time
+	* @return milliseconds
+	*/
+static double tv_ms(const struct timeval* tv) {
+	return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+/**
+	* CPU time of a usage record, used to rank commands
+	*
+	* @param u usage record
+	* @return user + system milliseconds
+	*/
+static double usage_cpu(const usage* u) {
+	return u->user_ms + u->sys_ms;
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Fill in a usage record from a child's rusage
+	*
+	* @param u usage record
+	* @param ru rusage returned by wait4
+	* @param start CLOCK_MONOTONIC time the command was started
+	* @param end CLOCK_MONOTONIC time it was seen to exit, NULL for now
+	*/
+void usage_from_rusage(usage* u, const struct rusage* ru, const struct timespec* start,
+	const struct timespec* end) {
+	struct timespec now;
+
+	if ( end )
+		now = *end;
+	else
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	u->wall_ms = (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+	u->user_ms = tv_ms(&ru->ru_utime);
+	u->sys_ms = tv_ms(&ru->ru_stime);
+	u->maxrss_kb = ru->ru_maxrss;
+	u->nvcsw = ru->ru_nvcsw;
+	u->nivcsw = ru->ru_nivcsw;
+	u->minflt = ru->ru_minflt;
+	u->majflt = ru->ru_majflt;
+}
+
+/**
+	* Add one usage record to a running total. Peak RSS is the maximum.
+	*
+	* @param total running total
+	* @param u usage to add
+	*/
+void usage_add(usage* total, const usage* u) {
+	total->wall_ms += u->wall_ms;
+	total->user_ms += u->user_ms;
+	total->sys_ms += u->sys_ms;
+	if ( u->maxrss_kb > total->maxrss_kb )
+		total->maxrss_kb = u->maxrss_kb;
+	total->nvcsw += u->nvcsw;
+	total->nivcsw += u->nivcsw;
+	total->minflt += u->minflt;
+	total->majflt += u->majflt;
+}
+
+/**
+	* Print a usage record on a single line (no newline)
+	*
+	* @param out stream
+	* @param u usage record
+	*/
+void usage_print(FILE* out, const usage* u) {
+	fprintf(out, "real %.3fs user %.3fs sys %.3fs maxrss %ldKB ctxsw %ld/%ld faults %ld/%ld",
+		u->wall_ms / 1e3, u->user_ms / 1e3, u->sys_ms / 1e3, u->maxrss_kb,
+		u->nvcsw, u->nivcsw, u->minflt, u->majflt);
+}
+
+/**
+	* Account a finished command to the session
+	*
+	* @param name command name
+	* @param u resources it used
+	*/
+void usage_record(const char* name, const usage* u) {
+	int i;
+
+	usage_add(&session, u);
+	session_cmds++;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Insertion into the (tiny) ranked list of most expensive commands
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = num_top; i > 0 && usage_cpu(&top[i - 1].u) < usage_cpu(u); i-- ) {
+		if ( i < USAGE_TOP_N )
+			top[i] = top[i - 1];
+	}
+	if ( i == USAGE_TOP_N )
+		return;
+
+	strncpy(top[i].name, name, USAGE_NAME_LEN - 1);
+	top[i].name[USAGE_NAME_LEN - 1] = '\0';
+	top[i].u = *u;
+	if ( num_top < USAGE_TOP_N )
+		num_top++;
+}
+
+/**
+	* Print the session totals and the most expensive commands
+	*
+	* @param out stream
+	*/
+void usage_summary(FILE* out) {
+	int i;
+
+	fprintf(out, "quash: %lu commands: ", session_cmds);
+	usage_print(out, &session);
+	fputc('\n', out);
+
+	for ( i = 0; i < num_top; i++ ) {
+		fprintf(out, "quash:   %-16s ", top[i].name);
+		usage_print(out, &top[i].u);
+		fputc('\n', out);
+	}
+}
@@ -0,0 +1,92 @@
+/**
+	* @file usage.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Per-command resource accounting. Every child quash waits for is
+	* collected with its rusage; the figures are kept per job, summed per
+	* session and the most expensive commands are remembered for a summary.
+	*/
+
+#ifndef USAGE_H
+#define USAGE_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/**
+	* Specify how many of the most expensive commands the session remembers
+	*/
+#define USAGE_TOP_N (5)
+
+/**
+	* Specify the longest command name kept in the session summary
+	*/
+#define USAGE_NAME_LEN (64)
+
+/**
+	* Resources consumed by a command
+	*/
+typedef struct usage {
+	double wall_ms;							///< elapsed wall time
+	double user_ms;							///< user CPU time
+	double sys_ms;							///< system CPU time
+	long maxrss_kb;							///< peak resident set size
+	long nvcsw;								///< voluntary context switches
+	long nivcsw;							///< involuntary context switches
+	long minflt;							///< minor page faults
+	long majflt;							///< major page faults
+} usage;
+
+/**
+	* Fill in a usage record from a child's rusage
+	*
+	* @param u usage record
+	* @param ru rusage returned by wait4
+	* @param start CLOCK_MONOTONIC time the command was started
+	* @param end CLOCK_MONOTONIC time it was seen to exit, NULL for now
+	*/
+void usage_from_rusage(usage* u, const struct rusage* ru, const struct timespec* start,
+	const struct timespec* end);
+
+/**
+	* Add one usage record to a running total. Peak RSS is the maximum.
+	*
+	* @param total running total
+	* @param u usage to add
+	*/
+void usage_add(usage* total, const usage* u);
+
+/**
+	* Print a usage record on a single line (no newline)
+	*
+	* @param out stream
+	* @param u usage record
+	*/
+void usage_print(FILE* out, const usage* u);
+
+/**
+	* Account a finished command to the session
+	*
+	* @param name command name
+	* @param u resources it used
+	*/
+void usage_record(const char* name, const usage* u);
+
+/**
+	* Print the session totals and the most expensive commands
+	*
+	* @param out stream
+	*/
+void usage_summary(FILE* out);
+
+#endif // USAGE_H
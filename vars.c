@@ -0,0 +1,367 @@
+/**
+ * @file vars.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Shell variable store and the cached environment of launched commands
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "vars.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**************************************************************************
+ * Private Types and Variables
+ **************************************************************************/
+/**
+	* One variable
+	*/
+typedef struct var_entry {
+	char* str;								///< "NAME=VALUE" (NULL marks an empty slot)
+	size_t name_len;						///< length of NAME
+	bool exported;							///< passed to launched commands
+} var_entry;
+
+/**
+	* Open addressing table of variables
+	*/
+static var_entry* table = NULL;
+
+/**
+	* Number of slots in the table (always a power of two)
+	*/
+static size_t table_size = 0;
+
+/**
+	* Number of used slots in the table
+	*/
+static size_t table_used = 0;
+
+/**
+	* Exported variables packed for execve: the pointer array followed by
+	* the strings it points to
+	*/
+static char** env_block = NULL;
+
+/**
+	* An exported variable changed since env_block was built
+	*/
+static bool env_stale = true;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* FNV-1a hash of a name that need not be NUL terminated
+	*
+	* @param name start of the name
+	* @param len length of the name
+	* @return hash value
+	*/
+static uint32_t vars_hash(const char* name, size_t len) {
+	uint32_t h = 2166136261u;
+
+	while ( len-- ) {
+		h ^= (unsigned char) *name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+	* Find the slot holding a name, or the empty slot ending its probe run
+	*
+	* @param name start of the name
+	* @param len length of the name
+	* @return index into table
+	*/
+static size_t vars_slot(const char* name, size_t len) {
+	size_t i = vars_hash(name, len) & (table_size - 1);
+
+	while ( table[i].str && (table[i].name_len != len || memcmp(table[i].str, name, len)) )
+		i = (i + 1) & (table_size - 1);
+	return i;
+}
+
+/**
+	* Double the table once it is three quarters full
+	*
+	* @return true if there is room for another entry
+	*/
+static bool vars_grow() {
+	var_entry* old = table;
+	size_t old_size = table_size;
+	size_t i;
+
+	if ( table && (table_used + 1) * 4 < table_size * 3 )
+		return true;
+
+	table_size = old ? old_size * 2 : VARS_INIT_SIZE;
+	if ( !(table = calloc(table_size, sizeof(var_entry))) ) {
+		table = old;
+		table_size = old_size;
+		return false;
+	}
+
+	for ( i = 0; i < old_size; i++ ) {
+		if ( old[i].str )
+			table[vars_slot(old[i].str, old[i].name_len)] = old[i];
+	}
+	free(old);
+	return true;
+}
+
+/**
+	* Empty a slot, shifting later entries of the same probe run back so
+	* lookups never stop early
+	*
+	* @param i slot to clear
+	*/
+static void vars_erase(size_t i) {
+	size_t j = i, k;
+
+	table[i].str = NULL;
+	for ( ;; ) {
+		j = (j + 1) & (table_size - 1);
+		if ( !table[j].str )
+			return;
+		k = vars_hash(table[j].str, table[j].name_len) & (table_size - 1);
+
+		// Move j into the hole unless its home lies cyclically in (i, j]
+		if ( (i <= j) ? (k <= i || k > j) : (k <= i && k > j) ) {
+			table[i] = table[j];
+			table[j].str = NULL;
+			i = j;
+		}
+	}
+}
+
+/**
+	* Store NAME=VALUE under a name
+	*
+	* @param name start of the name
+	* @param len length of the name
+	* @param value new value
+	* @param export export the variable
+	* @return false if out of memory
+	*/
+static bool vars_store(const char* name, size_t len, const char* value, bool export) {
+	size_t vlen = strlen(value), i;
+	char* str;
+
+	if ( !vars_grow() || !(str = malloc(len + vlen + 2)) )
+		return false;
+	memcpy(str, name, len);
+	str[len] = '=';
+	memcpy(str + len + 1, value, vlen + 1);
+
+	i = vars_slot(name, len);
+	if ( table[i].str ) {
+		free(table[i].str);
+		export = export || table[i].exported;
+	}
+	else
+		table_used++;
+	table[i] = (var_entry) { str, len, export };
+	if ( export )
+		env_stale = true;
+	return true;
+}
+
+/**
+	* Order variables by name for qsort
+	*/
+static int vars_cmp(const void* a, const void* b) {
+	return strcmp((*(const var_entry* const*) a)->str, (*(const var_entry* const*) b)->str);
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Import an environment. Every variable in it is exported.
+	*
+	* @param envp NULL terminated NAME=VALUE strings
+	*/
+void vars_init(char** envp) {
+	size_t i, len;
+
+	for ( i = 0; envp && envp[i]; i++ ) {
+		if ( (len = vars_name_len(envp[i])) && envp[i][len] == '=' )
+			vars_store(envp[i], len, envp[i] + len + 1, true);
+	}
+}
+
+/**
+	* Length of the variable name at the start of a string
+	*
+	* @param s string
+	* @return number of name characters ([A-Za-z_][A-Za-z0-9_]*), 0 if none
+	*/
+size_t vars_name_len(const char* s) {
+	size_t len = 0;
+
+	if ( !(s[0] == '_' || (s[0] >= 'A' && s[0] <= 'Z') || (s[0] >= 'a' && s[0] <= 'z')) )
+		return 0;
+	while ( s[len] == '_' || (s[len] >= 'A' && s[len] <= 'Z') || (s[len] >= 'a' && s[len] <= 'z')
+		|| (s[len] >= '0' && s[len] <= '9') )
+		len++;
+	return len;
+}
+
+/**
+	* Value of a variable
+	*
+	* @param name variable name
+	* @return value, or NULL if the variable is not set
+	*/
+const char* vars_get(const char* name) {
+	return vars_getn(name, strlen(name));
+}
+
+/**
+	* Value of a variable whose name is not NUL terminated
+	*
+	* @param name start of the name
+	* @param len length of the name
+	* @return value, or NULL if the variable is not set
+	*/
+const char* vars_getn(const char* name, size_t len) {
+	size_t i;
+
+	if ( !table_used )
+		return NULL;
+	i = vars_slot(name, len);
+	return table[i].str ? table[i].str + len + 1 : NULL;
+}
+
+/**
+	* Set a variable. A variable that is already exported stays exported.
+	*
+	* @param name variable name
+	* @param value new value
+	* @param export export the variable
+	* @return false if name is not a valid name or out of memory
+	*/
+bool vars_set(const char* name, const char* value, bool export) {
+	size_t len = vars_name_len(name);
+
+	if ( !len || name[len] )
+		return false;
+	return vars_store(name, len, value, export);
+}
+
+/**
+	* Export a variable that is already set
+	*
+	* @param name variable name
+	* @return false if the variable is not set
+	*/
+bool vars_export(const char* name) {
+	size_t i;
+
+	if ( !table_used )
+		return false;
+	i = vars_slot(name, strlen(name));
+	if ( !table[i].str )
+		return false;
+	if ( !table[i].exported ) {
+		table[i].exported = true;
+		env_stale = true;
+	}
+	return true;
+}
+
+/**
+	* Remove a variable
+	*
+	* @param name variable name
+	* @return false if the variable was not set
+	*/
+bool vars_unset(const char* name) {
+	size_t i;
+
+	if ( !table_used )
+		return false;
+	i = vars_slot(name, strlen(name));
+	if ( !table[i].str )
+		return false;
+	if ( table[i].exported )
+		env_stale = true;
+	free(table[i].str);
+	vars_erase(i);
+	table_used--;
+	return true;
+}
+
+/**
+	* Environment for a launched command. The block is rebuilt only when an
+	* exported variable has changed since the last call.
+	*
+	* @return NULL terminated NAME=VALUE strings
+	*/
+char** vars_envp() {
+	static char* empty[] = { NULL };
+	size_t i, n = 0, bytes = 0;
+	char** block;
+	char* strings;
+
+	if ( !env_stale && env_block )
+		return env_block;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Size, then pack pointers and strings into one allocation
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 0; i < table_size; i++ ) {
+		if ( table[i].str && table[i].exported ) {
+			n++;
+			bytes += strlen(table[i].str) + 1;
+		}
+	}
+	if ( !(block = malloc((n + 1) * sizeof(char*) + bytes)) )
+		return env_block ? env_block : empty;
+
+	strings = (char*) (block + n + 1);
+	for ( i = 0, n = 0; i < table_size; i++ ) {
+		if ( table[i].str && table[i].exported ) {
+			block[n++] = strings;
+			strings = stpcpy(strings, table[i].str) + 1;
+		}
+	}
+	block[n] = NULL;
+
+	free(env_block);
+	env_block = block;
+	env_stale = false;
+	return env_block;
+}
+
+/**
+	* Print variables as NAME=VALUE, sorted by name
+	*
+	* @param out stream to print to
+	* @param exported_only skip local variables
+	* @param prefix printed before each variable (e.g. "export ")
+	*/
+void vars_print(FILE* out, bool exported_only, const char* prefix) {
+	var_entry** sorted = malloc((table_used + 1) * sizeof(var_entry*));
+	size_t i, n = 0;
+
+	if ( !sorted )
+		return;
+	for ( i = 0; i < table_size; i++ ) {
+		if ( table[i].str && (table[i].exported || !exported_only) )
+			sorted[n++] = &table[i];
+	}
+	qsort(sorted, n, sizeof(var_entry*), vars_cmp);
+	for ( i = 0; i < n; i++ )
+		fprintf(out, "%s%s\n", prefix, sorted[i]->str);
+	free(sorted);
+}
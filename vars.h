@@ -0,0 +1,107 @@
+/**
+	* @file vars.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Shell variable store. Variables live in an open addressing hash table,
+	* each one local to the shell or exported to the commands it starts. The
+	* exported ones are packed into a single envp block that is rebuilt only
+	* after an exported variable changes, so a launch never walks the table.
+	*/
+
+#ifndef VARS_H
+#define VARS_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+	* Specify the initial number of slots in the variable table (power of two)
+	*/
+#define VARS_INIT_SIZE (64)
+
+/**
+	* Import an environment. Every variable in it is exported.
+	*
+	* @param envp NULL terminated NAME=VALUE strings
+	*/
+void vars_init(char** envp);
+
+/**
+	* Length of the variable name at the start of a string
+	*
+	* @param s string
+	* @return number of name characters ([A-Za-z_][A-Za-z0-9_]*), 0 if none
+	*/
+size_t vars_name_len(const char* s);
+
+/**
+	* Value of a variable
+	*
+	* @param name variable name
+	* @return value, or NULL if the variable is not set
+	*/
+const char* vars_get(const char* name);
+
+/**
+	* Value of a variable whose name is not NUL terminated
+	*
+	* @param name start of the name
+	* @param len length of the name
+	* @return value, or NULL if the variable is not set
+	*/
+const char* vars_getn(const char* name, size_t len);
+
+/**
+	* Set a variable. A variable that is already exported stays exported.
+	*
+	* @param name variable name
+	* @param value new value
+	* @param export export the variable
+	* @return false if name is not a valid name or out of memory
+	*/
+bool vars_set(const char* name, const char* value, bool export);
+
+/**
+	* Export a variable that is already set
+	*
+	* @param name variable name
+	* @return false if the variable is not set
+	*/
+bool vars_export(const char* name);
+
+/**
+	* Remove a variable
+	*
+	* @param name variable name
+	* @return false if the variable was not set
+	*/
+bool vars_unset(const char* name);
+
+/**
+	* Environment for a launched command: every exported variable, in one
+	* block that stays valid until the next call
+	*
+	* @return NULL terminated NAME=VALUE strings
+	*/
+char** vars_envp();
+
+/**
+	* Print variables as NAME=VALUE, sorted by name
+	*
+	* @param out stream to print to
+	* @param exported_only skip local variables
+	* @param prefix printed before each variable (e.g. "export ")
+	*/
+void vars_print(FILE* out, bool exported_only, const char* prefix);
+
+#endif // VARS_H
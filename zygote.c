@@ -0,0 +1,446 @@
+/**
+ * @file zygote.c
+ *
+ * Gehrig Keane
+ * Joeseph Champion
+ *
+ * Fork server for low-latency command launch
+	*/
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include "zygote.h"
+#include "fdreg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+/**************************************************************************
+ * Private Variables
+ **************************************************************************/
+/**
+	* Shell's end of the socketpair, -1 if no fork server is running
+	*/
+static int zygote_fd = -1;
+
+/**
+	* Request buffer (grown on demand on the shell side)
+	*/
+static char* msg = NULL;
+
+/**
+	* Size of msg
+	*/
+static size_t msg_cap = 0;
+
+/**************************************************************************
+ * Private Functions
+ **************************************************************************/
+/**
+	* Make room in the request buffer
+	*
+	* @param len bytes needed
+	* @return true on success
+	*/
+static bool zygote_reserve(size_t len) {
+	char* grown;
+
+	if ( len <= msg_cap )
+		return true;
+	if ( !(grown = realloc(msg, len)) )
+		return false;
+	msg = grown;
+	msg_cap = len;
+	return true;
+}
+
+/**
+	* Send a message, optionally with descriptors
+	*
+	* @param fd socket
+	* @param data message
+	* @param len message length
+	* @param fds descriptors to pass
+	* @param num_fds number of descriptors
+	* @return true on success
+	*/
+static bool zygote_send(int fd, const void* data, size_t len, const int* fds, int num_fds) {
+	union {
+		char buf[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { (void*) data, len };
+	struct msghdr mh = { 0 };
+	struct cmsghdr* cm;
+
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if ( num_fds ) {
+		mh.msg_control = control.buf;
+		mh.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+		cm = CMSG_FIRSTHDR(&mh);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+		memcpy(CMSG_DATA(cm), fds, num_fds * sizeof(int));
+	}
+
+	while ( sendmsg(fd, &mh, MSG_NOSIGNAL) < 0 ) {
+		if ( errno != EINTR )
+			return false;
+	}
+	return true;
+}
+
+/**
+	* Receive a reply from the fork server
+	*
+	* @param reply receives the reply
+	* @return true on success
+	*/
+static bool zygote_recv_reply(zygote_reply* reply) {
+	ssize_t n;
+
+	while ( (n = recv(zygote_fd, reply, sizeof(*reply), 0)) < 0 && errno == EINTR );
+	return n == sizeof(*reply);
+}
+
+/**
+	* Fork server side of a spawn request: fork, apply the file actions and
+	* exec. A close-on-exec pipe tells the server whether the exec worked.
+	*
+	* @param req request
+	* @param strings path, argv and envp strings
+	* @param fds received descriptors (stdin, stdout, stderr, action sources)
+	* @param num_fds number of received descriptors
+	* @param reply receives the result
+	*/
+static void zygote_do_spawn(zygote_req* req, char* strings, int* fds, int num_fds, zygote_reply* reply) {
+	char** argv = malloc((req->argc + req->envc + 2) * sizeof(char*));
+	char** envp = argv + req->argc + 1;
+	char* path = strings;
+	int errpipe[2], err, i;
+	spawn_t sp;
+	ssize_t n;
+
+	reply->pid = -1;
+	reply->err = !argv ? ENOMEM : EINVAL;
+	if ( !argv || num_fds < 3 ) {
+		free(argv);
+		return;
+	}
+	if ( pipe2(errpipe, O_CLOEXEC) < 0 ) {
+		reply->err = errno;
+		free(argv);
+		return;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Unpack the strings and translate actions to the received descriptors
+	////////////////////////////////////////////////////////////////////////////////
+	strings += strlen(strings) + 1;
+	for ( i = 0; i < req->argc; i++, strings += strlen(strings) + 1 )
+		argv[i] = strings;
+	argv[i] = NULL;
+	for ( i = 0; i < req->envc; i++, strings += strlen(strings) + 1 )
+		envp[i] = strings;
+	envp[i] = NULL;
+
+	spawn_reset(&sp);
+	for ( i = 0; i < 3; i++ )
+		spawn_add_dup2(&sp, fds[i], i);
+	for ( i = 0; i < req->num_actions; i++ ) {
+		if ( req->actions[i].type == SPAWN_CLOSE )
+			spawn_add_close(&sp, req->actions[i].fd);
+		else if ( req->actions[i].src >= 0 && req->actions[i].src < num_fds )
+			spawn_add_dup2(&sp, fds[req->actions[i].src], req->actions[i].fd);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Fork from the small image
+	////////////////////////////////////////////////////////////////////////////////
+	if ( (reply->pid = fork()) == 0 ) {
+		spawn_child_setup(&sp);
+		execve(path, argv, envp);
+		err = errno;
+		if ( write(errpipe[1], &err, sizeof(err)) < 0 ) {}
+		_exit(127);
+	}
+	err = errno;
+	close(errpipe[1]);
+
+	if ( reply->pid < 0 )
+		reply->err = err;
+	else if ( (n = read(errpipe[0], &err, sizeof(err))) == sizeof(err) ) {
+		waitpid(reply->pid, NULL, 0);
+		reply->pid = -1;
+		reply->err = err;
+	}
+	close(errpipe[0]);
+	free(argv);
+}
+
+/**
+	* Fork server main loop. Never returns.
+	*
+	* @param sock server's end of the socketpair
+	*/
+static void zygote_main(int sock) {
+	union {
+		char buf[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	char* buf = malloc(ZYGOTE_MAX_MSG);
+	int fds[ZYGOTE_MAX_FDS];
+	zygote_reply reply;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr* cm;
+	int num_fds, i;
+	ssize_t n;
+
+	if ( !buf )
+		_exit(EXIT_FAILURE);
+
+	for ( ;; ) {
+		iov.iov_base = buf;
+		iov.iov_len = ZYGOTE_MAX_MSG;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = control.buf;
+		mh.msg_controllen = sizeof(control.buf);
+
+		if ( (n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			_exit(EXIT_SUCCESS);		// the shell is gone
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Park received descriptors out of the way of the child's targets
+		////////////////////////////////////////////////////////////////////////////////
+		num_fds = 0;
+		for ( cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm) ) {
+			if ( cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS )
+				continue;
+			num_fds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cm), num_fds * sizeof(int));
+		}
+		for ( i = 0; i < num_fds; i++ ) {
+			int parked = fcntl(fds[i], F_DUPFD_CLOEXEC, ZYGOTE_FD_BASE);
+			close(fds[i]);
+			fds[i] = parked;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Serve the request
+		////////////////////////////////////////////////////////////////////////////////
+		zygote_req* req = (zygote_req*) buf;
+		memset(&reply, 0, sizeof(reply));
+		if ( (size_t) n < sizeof(*req) || (mh.msg_flags & MSG_TRUNC) ) {
+			reply.pid = -1;
+			reply.err = E2BIG;
+		}
+		else if ( req->op == ZYGOTE_SPAWN ) {
+			buf[n - 1] = '\0';
+			zygote_do_spawn(req, buf + sizeof(*req), fds, num_fds, &reply);
+		}
+		else {
+			while ( (reply.pid = wait4(req->pid, &reply.status, 0, &reply.ru)) < 0 && errno == EINTR );
+			reply.err = errno;
+		}
+
+		for ( i = 0; i < num_fds; i++ )
+			close(fds[i]);
+		zygote_send(sock, &reply, sizeof(reply), NULL, 0);
+	}
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+	* Start the fork server
+	*
+	* @return true if it is running
+	*/
+bool zygote_start() {
+	int sv[2], size = ZYGOTE_MAX_MSG * 2;
+	pid_t p;
+
+	if ( zygote_fd >= 0 )
+		return true;
+	if ( socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0 )
+		return false;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	fflush(stdout);
+	fflush(stderr);
+	if ( (p = fork()) < 0 ) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Server - keep stdio and the socket only, and leave ^C to the children
+	////////////////////////////////////////////////////////////////////////////////
+	if ( p == 0 ) {
+		if ( dup2(sv[1], 3) < 0 )
+			_exit(EXIT_FAILURE);
+		close_range(4, ~0U, 0);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+		zygote_main(3);
+	}
+
+	close(sv[1]);
+	zygote_fd = fdreg_track(sv[0], FD_SHELL, 0, "fork server socket");
+	return true;
+}
+
+/**
+	* Launch a command through the fork server
+	*
+	* @param sp launch description, may be NULL
+	* @param path resolved executable path
+	* @param argv argument vector
+	* @param envp environment variables
+	* @return pid, -1 with errno set to the launch error, or -2 if the fork
+	*         server cannot take the request (use another backend)
+	*/
+pid_t zygote_spawn(spawn_t* sp, const char* path, char* argv[], char* envp[]) {
+	int fds[ZYGOTE_MAX_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	int num_fds = 3, i, j;
+	zygote_reply reply;
+	zygote_req* req;
+	size_t len, n;
+
+	if ( zygote_fd < 0 )
+		return -2;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Size and pack the request
+	////////////////////////////////////////////////////////////////////////////////
+	len = sizeof(zygote_req) + strlen(path) + 1;
+	for ( i = 0; argv[i]; i++ )
+		len += strlen(argv[i]) + 1;
+	for ( j = 0; envp && envp[j]; j++ )
+		len += strlen(envp[j]) + 1;
+	if ( len > ZYGOTE_MAX_MSG || !zygote_reserve(len) )
+		return -2;
+
+	req = (zygote_req*) msg;
+	memset(req, 0, sizeof(*req));
+	req->op = ZYGOTE_SPAWN;
+	req->argc = i;
+	req->envc = j;
+
+	n = sizeof(*req);
+	n += stpcpy(msg + n, path) - (msg + n) + 1;
+	for ( i = 0; argv[i]; i++ )
+		n += stpcpy(msg + n, argv[i]) - (msg + n) + 1;
+	for ( j = 0; envp && envp[j]; j++ )
+		n += stpcpy(msg + n, envp[j]) - (msg + n) + 1;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// dup2 sources travel as SCM_RIGHTS. Closes of those sources are dropped:
+	// the server's copies are close-on-exec already.
+	////////////////////////////////////////////////////////////////////////////////
+	for ( i = 0; sp && i < sp->num_actions; i++ ) {
+		spawn_action* a = &sp->actions[i];
+
+		if ( a->type == SPAWN_DUP2 ) {
+			fds[num_fds] = a->src;
+			req->actions[req->num_actions] = *a;
+			req->actions[req->num_actions++].src = num_fds++;
+			continue;
+		}
+		for ( j = 3; j < num_fds && fds[j] != a->fd; j++ ) {}
+		if ( j == num_fds )
+			req->actions[req->num_actions++] = *a;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Round trip
+	////////////////////////////////////////////////////////////////////////////////
+	if ( !zygote_send(zygote_fd, msg, len, fds, num_fds) ) {
+		if ( errno != EMSGSIZE )
+			zygote_stop();
+		return -2;
+	}
+	if ( !zygote_recv_reply(&reply) ) {
+		zygote_stop();
+		return -2;
+	}
+
+	if ( reply.pid < 0 )
+		errno = reply.err;
+	return reply.pid;
+}
+
+/**
+	* Wait for a command the fork server started
+	*
+	* @param pid child pid
+	* @param status receives the wait status
+	* @param ru receives the resource usage
+	* @return pid, or -1 with errno set on failure
+	*/
+pid_t zygote_wait(pid_t pid, int* status, struct rusage* ru) {
+	zygote_req req;
+	zygote_reply reply;
+
+	if ( zygote_fd < 0 ) {
+		errno = ECHILD;
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.op = ZYGOTE_WAIT;
+	req.pid = pid;
+	if ( !zygote_send(zygote_fd, &req, sizeof(req), NULL, 0) || !zygote_recv_reply(&reply) ) {
+		zygote_stop();
+		errno = ECHILD;
+		return -1;
+	}
+
+	if ( reply.pid < 0 ) {
+		errno = reply.err;
+		return -1;
+	}
+	*status = reply.status;
+	if ( ru )
+		*ru = reply.ru;
+	return reply.pid;
+}
+
+/**
+	* Query whether the fork server is available
+	*
+	* @return true if requests can be sent
+	*/
+bool zygote_running() {
+	return zygote_fd >= 0;
+}
+
+/**
+	* Drop this process's connection to the fork server (forked children of
+	* the shell must not share it). The server exits once the shell does.
+	*/
+void zygote_stop() {
+	if ( zygote_fd >= 0 )
+		fdreg_close(zygote_fd);
+	zygote_fd = -1;
+}
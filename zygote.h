@@ -0,0 +1,121 @@
+/**
+	* @file zygote.h
+	*
+	* Gehrig Keane
+	* Joeseph Champion
+	*
+	* Fork server. At startup, before the shell has grown, quash forks a tiny
+	* helper that keeps only its stdio and one end of a UNIX socketpair. Launch
+	* requests (path, argv, envp and file actions, with the descriptors passed
+	* via SCM_RIGHTS) are forked and exec'd from the helper's small image, and
+	* the helper reaps the children and reports their status and rusage back.
+	*/
+
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+/**
+	* Defines GNU Source type for compialtion
+	*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "spawn.h"
+
+/**
+	* Specify the largest request the fork server accepts (path, argv and envp
+	* included). Larger launches fall back to another backend.
+	*/
+#define ZYGOTE_MAX_MSG (192 * 1024)
+
+/**
+	* Specify the most descriptors passed with one request (stdio + actions)
+	*/
+#define ZYGOTE_MAX_FDS (3 + MAX_SPAWN_ACTIONS)
+
+/**
+	* Specify the lowest descriptor the fork server parks received fds at, so
+	* they never collide with the targets of a child's file actions
+	*/
+#define ZYGOTE_FD_BASE (100)
+
+/**
+	* Requests understood by the fork server
+	*/
+typedef enum zygote_op {
+	ZYGOTE_SPAWN,							///< fork + exec a command
+	ZYGOTE_WAIT								///< wait for a command started earlier
+} zygote_op;
+
+/**
+	* Fixed part of a request. A spawn request is followed by the path, argv
+	* and envp strings, each NUL terminated, and carries the caller's stdin,
+	* stdout, stderr and every dup2 source as SCM_RIGHTS.
+	*/
+typedef struct zygote_req {
+	zygote_op op;							///< request type
+	pid_t pid;								///< child to wait for (ZYGOTE_WAIT)
+	int argc;								///< number of argv strings
+	int envc;								///< number of envp strings
+	int num_actions;						///< number of file actions
+	spawn_action actions[MAX_SPAWN_ACTIONS];	///< actions, dup2 src is an index into the passed fds
+} zygote_req;
+
+/**
+	* Reply to a request
+	*/
+typedef struct zygote_reply {
+	pid_t pid;								///< child pid, or -1 on failure
+	int err;								///< errno of a failed request
+	int status;								///< wait status (ZYGOTE_WAIT)
+	struct rusage ru;						///< child's resource usage (ZYGOTE_WAIT)
+} zygote_reply;
+
+/**
+	* Start the fork server
+	*
+	* @return true if it is running
+	*/
+bool zygote_start();
+
+/**
+	* Launch a command through the fork server
+	*
+	* @param sp launch description, may be NULL
+	* @param path resolved executable path
+	* @param argv argument vector
+	* @param envp environment variables
+	* @return pid, -1 with errno set to the launch error, or -2 if the fork
+	*         server cannot take the request (use another backend)
+	*/
+pid_t zygote_spawn(spawn_t* sp, const char* path, char* argv[], char* envp[]);
+
+/**
+	* Wait for a command the fork server started
+	*
+	* @param pid child pid
+	* @param status receives the wait status
+	* @param ru receives the resource usage
+	* @return pid, or -1 with errno set on failure
+	*/
+pid_t zygote_wait(pid_t pid, int* status, struct rusage* ru);
+
+/**
+	* Query whether the fork server is available
+	*
+	* @return true if requests can be sent
+	*/
+bool zygote_running();
+
+/**
+	* Drop this process's connection to the fork server (forked children of
+	* the shell must not share it). The server exits once the shell does.
+	*/
+void zygote_stop();
+
+#endif // ZYGOTE_H